@@ -0,0 +1,130 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef BITS_HH
+#define BITS_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace ben {
+    enum class bit_order { MSB, LSB };
+
+    /* Reads bit fields from byte array, refilling 64-bit buffer a word at
+       a time. In MSB order, bits are taken from the most significant bit
+       of each byte first and the buffer is kept left-aligned; in LSB order,
+       from the least significant bit and the buffer is right-aligned. */
+    template <bit_order Order> class bit_reader {
+        std::uint8_t const *data;
+        std::size_t size;
+        std::size_t pos = 0;
+        std::uint64_t buf = 0;
+        unsigned int count = 0;
+
+        static std::uint64_t load64(std::uint8_t const *p) {
+            std::uint64_t word;
+            std::memcpy(&word, p, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            if (Order == bit_order::MSB) word = __builtin_bswap64(word);
+#else
+            if (Order == bit_order::LSB) word = __builtin_bswap64(word);
+#endif
+            return word;
+        }
+
+        void refill() {
+            if (size - pos >= 8) {
+                /* Bits beyond `count' are loaded too, but they are the
+                   same bits the next refill loads, so OR-ing is safe. */
+                if (Order == bit_order::MSB) {
+                    buf |= load64(data + pos) >> count;
+                } else {
+                    buf |= load64(data + pos) << count;
+                }
+                pos += (63 - count) >> 3;
+                count |= 56;
+                return;
+            }
+            while (count <= 56 && pos < size) {
+                if (Order == bit_order::MSB) {
+                    buf |= static_cast<std::uint64_t>(data[pos])
+                           << (56 - count);
+                } else {
+                    buf |= static_cast<std::uint64_t>(data[pos]) << count;
+                }
+                ++pos;
+                count += 8;
+            }
+        }
+
+        /* N must be in 1..56. */
+        std::uint64_t take(unsigned int n) {
+            if (count < n) refill();
+            std::uint64_t value;
+            if (Order == bit_order::MSB) {
+                value = buf >> (64 - n);
+                buf <<= n;
+            } else {
+                value = buf & ((std::uint64_t(1) << n) - 1);
+                buf >>= n;
+            }
+            count -= n;
+            return value;
+        }
+
+    public:
+        bit_reader(std::uint8_t const *data, std::size_t size)
+            : data(data), size(size) {}
+
+        std::size_t remaining() const { return (size - pos) * 8 + count; }
+
+        std::uint64_t read(unsigned int n) {
+            if (n == 0) return 0;
+            if (n > 64 || n > remaining()) {
+                throw std::runtime_error("Bit field exceeds buffer.");
+            }
+            if (n <= 56) return take(n);
+
+            if (Order == bit_order::MSB) {
+                std::uint64_t hi = take(n - 32);
+                return hi << 32 | take(32);
+            } else {
+                std::uint64_t lo = take(32);
+                return lo | take(n - 32) << 32;
+            }
+        }
+
+        void skip(std::size_t n) {
+            if (n > remaining()) {
+                throw std::runtime_error("Bit field exceeds buffer.");
+            }
+            if (n >= count) {
+                n -= count;
+                buf = 0;
+                count = 0;
+                pos += n >> 3;
+                n &= 7;
+            }
+            if (n) take(n);
+        }
+    };
+} // namespace ben
+
+#endif
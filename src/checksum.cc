@@ -0,0 +1,366 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "command.hh"
+#include "file.hh"
+#include "option.hh"
+#include "parallel.hh"
+
+namespace ben {
+    namespace {
+        enum class checksum_algo { CRC32, CRC32C, ADLER32, SUM8, SUM16, SUM32 };
+
+        constexpr std::size_t max_results = 1000;
+        constexpr std::size_t grain = 1 << 16;
+        constexpr std::uint32_t adler_mod = 65521;
+
+        struct range {
+            std::size_t start;
+            std::size_t end;
+        };
+
+        /* Ranges found by one chunk of start offsets. Only the first
+           max_results are kept, but all are counted unless EXACT is
+           cleared. */
+        struct chunk_result {
+            std::vector<range> ranges;
+            std::size_t count = 0;
+            bool exact = true;
+
+            bool full() const { return ranges.size() == max_results; }
+
+            void add(std::size_t start, std::size_t end) {
+                if (!full()) ranges.push_back({start, end});
+                ++count;
+            }
+        };
+
+        /* Concatenates chunk results, which keeps them ordered by start
+           offset. Returns number of all ranges found. */
+        std::size_t merge_results(std::vector<chunk_result> const &chunks,
+                                  std::vector<range> &out) {
+            std::size_t count = 0;
+            for (chunk_result const &c : chunks) {
+                count += c.count;
+                for (range const &r : c.ranges) {
+                    if (out.size() == max_results) break;
+                    out.push_back(r);
+                }
+            }
+            return count;
+        }
+
+        /*
+         * Finds every pair s < e with A[s] == B[e]. Both vectors hold one
+         * key per position 0..N. B is sorted once and each start offset
+         * looks its key up, in parallel over start offsets.
+         */
+        std::size_t join_keys(std::vector<std::uint32_t> const &a,
+                              std::vector<std::uint32_t> const &b,
+                              std::vector<range> &out) {
+            std::size_t n = a.size() - 1;
+            std::vector<std::pair<std::uint32_t, std::size_t>> index;
+            index.reserve(n);
+            for (std::size_t e = 1; e <= n; ++e) index.emplace_back(b[e], e);
+            std::sort(index.begin(), index.end());
+
+            std::vector<chunk_result> chunks((n + grain - 1) / grain);
+            parallel_for(n, grain, [&](std::size_t begin, std::size_t end) {
+                chunk_result &res = chunks[begin / grain];
+                for (std::size_t s = begin; s < end; ++s) {
+                    auto itr = std::lower_bound(index.begin(), index.end(),
+                                                std::make_pair(a[s], s + 1));
+                    auto last = std::upper_bound(
+                        itr, index.end(), std::make_pair(a[s], SIZE_MAX));
+                    /* Matches are counted at once; only those kept are
+                       walked. */
+                    res.count += last - itr;
+                    for (; itr != last && !res.full(); ++itr) {
+                        res.ranges.push_back({s, itr->second});
+                    }
+                }
+            });
+            return merge_results(chunks, out);
+        }
+
+        using crc_table = std::array<std::uint32_t, 256>;
+
+        crc_table make_crc_table(std::uint32_t poly) {
+            crc_table table;
+            for (std::uint32_t i = 0; i < 256; ++i) {
+                std::uint32_t c = i;
+                for (int k = 0; k < 8; ++k) c = c & 1 ? c >> 1 ^ poly : c >> 1;
+                table[i] = c;
+            }
+            return table;
+        }
+
+        /* Linear map over GF(2)^32 stored as images of each bit. */
+        struct gf2_matrix {
+            std::array<std::uint32_t, 32> col;
+        };
+
+        inline std::uint32_t apply(gf2_matrix const &m, std::uint32_t v) {
+            std::uint32_t r = 0;
+            for (int j = 0; j < 32; ++j) r ^= m.col[j] & (0 - (v >> j & 1));
+            return r;
+        }
+
+        gf2_matrix compose(gf2_matrix const &a, gf2_matrix const &b) {
+            gf2_matrix c;
+            for (int j = 0; j < 32; ++j) c.col[j] = apply(a, b.col[j]);
+            return c;
+        }
+
+        gf2_matrix power(gf2_matrix m, std::size_t k) {
+            gf2_matrix r;
+            for (int j = 0; j < 32; ++j) r.col[j] = std::uint32_t(1) << j;
+            for (; k; k >>= 1) {
+                if (k & 1) r = compose(m, r);
+                m = compose(m, m);
+            }
+            return r;
+        }
+
+        /* Advances CRC register through one zero byte. */
+        inline std::uint32_t crc_zero(crc_table const &t, std::uint32_t r) {
+            return r >> 8 ^ t[r & 0xff];
+        }
+
+        /*
+         * Let P[k] be the CRC register after the first k bytes starting
+         * from 0 and Z the map advancing the register by one zero byte.
+         * By linearity, the register for [s, e) with initial value I is
+         * Z^(e-s)(I ^ P[s]) ^ P[e], so the range has checksum VALUE iff
+         * Z^(N-s)(I ^ P[s]) == Z^(N-e)(VALUE ^ XOROUT ^ P[e]). Both sides
+         * depend on one end only, which turns the search into a join.
+         */
+        std::size_t find_crc(std::uint32_t poly, std::uint32_t value,
+                             std::uint8_t const *data, std::size_t n,
+                             std::vector<range> &out) {
+            constexpr std::uint32_t init = 0xffffffff;
+            constexpr std::uint32_t xorout = 0xffffffff;
+            crc_table const table = make_crc_table(poly);
+
+            std::vector<std::uint32_t> prefix(n + 1);
+            std::uint32_t reg = 0;
+            for (std::size_t i = 0; i < n; ++i) {
+                prefix[i] = reg;
+                reg = reg >> 8 ^ table[(reg ^ data[i]) & 0xff];
+            }
+            prefix[n] = reg;
+
+            gf2_matrix zero;
+            for (int j = 0; j < 32; ++j) {
+                zero.col[j] = crc_zero(table, std::uint32_t(1) << j);
+            }
+
+            std::vector<std::uint32_t> a(n + 1), b(n + 1);
+            std::uint32_t target = value ^ xorout;
+            parallel_for(n + 1, grain, [&](std::size_t begin, std::size_t end) {
+                gf2_matrix g = power(zero, n - (end - 1));
+                for (std::size_t k = end; k-- > begin;) {
+                    a[k] = apply(g, init ^ prefix[k]);
+                    b[k] = apply(g, target ^ prefix[k]);
+                    for (int j = 0; j < 32; ++j) {
+                        g.col[j] = crc_zero(table, g.col[j]);
+                    }
+                }
+            });
+            return join_keys(a, b, out);
+        }
+
+        std::size_t find_sum(unsigned int bits, std::uint32_t value,
+                             std::uint8_t const *data, std::size_t n,
+                             std::vector<range> &out) {
+            std::uint32_t mask =
+                bits == 32 ? 0xffffffff : (std::uint32_t(1) << bits) - 1;
+            std::vector<std::uint32_t> a(n + 1), b(n + 1);
+            std::uint32_t sum = 0;
+            for (std::size_t i = 0;; ++i) {
+                a[i] = sum & mask;
+                b[i] = (sum - value) & mask;
+                if (i == n) break;
+                sum += data[i];
+            }
+            return join_keys(a, b, out);
+        }
+
+        /*
+         * With prefix sums S1[k] of bytes and T1[k] of S1[1..k], Adler-32
+         * of [s, e) is A = 1 + S1[e] - S1[s] and
+         * B = L + T1[e] - T1[s] - L * S1[s] modulo 65521, where L = e - s.
+         * Ends whose S1 satisfies A are looked up by key and B is checked
+         * for each of them.
+         */
+        std::size_t find_adler(std::uint32_t value, std::uint8_t const *data,
+                               std::size_t n, std::vector<range> &out,
+                               bool &exact) {
+            std::uint32_t va = value & 0xffff;
+            std::uint32_t vb = value >> 16;
+            if (va >= adler_mod || vb >= adler_mod) {
+                throw std::runtime_error(
+                    "VALUE is not a valid Adler-32 checksum.");
+            }
+
+            std::vector<std::uint32_t> s1(n + 1), t1(n + 1);
+            for (std::size_t i = 0; i < n; ++i) {
+                s1[i + 1] = (s1[i] + data[i]) % adler_mod;
+                t1[i + 1] = (t1[i] + s1[i + 1]) % adler_mod;
+            }
+
+            std::vector<std::pair<std::uint32_t, std::size_t>> index;
+            index.reserve(n);
+            for (std::size_t e = 1; e <= n; ++e) index.emplace_back(s1[e], e);
+            std::sort(index.begin(), index.end());
+
+            std::vector<chunk_result> chunks((n + grain - 1) / grain);
+            parallel_for(n, grain, [&](std::size_t begin, std::size_t end) {
+                chunk_result &res = chunks[begin / grain];
+                /* B must be checked per candidate, so counting every
+                   match would take as long as finding it. Stop once a
+                   chunk has as many as can be shown. */
+                for (std::size_t s = begin; s < end && !res.full(); ++s) {
+                    std::uint32_t key =
+                        (s1[s] + va + adler_mod - 1) % adler_mod;
+                    auto itr = std::lower_bound(index.begin(), index.end(),
+                                                std::make_pair(key, s + 1));
+                    for (; itr != index.end() && itr->first == key; ++itr) {
+                        std::size_t e = itr->second;
+                        std::uint64_t len = (e - s) % adler_mod;
+                        std::uint64_t b = len + t1[e] + adler_mod - t1[s] +
+                                          adler_mod * adler_mod -
+                                          len * s1[s];
+                        if (b % adler_mod == vb) res.add(s, e);
+                        if (res.full()) {
+                            res.exact = false;
+                            break;
+                        }
+                    }
+                }
+            });
+            for (chunk_result const &c : chunks) exact = exact && c.exact;
+            return merge_results(chunks, out);
+        }
+
+        void help_crcfind([[maybe_unused]] std::string cmd) {
+            std::cout << R"(usage: crcfind VALUE [ALGO] [BUF]
+Find byte ranges of the buffer whose checksum equals VALUE.
+ALGO is one of;
+  crc32    CRC-32 as used by zlib and PNG (default).
+  crc32c   CRC-32C (Castagnoli).
+  adler32  Adler-32 as used by zlib.
+  sum8, sum16, sum32
+           sum of bytes modulo 2^8, 2^16 or 2^32.
+Ranges are printed as START..END, END exclusive, ordered by START.
+At most 1000 ranges are printed and the rest are counted, except with
+adler32, which stops looking once enough are found. Every start offset
+is tried in parallel and no range is checksummed one by one.
+)";
+        }
+
+        int crcfind(std::vector<std::string> const &args) {
+            std::size_t value;
+            checksum_algo algo;
+            file *f;
+            try {
+                option_matcher opt(args);
+                value = opt.get_size();
+                algo = static_cast<checksum_algo>(opt.select_string(
+                    {"crc32", "crc32c", "adler32", "sum8", "sum16", "sum32"},
+                    0));
+                f = opt.get_file_or_default();
+                opt.must_not_remain();
+
+                std::size_t limit = algo == checksum_algo::SUM8    ? 0xff
+                                    : algo == checksum_algo::SUM16 ? 0xffff
+                                                                   : 0xffffffff;
+                if (value > limit) {
+                    throw std::runtime_error("VALUE is out of range.");
+                }
+            } catch (std::runtime_error const &e) {
+                std::cout << "crcfind: " << e.what() << '\n';
+                return 1;
+            }
+
+            std::uint8_t const *data = f->data.data();
+            std::size_t n = f->data.size();
+            std::vector<range> found;
+            std::size_t count;
+            bool exact = true;
+            try {
+                switch (algo) {
+                case checksum_algo::CRC32:
+                    count = find_crc(0xedb88320, value, data, n, found);
+                    break;
+                case checksum_algo::CRC32C:
+                    count = find_crc(0x82f63b78, value, data, n, found);
+                    break;
+                case checksum_algo::ADLER32:
+                    count = find_adler(value, data, n, found, exact);
+                    break;
+                case checksum_algo::SUM8:
+                    count = find_sum(8, value, data, n, found);
+                    break;
+                case checksum_algo::SUM16:
+                    count = find_sum(16, value, data, n, found);
+                    break;
+                default:
+                    count = find_sum(32, value, data, n, found);
+                    break;
+                }
+            } catch (std::runtime_error const &e) {
+                std::cout << "crcfind: " << e.what() << '\n';
+                return 1;
+            }
+
+            if (count == 0) {
+                std::cout << "crcfind: No range found.\n";
+                return 1;
+            }
+            for (range const &r : found) {
+                std::cout << std::hex << std::setfill('0') << std::setw(8)
+                          << r.start << ".." << std::setw(8) << r.end
+                          << std::dec << " (" << r.end - r.start
+                          << " bytes)\n";
+            }
+            if (count > found.size()) {
+                if (!exact) std::cout << "At least ";
+                std::cout << count - found.size() << " more ranges omitted.\n";
+            } else if (!exact) {
+                std::cout << "More ranges may be omitted.\n";
+            }
+            return 0;
+        }
+    } // namespace
+
+    void checksum_init() {
+        command_register("crcfind", &crcfind, &help_crcfind);
+    }
+} // namespace ben
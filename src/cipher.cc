@@ -0,0 +1,641 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <wmmintrin.h>
+#define HAVE_AESNI 1
+#endif
+
+#include "command.hh"
+#include "cpu.hh"
+#include "decode.hh"
+#include "file.hh"
+#include "hex.hh"
+#include "option.hh"
+#include "output.hh"
+#include "parallel.hh"
+
+namespace ben {
+    namespace {
+        enum class cipher { AES128_CBC, AES256_CTR, CHACHA20 };
+
+        char const *const cipher_names[] = {"aes-128-cbc", "aes-256-ctr",
+                                            "chacha20"};
+
+        /* Blocks processed by one task of parallel_for. */
+        constexpr std::size_t grain = 4096;
+
+        inline std::uint8_t xtime(std::uint8_t x) {
+            return x << 1 ^ (x & 0x80 ? 0x1b : 0);
+        }
+
+        std::uint8_t gmul(std::uint8_t a, std::uint8_t b) {
+            std::uint8_t r = 0;
+            for (; b; b >>= 1, a = xtime(a)) {
+                if (b & 1) r ^= a;
+            }
+            return r;
+        }
+
+        struct aes_sbox {
+            std::uint8_t fwd[256];
+            std::uint8_t inv[256];
+
+            aes_sbox() {
+                /* Walk the multiplicative group with generator 3 and its
+                   inverse, applying the affine transform to the inverse. */
+                std::uint8_t p = 1, q = 1;
+                do {
+                    p = p ^ xtime(p);
+                    q ^= q << 1;
+                    q ^= q << 2;
+                    q ^= q << 4;
+                    if (q & 0x80) q ^= 0x09;
+                    std::uint8_t x = q;
+                    for (int i = 1; i < 5; ++i) {
+                        x ^= static_cast<std::uint8_t>(q << i | q >> (8 - i));
+                    }
+                    fwd[p] = x ^ 0x63;
+                } while (p != 1);
+                fwd[0] = 0x63;
+                for (int i = 0; i < 256; ++i) inv[fwd[i]] = i;
+            }
+        };
+
+        aes_sbox const &sbox() {
+            static aes_sbox const s;
+            return s;
+        }
+
+#ifdef HAVE_AESNI
+        bool has_aesni() { return cpu::has(cpu::feature::AES); }
+
+        __attribute__((target("aes,sse2"))) void
+        aesni_decryption_keys(std::uint8_t const *ek, unsigned int nr,
+                              std::uint8_t *dk) {
+            std::memcpy(dk, ek + nr * 16, 16);
+            for (unsigned int r = 1; r < nr; ++r) {
+                __m128i k = _mm_loadu_si128(
+                    reinterpret_cast<__m128i const *>(ek + (nr - r) * 16));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dk + r * 16),
+                                 _mm_aesimc_si128(k));
+            }
+            std::memcpy(dk + nr * 16, ek, 16);
+        }
+
+        /* Runs N independent blocks through AES with round keys RK,
+           eight at a time to hide latency of the AES instructions. */
+        template <bool Decrypt>
+        __attribute__((target("aes,sse2"))) void
+        aesni_blocks(std::uint8_t const *rk, unsigned int nr,
+                     std::uint8_t const *in, std::uint8_t *out,
+                     std::size_t n) {
+            __m128i k[15];
+            for (unsigned int r = 0; r <= nr; ++r) {
+                k[r] = _mm_loadu_si128(
+                    reinterpret_cast<__m128i const *>(rk + r * 16));
+            }
+
+            std::size_t i = 0;
+            for (; i + 8 <= n; i += 8) {
+                __m128i b[8];
+                for (int j = 0; j < 8; ++j) {
+                    b[j] = _mm_xor_si128(
+                        _mm_loadu_si128(reinterpret_cast<__m128i const *>(
+                            in + (i + j) * 16)),
+                        k[0]);
+                }
+                for (unsigned int r = 1; r < nr; ++r) {
+                    for (int j = 0; j < 8; ++j) {
+                        if constexpr (Decrypt) {
+                            b[j] = _mm_aesdec_si128(b[j], k[r]);
+                        } else {
+                            b[j] = _mm_aesenc_si128(b[j], k[r]);
+                        }
+                    }
+                }
+                for (int j = 0; j < 8; ++j) {
+                    if constexpr (Decrypt) {
+                        b[j] = _mm_aesdeclast_si128(b[j], k[nr]);
+                    } else {
+                        b[j] = _mm_aesenclast_si128(b[j], k[nr]);
+                    }
+                    _mm_storeu_si128(
+                        reinterpret_cast<__m128i *>(out + (i + j) * 16), b[j]);
+                }
+            }
+            for (; i < n; ++i) {
+                __m128i b = _mm_xor_si128(
+                    _mm_loadu_si128(
+                        reinterpret_cast<__m128i const *>(in + i * 16)),
+                    k[0]);
+                for (unsigned int r = 1; r < nr; ++r) {
+                    if constexpr (Decrypt) {
+                        b = _mm_aesdec_si128(b, k[r]);
+                    } else {
+                        b = _mm_aesenc_si128(b, k[r]);
+                    }
+                }
+                if constexpr (Decrypt) {
+                    b = _mm_aesdeclast_si128(b, k[nr]);
+                } else {
+                    b = _mm_aesenclast_si128(b, k[nr]);
+                }
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 16), b);
+            }
+        }
+#endif
+
+        /* AES block cipher, using AES-NI when the CPU supports it. */
+        class aes {
+            std::array<std::uint8_t, 240> ek;
+            std::array<std::uint8_t, 240> dk;
+            unsigned int nr;
+            bool hw = false;
+
+            void add_round_key(std::uint8_t *s, unsigned int r) const {
+                for (int i = 0; i < 16; ++i) s[i] ^= ek[r * 16 + i];
+            }
+
+            /* State is stored column by column, so row R of column C is
+               S[R + 4 * C]. */
+            static void shift_rows(std::uint8_t *s, bool inverse) {
+                std::uint8_t t[16];
+                for (int c = 0; c < 4; ++c) {
+                    for (int r = 0; r < 4; ++r) {
+                        int from = inverse ? (c + 4 - r) % 4 : (c + r) % 4;
+                        t[r + 4 * c] = s[r + 4 * from];
+                    }
+                }
+                std::memcpy(s, t, 16);
+            }
+
+            static void mix_columns(std::uint8_t *s) {
+                for (int c = 0; c < 4; ++c) {
+                    std::uint8_t *a = s + 4 * c;
+                    std::uint8_t a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3];
+                    std::uint8_t t = a0 ^ a1 ^ a2 ^ a3;
+                    a[0] ^= t ^ xtime(a0 ^ a1);
+                    a[1] ^= t ^ xtime(a1 ^ a2);
+                    a[2] ^= t ^ xtime(a2 ^ a3);
+                    a[3] ^= t ^ xtime(a3 ^ a0);
+                }
+            }
+
+            static void inv_mix_columns(std::uint8_t *s) {
+                for (int c = 0; c < 4; ++c) {
+                    std::uint8_t *a = s + 4 * c;
+                    std::uint8_t a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3];
+                    a[0] = gmul(a0, 14) ^ gmul(a1, 11) ^ gmul(a2, 13) ^
+                           gmul(a3, 9);
+                    a[1] = gmul(a0, 9) ^ gmul(a1, 14) ^ gmul(a2, 11) ^
+                           gmul(a3, 13);
+                    a[2] = gmul(a0, 13) ^ gmul(a1, 9) ^ gmul(a2, 14) ^
+                           gmul(a3, 11);
+                    a[3] = gmul(a0, 11) ^ gmul(a1, 13) ^ gmul(a2, 9) ^
+                           gmul(a3, 14);
+                }
+            }
+
+            void encrypt_block(std::uint8_t const *in,
+                               std::uint8_t *out) const {
+                std::uint8_t const *box = sbox().fwd;
+                std::uint8_t s[16];
+                std::memcpy(s, in, 16);
+                add_round_key(s, 0);
+                for (unsigned int r = 1; r <= nr; ++r) {
+                    for (std::uint8_t &b : s) b = box[b];
+                    shift_rows(s, false);
+                    if (r != nr) mix_columns(s);
+                    add_round_key(s, r);
+                }
+                std::memcpy(out, s, 16);
+            }
+
+            void decrypt_block(std::uint8_t const *in,
+                               std::uint8_t *out) const {
+                std::uint8_t const *box = sbox().inv;
+                std::uint8_t s[16];
+                std::memcpy(s, in, 16);
+                add_round_key(s, nr);
+                for (unsigned int r = nr; r-- > 0;) {
+                    shift_rows(s, true);
+                    for (std::uint8_t &b : s) b = box[b];
+                    add_round_key(s, r);
+                    if (r != 0) inv_mix_columns(s);
+                }
+                std::memcpy(out, s, 16);
+            }
+
+        public:
+            explicit aes(std::vector<std::uint8_t> const &key) {
+                std::size_t nk = key.size() / 4;
+                nr = nk + 6;
+                std::uint8_t const *box = sbox().fwd;
+
+                std::memcpy(ek.data(), key.data(), key.size());
+                std::uint8_t rcon = 1;
+                for (std::size_t i = nk; i < 4 * (nr + 1); ++i) {
+                    std::uint8_t t[4];
+                    std::memcpy(t, &ek[(i - 1) * 4], 4);
+                    if (i % nk == 0) {
+                        std::uint8_t t0 = t[0];
+                        t[0] = box[t[1]] ^ rcon;
+                        t[1] = box[t[2]];
+                        t[2] = box[t[3]];
+                        t[3] = box[t0];
+                        rcon = xtime(rcon);
+                    } else if (nk > 6 && i % nk == 4) {
+                        for (std::uint8_t &b : t) b = box[b];
+                    }
+                    for (int j = 0; j < 4; ++j) {
+                        ek[i * 4 + j] = ek[(i - nk) * 4 + j] ^ t[j];
+                    }
+                }
+
+#ifdef HAVE_AESNI
+                if (has_aesni()) {
+                    hw = true;
+                    aesni_decryption_keys(ek.data(), nr, dk.data());
+                }
+#endif
+            }
+
+            /* Encrypts N independent blocks. IN and OUT may be equal. */
+            void encrypt(std::uint8_t const *in, std::uint8_t *out,
+                         std::size_t n) const {
+#ifdef HAVE_AESNI
+                if (hw) {
+                    aesni_blocks<false>(ek.data(), nr, in, out, n);
+                    return;
+                }
+#endif
+                for (std::size_t i = 0; i < n; ++i) {
+                    encrypt_block(in + i * 16, out + i * 16);
+                }
+            }
+
+            /* Decrypts N independent blocks. IN and OUT may be equal. */
+            void decrypt(std::uint8_t const *in, std::uint8_t *out,
+                         std::size_t n) const {
+#ifdef HAVE_AESNI
+                if (hw) {
+                    aesni_blocks<true>(dk.data(), nr, in, out, n);
+                    return;
+                }
+#endif
+                for (std::size_t i = 0; i < n; ++i) {
+                    decrypt_block(in + i * 16, out + i * 16);
+                }
+            }
+        };
+
+        /* Every plaintext block of CBC depends only on two ciphertext
+           blocks, so decryption runs in parallel. */
+        void aes_cbc_decrypt(aes const &c, std::uint8_t const *iv,
+                             std::uint8_t const *in, std::uint8_t *out,
+                             std::size_t len) {
+            parallel_for(len / 16, grain,
+                         [&](std::size_t begin, std::size_t end) {
+                             c.decrypt(in + begin * 16, out + begin * 16,
+                                       end - begin);
+                             for (std::size_t i = begin; i < end; ++i) {
+                                 std::uint8_t const *prev =
+                                     i == 0 ? iv : in + (i - 1) * 16;
+                                 for (int j = 0; j < 16; ++j) {
+                                     out[i * 16 + j] ^= prev[j];
+                                 }
+                             }
+                         });
+        }
+
+        /* Counter block is IV + block index as 128-bit big endian. */
+        void aes_ctr_crypt(aes const &c, std::uint8_t const *iv,
+                           std::uint8_t const *in, std::uint8_t *out,
+                           std::size_t len) {
+            std::uint64_t iv_hi = decode<std::uint64_t, byte_order::BIG>(iv);
+            std::uint64_t iv_lo =
+                decode<std::uint64_t, byte_order::BIG>(iv + 8);
+
+            parallel_for((len + 15) / 16, grain, [&](std::size_t begin,
+                                                     std::size_t end) {
+                constexpr std::size_t batch = 64;
+                std::uint8_t ks[batch * 16];
+                std::uint64_t lo = iv_lo + begin;
+                std::uint64_t hi = iv_hi + (lo < iv_lo);
+
+                for (std::size_t b = begin; b < end; b += batch) {
+                    std::size_t n = std::min(batch, end - b);
+                    for (std::size_t i = 0; i < n; ++i) {
+                        for (int j = 0; j < 8; ++j) {
+                            ks[i * 16 + j] = hi >> (56 - j * 8);
+                            ks[i * 16 + 8 + j] = lo >> (56 - j * 8);
+                        }
+                        if (++lo == 0) ++hi;
+                    }
+                    c.encrypt(ks, ks, n);
+
+                    std::size_t from = b * 16;
+                    std::size_t to = std::min(len, (b + n) * 16);
+                    for (std::size_t i = from; i < to; ++i) {
+                        out[i] = in[i] ^ ks[i - from];
+                    }
+                }
+            });
+        }
+
+        inline std::uint32_t rotl32(std::uint32_t x, int n) {
+            return x << n | x >> (32 - n);
+        }
+
+        inline void quarter_round(std::uint32_t *x, int a, int b, int c,
+                                  int d) {
+            x[a] += x[b];
+            x[d] = rotl32(x[d] ^ x[a], 16);
+            x[c] += x[d];
+            x[b] = rotl32(x[b] ^ x[c], 12);
+            x[a] += x[b];
+            x[d] = rotl32(x[d] ^ x[a], 8);
+            x[c] += x[d];
+            x[b] = rotl32(x[b] ^ x[c], 7);
+        }
+
+        /* Writes 64-byte ChaCha20 keystream block for STATE to OUT. */
+        void chacha_block(std::uint32_t const *state, std::uint8_t *out) {
+            std::uint32_t x[16];
+            std::memcpy(x, state, sizeof(x));
+            for (int i = 0; i < 10; ++i) {
+                quarter_round(x, 0, 4, 8, 12);
+                quarter_round(x, 1, 5, 9, 13);
+                quarter_round(x, 2, 6, 10, 14);
+                quarter_round(x, 3, 7, 11, 15);
+                quarter_round(x, 0, 5, 10, 15);
+                quarter_round(x, 1, 6, 11, 12);
+                quarter_round(x, 2, 7, 8, 13);
+                quarter_round(x, 3, 4, 9, 14);
+            }
+            for (int i = 0; i < 16; ++i) {
+                std::uint32_t v = x[i] + state[i];
+                for (int j = 0; j < 4; ++j) out[i * 4 + j] = v >> (j * 8);
+            }
+        }
+
+#ifdef __SSE2__
+        inline __m128i rotl_epi32(__m128i x, int n) {
+            return _mm_or_si128(_mm_slli_epi32(x, n),
+                                _mm_srli_epi32(x, 32 - n));
+        }
+
+        inline void quarter_round(__m128i *x, int a, int b, int c, int d) {
+            x[a] = _mm_add_epi32(x[a], x[b]);
+            x[d] = rotl_epi32(_mm_xor_si128(x[d], x[a]), 16);
+            x[c] = _mm_add_epi32(x[c], x[d]);
+            x[b] = rotl_epi32(_mm_xor_si128(x[b], x[c]), 12);
+            x[a] = _mm_add_epi32(x[a], x[b]);
+            x[d] = rotl_epi32(_mm_xor_si128(x[d], x[a]), 8);
+            x[c] = _mm_add_epi32(x[c], x[d]);
+            x[b] = rotl_epi32(_mm_xor_si128(x[b], x[c]), 7);
+        }
+
+        /* Four consecutive blocks at once, one block per lane. */
+        void chacha_block4(std::uint32_t const *state, std::uint8_t *out) {
+            __m128i init[16], x[16];
+            for (int i = 0; i < 16; ++i) init[i] = _mm_set1_epi32(state[i]);
+            init[12] = _mm_add_epi32(init[12], _mm_set_epi32(3, 2, 1, 0));
+            for (int i = 0; i < 16; ++i) x[i] = init[i];
+
+            for (int i = 0; i < 10; ++i) {
+                quarter_round(x, 0, 4, 8, 12);
+                quarter_round(x, 1, 5, 9, 13);
+                quarter_round(x, 2, 6, 10, 14);
+                quarter_round(x, 3, 7, 11, 15);
+                quarter_round(x, 0, 5, 10, 15);
+                quarter_round(x, 1, 6, 11, 12);
+                quarter_round(x, 2, 7, 8, 13);
+                quarter_round(x, 3, 4, 9, 14);
+            }
+
+            alignas(16) std::uint32_t lanes[16][4];
+            for (int i = 0; i < 16; ++i) {
+                _mm_store_si128(reinterpret_cast<__m128i *>(lanes[i]),
+                                _mm_add_epi32(x[i], init[i]));
+            }
+            for (int b = 0; b < 4; ++b) {
+                for (int i = 0; i < 16; ++i) {
+                    std::memcpy(out + b * 64 + i * 4, &lanes[i][b], 4);
+                }
+            }
+        }
+#endif
+
+        /*
+         * ChaCha20 as in RFC 8439. A 12-byte IV is the nonce with block
+         * counter starting from 0; a 16-byte IV is the initial counter in
+         * little endian followed by the nonce, as OpenSSL takes it.
+         */
+        void chacha20_crypt(std::vector<std::uint8_t> const &key,
+                            std::vector<std::uint8_t> const &iv,
+                            std::uint8_t const *in, std::uint8_t *out,
+                            std::size_t len) {
+            std::uint32_t state[16] = {0x61707865, 0x3320646e, 0x79622d32,
+                                       0x6b206574};
+            for (int i = 0; i < 8; ++i) {
+                state[4 + i] = decode<std::uint32_t, byte_order::LITTLE>(
+                    key.data() + i * 4);
+            }
+            std::uint8_t const *nonce = iv.data();
+            if (iv.size() == 16) {
+                state[12] = decode<std::uint32_t, byte_order::LITTLE>(nonce);
+                nonce += 4;
+            }
+            for (int i = 0; i < 3; ++i) {
+                state[13 + i] = decode<std::uint32_t, byte_order::LITTLE>(
+                    nonce + i * 4);
+            }
+
+            std::size_t nblocks = (len + 63) / 64;
+            if (nblocks > (std::uint64_t(1) << 32) - state[12]) {
+                throw std::runtime_error("Block counter overflows.");
+            }
+
+            parallel_for(nblocks, grain, [&](std::size_t begin,
+                                             std::size_t end) {
+                std::uint32_t st[16];
+                std::memcpy(st, state, sizeof(st));
+                st[12] += begin;
+
+                std::uint8_t ks[256];
+                for (std::size_t b = begin; b < end;) {
+                    std::size_t n = 1;
+#ifdef __SSE2__
+                    if (end - b >= 4) {
+                        chacha_block4(st, ks);
+                        n = 4;
+                    } else
+#endif
+                        chacha_block(st, ks);
+                    st[12] += n;
+
+                    std::size_t from = b * 64;
+                    std::size_t to = std::min(len, (b + n) * 64);
+                    for (std::size_t i = from; i < to; ++i) {
+                        out[i] = in[i] ^ ks[i - from];
+                    }
+                    b += n;
+                }
+            });
+        }
+
+        std::vector<std::uint8_t> parse_hex(std::string const &s,
+                                            char const *what) {
+            std::string bytes;
+            try {
+                bytes = parse_hex_bytes(s);
+            } catch (std::runtime_error const &e) {
+                throw std::runtime_error(std::string(what) + ": " + e.what());
+            }
+            return std::vector<std::uint8_t>(bytes.begin(), bytes.end());
+        }
+
+        void help_decrypt([[maybe_unused]] std::string cmd) {
+            std::cout << R"(usage: decrypt CIPHER KEY IV [OFFSET LEN] [BUF]
+Decrypt LEN bytes from OFFSET of the buffer and add the plaintext as
+a new buffer. Without OFFSET and LEN, whole buffer is decrypted.
+KEY and IV are given as hex strings. CIPHER is one of;
+  aes-128-cbc  16-byte KEY and IV. LEN must be a multiple of 16.
+               Padding is left as is.
+  aes-256-ctr  32-byte KEY. IV is the initial 128-bit big endian
+               counter block.
+  chacha20     32-byte KEY. IV is either a 12-byte nonce, or 4-byte
+               little endian initial counter followed by the nonce.
+AES uses AES-NI instructions when available. Blocks are processed
+in parallel.
+)";
+        }
+
+        int decrypt(std::vector<std::string> const &args) {
+            cipher algo;
+            std::vector<std::uint8_t> key, iv;
+            std::size_t offset = 0, len = 0;
+            bool whole = true;
+            file *f;
+            try {
+                option_matcher opt(args);
+                algo = static_cast<cipher>(opt.select_string(
+                    {"aes-128-cbc", "aes-256-ctr", "chacha20"}));
+                key = parse_hex(opt.get_string(), "KEY");
+                iv = parse_hex(opt.get_string(), "IV");
+                if (opt.remaining() >= 2) {
+                    offset = opt.get_size();
+                    len = opt.get_size();
+                    whole = false;
+                }
+                f = opt.get_file_or_default();
+                opt.must_not_remain();
+
+                std::size_t key_size = algo == cipher::AES128_CBC ? 16 : 32;
+                if (key.size() != key_size) {
+                    throw std::runtime_error(
+                        "KEY must be " + std::to_string(key_size) +
+                        " bytes.");
+                }
+                if (algo == cipher::CHACHA20
+                        ? iv.size() != 12 && iv.size() != 16
+                        : iv.size() != 16) {
+                    throw std::runtime_error(
+                        algo == cipher::CHACHA20
+                            ? "IV must be 12 or 16 bytes."
+                            : "IV must be 16 bytes.");
+                }
+                if (whole) {
+                    len = f->data.size();
+                } else if (offset > f->data.size() ||
+                           f->data.size() - offset < len) {
+                    throw std::runtime_error("Range exceeds buffer.");
+                }
+                if (algo == cipher::AES128_CBC && len % 16) {
+                    throw std::runtime_error(
+                        "LEN must be a multiple of 16.");
+                }
+            } catch (std::runtime_error const &e) {
+                std::cout << "decrypt: " << e.what() << '\n';
+                return 1;
+            }
+
+            byte_buffer result(len);
+            std::uint8_t const *in = f->data.data() + offset;
+            try {
+                switch (algo) {
+                case cipher::AES128_CBC:
+                    aes_cbc_decrypt(aes(key), iv.data(), in, result.data(),
+                                    len);
+                    break;
+                case cipher::AES256_CTR:
+                    aes_ctr_crypt(aes(key), iv.data(), in, result.data(),
+                                  len);
+                    break;
+                case cipher::CHACHA20:
+                    chacha20_crypt(key, iv, in, result.data(), len);
+                    break;
+                }
+            } catch (std::runtime_error const &e) {
+                std::cout << "decrypt: " << e.what() << '\n';
+                return 1;
+            }
+
+            int han = add_file_buffer(
+                f->filename + "#" + cipher_names[static_cast<int>(algo)] +
+                    ":" + std::to_string(offset),
+                std::move(result));
+            std::cout << "Added as %" << han << '\n';
+            output::value("buffer", han);
+            return 0;
+        }
+    } // namespace
+
+    void cipher_init() {
+        command_register("decrypt", &decrypt, &help_decrypt);
+        cpu::register_kernel("aes", [] {
+#ifdef HAVE_AESNI
+            if (has_aesni()) return "aes-ni";
+#endif
+            return "generic";
+        });
+        cpu::register_kernel("chacha20", [] {
+#ifdef __SSE2__
+            return "sse2";
+#else
+            return "generic";
+#endif
+        });
+    }
+} // namespace ben
@@ -17,15 +17,25 @@
  */
 
 #include <exception>
+#include <iomanip>
+#include <ios>
 #include <iostream>
 #include <iterator>
+#include <stdexcept>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 #include "command.hh"
+#include "cpu.hh"
+#include "file.hh"
+#include "memory.hh"
 #include "modes.hh"
 #include "option.hh"
+#include "output.hh"
+#include "parallel.hh"
+#include "store.hh"
+#include "trace.hh"
 #include "variable.hh"
 
 namespace ben {
@@ -54,9 +64,62 @@ namespace ben {
 If VALUE is empty or not specified, show current value.
 Possible keys;
   auto-shell    If on, try executing system command if ben command not found.
+  threads       Number of threads for parallel commands, including the main
+                thread, up to 4 times number of CPUs. 0 means number of
+                CPUs. Query shows tasks run, tasks stolen from other
+                threads and busy time of each.
+  cpu           `baseline' to use only instructions every CPU of the
+                architecture has, or `native' to use the best ones this
+                CPU supports. Query shows detected features and the
+                variant used by each optimized routine.
+  hugepages     If on, back large buffers loaded from now on with huge
+                pages. Query also shows NUMA nodes they are interleaved
+                over.
+  cold-compress If on, compress buffers other than the 4 most recently
+                used in memory between commands. They are decompressed
+                when used again. Query also shows how much is saved.
+  dedup         If on, store each distinct block of buffers created from
+                now on once. See `mem' for how much is shared. Off by
+                default, as stored buffers are mapped in small pages.
 )";
         }
 
+        void show_threads() {
+            std::vector<thread_stats> stats = thread_statistics();
+            std::cout << stats.size() << '\n';
+            output::value("threads", stats.size());
+
+            std::ios init(nullptr);
+            init.copyfmt(std::cout);
+            std::cout << "thread      tasks   steals   busy\n";
+            for (std::size_t i = 0; i < stats.size(); ++i) {
+                if (i + 1 < stats.size()) {
+                    std::cout << std::left << std::setw(6) << i;
+                } else {
+                    std::cout << "other ";
+                }
+                std::cout << std::right << std::setw(11) << stats[i].tasks
+                          << std::setw(9) << stats[i].steals << std::fixed
+                          << std::setprecision(1) << std::setw(6)
+                          << stats[i].busy * 100 << "%\n";
+                std::cout.copyfmt(init);
+                output::element("tasks", stats[i].tasks);
+                output::element("steals", stats[i].steals);
+                output::element("busy", stats[i].busy);
+            }
+        }
+
+        void show_cold_compress() {
+            cold_stats st = cold_statistics();
+            std::cout << (cold_compress() ? "ON" : "OFF") << '\n'
+                      << st.buffers << " cold buffers, " << st.size
+                      << " bytes compressed to " << st.compressed << '\n';
+            output::value("cold_compress", cold_compress());
+            output::value("cold_buffers", st.buffers);
+            output::value("cold_size", st.size);
+            output::value("cold_compressed", st.compressed);
+        }
+
         int mode(std::vector<std::string> const &args) {
             std::string key;
             std::string value;
@@ -76,6 +139,64 @@ Possible keys;
                 } else {
                     modes::auto_shell = is_truthy(value);
                 }
+            } else if (key == "threads") {
+                if (value.empty()) {
+                    show_threads();
+                    return 0;
+                }
+                std::size_t n;
+                try {
+                    std::size_t pos;
+                    n = std::stoul(value, &pos, 0);
+                    /* stoul takes "-1" as the largest value. */
+                    if (pos != value.size() ||
+                        value.find('-') != std::string::npos) {
+                        throw std::invalid_argument("");
+                    }
+                } catch (std::logic_error const &) {
+                    std::cout << "mode: Expect integer value.\n";
+                    return 1;
+                }
+                try {
+                    set_thread_count(n);
+                } catch (std::exception const &e) {
+                    std::cout << "mode: " << e.what() << '\n';
+                    return 1;
+                }
+            } else if (key == "hugepages") {
+                if (value.empty()) {
+                    std::cout << (memory::huge_pages() ? "ON" : "OFF")
+                              << " (" << memory::numa_nodes()
+                              << " NUMA nodes)\n";
+                    output::value("hugepages", memory::huge_pages());
+                    output::value("nodes", memory::numa_nodes());
+                } else {
+                    memory::set_huge_pages(is_truthy(value));
+                }
+            } else if (key == "cold-compress") {
+                if (value.empty()) {
+                    show_cold_compress();
+                } else {
+                    set_cold_compress(is_truthy(value));
+                }
+            } else if (key == "dedup") {
+                if (value.empty()) {
+                    std::cout << (store::enabled() ? "ON" : "OFF") << '\n';
+                } else {
+                    store::set_enabled(is_truthy(value));
+                }
+            } else if (key == "cpu") {
+                if (value.empty()) {
+                    cpu::report();
+                } else if (value == "baseline" || value == "native") {
+                    cpu::set_baseline(value == "baseline");
+                } else {
+                    std::cout << "mode: " << value << ": Unknown value.\n";
+                    return 1;
+                }
+            } else {
+                std::cout << "mode: " << key << ": Unknown key.\n";
+                return 1;
             }
             return 0;
         }
@@ -110,6 +231,7 @@ Possible keys;
 
         int retval;
         try {
+            trace::span span("command", itr->first);
             retval = itr->second.cmd(args);
         } catch (std::exception const &e) {
             std::cout << "BUG: " << e.what() << '\n';
@@ -43,6 +43,28 @@ namespace ben {
     void printer_init();
     /* zlib.cc */
     void zlib_init();
+    /* search.cc */
+    void search_init();
+    /* unicode.cc */
+    void unicode_init();
+    /* simhash.cc */
+    void simhash_init();
+    /* known.cc */
+    void known_init();
+    /* rules.cc */
+    void rules_init();
+    /* checksum.cc */
+    void checksum_init();
+    /* cipher.cc */
+    void cipher_init();
+    /* view.cc */
+    void view_init();
+    /* render.cc */
+    void render_init();
+    /* store.cc */
+    void store_init();
+    /* trace.cc */
+    void trace_init();
 } // namespace ben
 
 #endif
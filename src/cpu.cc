@@ -0,0 +1,126 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cpu.hh"
+#include "output.hh"
+
+#ifdef HAVE_X86_DISPATCH
+#include <cpuid.h>
+#endif
+
+namespace ben::cpu {
+    namespace {
+        constexpr std::size_t nfeatures = 6;
+        char const *const feature_names[nfeatures] = {
+            "sse4.2", "pclmul", "aes", "sha", "avx2", "avx512bw"};
+
+        struct detected_features {
+            bool present[nfeatures] = {};
+
+            detected_features() {
+#ifdef HAVE_X86_DISPATCH
+                unsigned int a, b, c, d;
+                if (!__get_cpuid(1, &a, &b, &c, &d)) return;
+                present[static_cast<int>(feature::SSE42)] = c & bit_SSE4_2;
+                present[static_cast<int>(feature::PCLMUL)] = c & bit_PCLMUL;
+                present[static_cast<int>(feature::AES)] = c & bit_AES;
+
+                /* Wide registers are usable only if OS saves them on
+                   context switch. */
+                unsigned int xcr0 = 0;
+                if (c & bit_OSXSAVE) {
+                    unsigned int hi;
+                    __asm__("xgetbv" : "=a"(xcr0), "=d"(hi) : "c"(0));
+                }
+                bool ymm = (xcr0 & 0x06) == 0x06;
+                bool zmm = (xcr0 & 0xe6) == 0xe6;
+
+                if (!__get_cpuid_count(7, 0, &a, &b, &c, &d)) return;
+                present[static_cast<int>(feature::SHA)] = b & bit_SHA;
+                present[static_cast<int>(feature::AVX2)] =
+                    ymm && (b & bit_AVX2);
+                present[static_cast<int>(feature::AVX512BW)] =
+                    zmm && (b & bit_AVX512F) && (b & bit_AVX512BW);
+#endif
+            }
+        };
+
+        detected_features const &detected() {
+            static detected_features const f;
+            return f;
+        }
+
+        struct kernel {
+            std::string name;
+            std::function<char const *()> bind;
+            char const *variant;
+        };
+
+        std::vector<kernel> &kernels() {
+            static std::vector<kernel> k;
+            return k;
+        }
+
+        bool baseline_only = false;
+    } // namespace
+
+    bool has(feature f) {
+        return !baseline_only && detected().present[static_cast<int>(f)];
+    }
+
+    void register_kernel(std::string name, std::function<char const *()> bind) {
+        char const *variant = bind();
+        kernels().push_back({std::move(name), std::move(bind), variant});
+    }
+
+    void set_baseline(bool on) {
+        baseline_only = on;
+        for (kernel &k : kernels()) k.variant = k.bind();
+    }
+
+    bool baseline() { return baseline_only; }
+
+    void report() {
+        std::cout << "features:";
+        for (std::size_t i = 0; i < nfeatures; ++i) {
+            if (detected().present[i]) {
+                std::cout << ' ' << feature_names[i];
+                output::element("features", feature_names[i]);
+            }
+        }
+        std::cout << (baseline_only ? " (disabled)\n" : "\n");
+        output::value("baseline", baseline_only);
+
+        for (kernel const &k : kernels()) {
+            std::cout << "  " << k.name
+                      << std::string(k.name.size() < 12 ? 12 - k.name.size()
+                                                         : 1,
+                                     ' ')
+                      << k.variant << '\n';
+            output::element("kernels", k.name);
+            output::element("variants", k.variant);
+        }
+    }
+} // namespace ben::cpu
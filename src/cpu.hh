@@ -0,0 +1,51 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPU_HH
+#define CPU_HH
+
+#include <functional>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_DISPATCH 1
+#endif
+
+namespace ben::cpu {
+    enum class feature { SSE42, PCLMUL, AES, SHA, AVX2, AVX512BW };
+
+    /* True if both CPU and OS support F, detected once with cpuid,
+       unless optional features are disabled with `mode cpu baseline'.
+       Always false on other architectures. */
+    bool has(feature f);
+
+    /* Registers hot loop NAME. BIND is called now and again whenever
+       usable features change; it points the loop at the best variant
+       according to has() and returns the variant's name. */
+    void register_kernel(std::string name, std::function<char const *()> bind);
+
+    /* Restricts dispatch to variants every CPU of the architecture
+       supports, or lifts the restriction. */
+    void set_baseline(bool on);
+    bool baseline();
+
+    /* Prints detected features and variant bound for each kernel. */
+    void report();
+} // namespace ben::cpu
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DECODE_HH
+#define DECODE_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace ben {
+    enum class byte_order { LITTLE, BIG };
+
+    namespace detail {
+        inline std::uint8_t bswap(std::uint8_t v) { return v; }
+        inline std::uint16_t bswap(std::uint16_t v) {
+            return __builtin_bswap16(v);
+        }
+        inline std::uint32_t bswap(std::uint32_t v) {
+            return __builtin_bswap32(v);
+        }
+        inline std::uint64_t bswap(std::uint64_t v) {
+            return __builtin_bswap64(v);
+        }
+
+        template <std::size_t N> struct uint_of_size;
+        template <> struct uint_of_size<1> { using type = std::uint8_t; };
+        template <> struct uint_of_size<2> { using type = std::uint16_t; };
+        template <> struct uint_of_size<4> { using type = std::uint32_t; };
+        template <> struct uint_of_size<8> { using type = std::uint64_t; };
+    } // namespace detail
+
+    /* Decodes value of type T stored in byte order ORDER at P.
+       Byte order is resolved at compile time, so callers should branch
+       on the order once and call the specialized routine. */
+    template <typename T, byte_order Order> T decode(std::uint8_t const *p) {
+        static_assert(std::is_trivially_copyable<T>::value);
+        using uint_type = typename detail::uint_of_size<sizeof(T)>::type;
+
+        uint_type raw;
+        std::memcpy(&raw, p, sizeof(T));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        if (Order == byte_order::BIG) raw = detail::bswap(raw);
+#else
+        if (Order == byte_order::LITTLE) raw = detail::bswap(raw);
+#endif
+        T value;
+        std::memcpy(&value, &raw, sizeof(T));
+        return value;
+    }
+} // namespace ben
+
+#endif
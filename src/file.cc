@@ -16,6 +16,7 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <bitset>
 #include <cstddef>
 #include <cstdint>
@@ -23,15 +24,26 @@
 #include <cstring>
 #include <exception>
 #include <fstream>
+#include <functional>
 #include <ios>
 #include <iostream>
+#include <mutex>
+#include <new>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include <zlib.h>
+
 #include "command.hh"
 #include "file.hh"
+#include "loader.hh"
+#include "memory.hh"
 #include "option.hh"
+#include "output.hh"
+#include "parallel.hh"
+#include "trace.hh"
 
 namespace ben {
     namespace {
@@ -90,29 +102,88 @@ Negative BASE means BASE bytes from the end of the buffer.
                     return 1;
                 }
             }
+            f->bit_cursor = 0;
+            output::value("cursor", f->cursor);
+
+            return 0;
+        }
+
+        void help_seekbits([[maybe_unused]] std::string cmd) {
+            std::cout << R"(usage: seekbits COUNT [BUF]
+Seek COUNT bits relative to current bit cursor.
+Both positive and negative COUNT is allowed.
+Byte cursor follows the bit cursor; `seek' and `goto' reset
+the bit position to the beginning of the byte.
+)";
+        }
+
+        int seekbits(std::vector<std::string> const &args) {
+            std::ptrdiff_t count;
+            file *f;
+            try {
+                option_matcher opt(args);
+                count = opt.get_diff();
+                f = opt.get_file_or_default();
+                opt.must_not_remain();
+            } catch (std::runtime_error const &e) {
+                std::cout << "seekbits: " << e.what() << '\n';
+                return 1;
+            }
+
+            std::size_t current = f->cursor * 8 + f->bit_cursor;
+            if (count >= 0) {
+                if (current + count >= f->data.size() * 8) {
+                    std::cout << "Cursor exceeds buffer.\n";
+                    return 1;
+                }
+            } else {
+                if (static_cast<std::size_t>(-count) > current) {
+                    std::cout << "Cursor exceeds buffer.\n";
+                    return 1;
+                }
+            }
+            current += count;
+            f->cursor = current >> 3;
+            f->bit_cursor = current & 7;
+            output::value("cursor", f->cursor);
+            output::value("bit_cursor", f->bit_cursor);
 
             return 0;
         }
 
         void help_load([[maybe_unused]] std::string cmd) {
-            std::cout << "usage: load FILE\n";
+            std::cout << R"(usage: load FILE...
+Load each FILE into a new buffer. Many files are read at once.
+`-' reads standard input.
+)";
         }
 
         int load(std::vector<std::string> const &args) {
-            std::string name;
+            std::vector<std::string> names;
             try {
                 option_matcher opt(args);
-                name = opt.get_string();
-                opt.must_not_remain();
+                names.push_back(opt.get_string());
+                for (std::string &name : opt.get_rest()) {
+                    names.push_back(std::move(name));
+                }
             } catch (std::runtime_error const &e) {
                 std::cout << "load: " << e.what() << '\n';
                 return 1;
             }
 
-            load_file(name);
+            int status = 0;
+            for (int han : load_files(names)) {
+                if (han < 0) {
+                    status = 1;
+                } else if (names.size() == 1) {
+                    output::value("buffer", han);
+                } else {
+                    output::element("added", han);
+                }
+            }
             list_file();
 
-            return 0;
+            return status;
         }
 
         int ls_buf([[maybe_unused]] std::vector<std::string> const &args) {
@@ -127,6 +198,137 @@ Negative BASE means BASE bytes from the end of the buffer.
         unsigned int default_file_num;
         std::vector<file> files;
 
+        /* Buffers kept uncompressed however long they are unused. */
+        constexpr std::size_t hot_buffers = 4;
+        /* Smaller buffers are not worth compressing. */
+        constexpr std::size_t cold_min_size = 64 * 1024;
+        constexpr std::size_t cold_block_size = 1024 * 1024;
+
+        bool cold_enabled = false;
+        std::uint64_t use_clock = 0;
+        /* Guards use_clock against file_at called from parallel
+           tasks. Never held while decompressing, as thaw waits for
+           pool tasks and the waiting thread runs other tasks meanwhile,
+           which may call file_at again. */
+        std::mutex use_mutex;
+
+        std::size_t cold_block_length(std::size_t size, std::size_t i) {
+            return std::min(cold_block_size, size - i * cold_block_size);
+        }
+
+        /* compress2 and uncompress with zlib's working memory taken
+           through the tracked allocator. */
+        int deflate_block(std::uint8_t *dest, uLongf *dest_len,
+                          std::uint8_t const *src, std::size_t len,
+                          int level) {
+            z_stream strm = {};
+            strm.zalloc = memory::zlib_alloc;
+            strm.zfree = memory::zlib_free;
+            int ret = deflateInit(&strm, level);
+            if (ret != Z_OK) return ret;
+            strm.next_in = const_cast<std::uint8_t *>(src);
+            strm.avail_in = len;
+            strm.next_out = dest;
+            strm.avail_out = *dest_len;
+            ret = deflate(&strm, Z_FINISH);
+            *dest_len = strm.total_out;
+            deflateEnd(&strm);
+            return ret == Z_STREAM_END ? Z_OK : ret == Z_OK ? Z_BUF_ERROR : ret;
+        }
+
+        int inflate_block(std::uint8_t *dest, uLongf *dest_len,
+                          std::uint8_t const *src, std::size_t len) {
+            z_stream strm = {};
+            strm.zalloc = memory::zlib_alloc;
+            strm.zfree = memory::zlib_free;
+            int ret = inflateInit(&strm);
+            if (ret != Z_OK) return ret;
+            strm.next_in = const_cast<std::uint8_t *>(src);
+            strm.avail_in = len;
+            strm.next_out = dest;
+            strm.avail_out = *dest_len;
+            ret = inflate(&strm, Z_FINISH);
+            *dest_len = strm.total_out;
+            inflateEnd(&strm);
+            return ret == Z_STREAM_END ? Z_OK : ret == Z_OK ? Z_BUF_ERROR : ret;
+        }
+
+        /* Compresses contents of F block by block, with zlib level 1
+           as speed matters more than ratio here. */
+        void freeze(file &f) {
+            memory::charge_scope scope(memory::subsystem::CACHE);
+            std::size_t size = f.data.size();
+            std::size_t n = (size + cold_block_size - 1) / cold_block_size;
+            std::vector<std::vector<std::uint8_t>> blocks(n);
+            parallel_for(n, 1, [&](std::size_t begin, std::size_t end) {
+                std::vector<std::uint8_t> z(compressBound(cold_block_size));
+                for (std::size_t i = begin; i < end; ++i) {
+                    std::uint8_t const *p =
+                        f.data.data() + i * cold_block_size;
+                    std::size_t len = cold_block_length(size, i);
+                    uLongf zlen = z.size();
+                    if (deflate_block(z.data(), &zlen, p, len, 1) == Z_OK &&
+                        zlen < len) {
+                        blocks[i].assign(z.data(), z.data() + zlen);
+                    } else {
+                        blocks[i].assign(p, p + len);
+                    }
+                }
+            });
+
+            std::size_t compressed = 0;
+            for (auto const &b : blocks) compressed += b.size();
+            if (compressed > size / 10 * 9) {
+                f.compressible = false;
+                return;
+            }
+            f.cold = std::move(blocks);
+            f.cold_size = size;
+            f.data = buffer_data();
+        }
+
+        void thaw(file &f) {
+            byte_buffer data(f.cold_size);
+            auto body = [&](std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; ++i) {
+                    std::vector<std::uint8_t> const &b = f.cold[i];
+                    std::uint8_t *out = data.data() + i * cold_block_size;
+                    std::size_t len = cold_block_length(f.cold_size, i);
+                    if (b.size() == len) {
+                        std::copy(b.begin(), b.end(), out);
+                        continue;
+                    }
+                    uLongf zlen = len;
+                    if (inflate_block(out, &zlen, b.data(), b.size()) != Z_OK ||
+                        zlen != len) {
+                        throw std::runtime_error(
+                            "zlib error: cold buffer is broken.");
+                    }
+                }
+            };
+            parallel_for(f.cold.size(), 1, body);
+            f.data = std::move(data);
+            f.cold = {};
+            f.cold_size = 0;
+        }
+
+        /* Marks F as used and decompresses it if cold. */
+        file *touch(file &f) {
+            {
+                std::lock_guard<std::mutex> lock(use_mutex);
+                f.last_use = ++use_clock;
+            }
+            /* Parallel tasks only see buffers thawed by thaw_files. */
+            if (!f.cold.empty()) thaw(f);
+            return &f;
+        }
+
+        int add_file(file f) {
+            f.last_use = ++use_clock;
+            files.push_back(std::move(f));
+            return files.size() - 1;
+        }
+
         void help_default_file([[maybe_unused]] std::string cmd) {
             std::cout << R"(usage: default BUF
 Query or change default buffer.
@@ -137,6 +339,7 @@ Query or change default buffer.
             if (args.size() < 2) {
                 if (default_file_num < files.size()) {
                     std::cout << "%" << default_file_num << '\n';
+                    output::value("buffer", default_file_num);
                 } else {
                     std::cout << "Default file not set.\n";
                 }
@@ -154,19 +357,21 @@ Query or change default buffer.
         }
 
         void help_cursor([[maybe_unused]] std::string const cmd) {
-            std::cout << R"(usage: cursor [bin|oct|dec|hex] [BUF]
+            std::cout << R"(usage: cursor [bin|oct|dec|hex|bit] [BUF]
 Query cursor posiion. Default format is hex.
+`bit' prints position in bits from the beginning of the buffer
+in decimal, including the bit cursor.
 )";
         }
 
         int cursor(std::vector<std::string> const &args) {
-            enum print_style { BIN, OCT, DEC, HEX };
+            enum print_style { BIN, OCT, DEC, HEX, BIT };
             print_style style;
             file *f;
             try {
                 option_matcher opt(args);
                 style = static_cast<print_style>(
-                    opt.select_string({"bin", "oct", "dec", "hex"},
+                    opt.select_string({"bin", "oct", "dec", "hex", "bit"},
                                       static_cast<std::size_t>(HEX)));
                 f = opt.get_file_or_default();
                 opt.must_not_remain();
@@ -185,11 +390,15 @@ Query cursor posiion. Default format is hex.
                 std::cout << std::oct << f->cursor << '\n';
             } else if (style == DEC) {
                 std::cout << std::dec << f->cursor << '\n';
+            } else if (style == BIT) {
+                std::cout << std::dec << f->cursor * 8 + f->bit_cursor << '\n';
             } else {
                 std::cout << std::hex << f->cursor << '\n';
             }
 
             std::cout.copyfmt(init);
+            output::value("cursor", f->cursor);
+            output::value("bit_cursor", f->bit_cursor);
 
             return 0;
         }
@@ -215,6 +424,8 @@ Move BUF's cursor to ADDR.
 
             if (addr < f->data.size()) {
                 f->cursor = addr;
+                f->bit_cursor = 0;
+                output::value("cursor", f->cursor);
             } else {
                 std::cout << "goto: ADDR exceeds buffer.\n";
                 return 1;
@@ -223,8 +434,41 @@ Move BUF's cursor to ADDR.
             return 0;
         }
 
-        std::vector<std::uint8_t> load_file_stdin() {
-            std::vector<std::uint8_t> data;
+        void help_snapshot([[maybe_unused]] std::string cmd) {
+            std::cout << R"(usage: snapshot [BUF]
+Add a copy of the buffer, with its cursor and settings, as a new
+buffer. Contents are shared with the original rather than copied, so
+that a snapshot of even a large buffer costs little memory.
+)";
+        }
+
+        int snapshot(std::vector<std::string> const &args) {
+            file *f;
+            try {
+                option_matcher opt(args);
+                f = opt.get_file_or_default();
+                opt.must_not_remain();
+            } catch (std::exception const &e) {
+                std::cout << "snapshot: " << e.what() << '\n';
+                return 1;
+            }
+
+            file s;
+            s.filename = f->filename + "#snap";
+            s.data = f->data.share();
+            s.cursor = f->cursor;
+            s.bit_cursor = f->bit_cursor;
+            s.endian = f->endian;
+            s.bits = f->bits;
+            s.default_radix = f->default_radix;
+            int han = add_file(std::move(s));
+            std::cout << "Added as %" << han << '\n';
+            output::value("buffer", han);
+            return 0;
+        }
+
+        byte_buffer load_file_stdin() {
+            byte_buffer data;
             char buf[2048];
 
             do {
@@ -239,61 +483,72 @@ Move BUF's cursor to ADDR.
 
     void file_init() {
         command_register("seek", &seek, &help_seek);
+        command_register("seekbits", &seekbits, &help_seekbits);
         command_register("load", &load, &help_load);
         command_register("lsbuf", &ls_buf);
         command_register("default", &default_file, &help_default_file);
         command_register("cursor", &cursor, &help_cursor);
         command_register("goto", &cursor_goto, &help_cursor_goto);
+        command_register("snapshot", &snapshot, &help_snapshot);
     }
 
     int load_file(std::string filename) {
-        std::vector<std::uint8_t> data;
-
-        if (filename == "-") {
-            data = load_file_stdin();
-        } else {
-
-            std::ifstream strm(filename, std::ios::binary);
-            if (!strm) {
-                int errsave = errno;
-                std::cout << "Failed to load: " << std::strerror(errsave)
-                          << '\n';
-                return -1;
-            }
+        return load_files({std::move(filename)})[0];
+    }
 
-            char buf[2048];
-            do {
-                strm.read(buf, 2048);
-                data.insert(data.end(), buf, buf + strm.gcount());
-            } while (!strm.fail());
+    std::vector<int> load_files(std::vector<std::string> const &filenames) {
+        memory::charge_scope scope(memory::subsystem::BUFFERS);
+        std::vector<std::string> paths;
+        for (std::string const &name : filenames) {
+            if (name != "-") paths.push_back(name);
+        }
+        std::vector<loaded_file> loaded;
+        try {
+            trace::span span("load", "read_files");
+            loaded = read_files(paths);
+        } catch (std::runtime_error const &e) {
+            std::cout << "Failed to load: " << e.what() << '\n';
+            return std::vector<int>(filenames.size(), -1);
+        }
 
-            if (!strm.eof()) {
-                std::cout << "Error loading " << filename
-                          << "; file may not be complete.\n";
+        std::vector<int> handles;
+        std::size_t next = 0;
+        for (std::string const &name : filenames) {
+            file f;
+            if (name == "-") {
+                f.filename = "*stdin*";
+                f.data = load_file_stdin();
+            } else {
+                loaded_file &l = loaded[next++];
+                if (l.error && l.data.empty()) {
+                    std::cout << "Failed to load " << name << ": "
+                              << std::strerror(l.error) << '\n';
+                    handles.push_back(-1);
+                    continue;
+                }
+                if (l.error) {
+                    std::cout << "Error loading " << name
+                              << "; file may not be complete.\n";
+                }
+                f.filename = name;
+                f.data = std::move(l.data);
             }
+            handles.push_back(add_file(std::move(f)));
         }
-
-        file f;
-        f.filename = filename == "-" ? "*stdin*" : filename;
-        f.data = data;
-        files.push_back(f);
-
-        return files.size() - 1;
+        return handles;
     }
 
-    int add_file_buffer(std::string filename, std::vector<std::uint8_t> &buf) {
+    int add_file_buffer(std::string filename, byte_buffer buf) {
         file f;
         f.filename = filename;
-        f.data = buf;
-        files.push_back(f);
-
-        return files.size() - 1;
+        f.data = std::move(buf);
+        return add_file(std::move(f));
     }
 
     file *get_file(std::string repr) {
         if (repr.empty()) {
             if (default_file_num < files.size()) {
-                return &files[default_file_num];
+                return touch(files[default_file_num]);
             } else {
                 return nullptr;
             }
@@ -311,12 +566,81 @@ Move BUF's cursor to ADDR.
             return nullptr;
         }
         default_file_num = n;
-        return &files[n];
+        return touch(files[n]);
+    }
+
+    std::size_t file_count() { return files.size(); }
+
+    void thaw_files() {
+        for (file &f : files) touch(f);
+    }
+
+    std::size_t file_index(file const *f) {
+        std::size_t i = 0;
+        while (i < files.size() && &files[i] != f) ++i;
+        return i;
+    }
+
+    file *file_at(std::size_t n) {
+        if (n >= files.size()) return nullptr;
+        return touch(files[n]);
     }
 
     void list_file() {
         for (unsigned int i = 0; i < files.size(); ++i) {
             std::cout << " %" << i << ": " << files[i].filename << '\n';
+            output::element("buffers", i);
+            output::element("names", files[i].filename);
+            output::element("sizes", files[i].size());
+        }
+    }
+
+    bool cold_compress() { return cold_enabled; }
+
+    void set_cold_compress(bool on) { cold_enabled = on; }
+
+    void compress_cold_files() {
+        if (!cold_enabled || files.size() <= hot_buffers) return;
+
+        std::vector<std::uint64_t> uses;
+        for (file const &f : files) uses.push_back(f.last_use);
+        std::nth_element(uses.begin(), uses.begin() + hot_buffers - 1,
+                         uses.end(), std::greater<std::uint64_t>());
+        std::uint64_t hot = uses[hot_buffers - 1];
+
+        for (file &f : files) {
+            /* Shared contents would stay in memory anyway. */
+            if (f.last_use >= hot || !f.cold.empty() || !f.compressible ||
+                f.data.size() < cold_min_size || f.data.shared()) {
+                continue;
+            }
+            try {
+                freeze(f);
+            } catch (std::bad_alloc const &) {
+                /* Buffer simply stays hot. */
+            }
+        }
+    }
+
+    cold_stats cold_statistics() {
+        cold_stats st = {};
+        for (file const &f : files) {
+            if (f.cold.empty()) continue;
+            ++st.buffers;
+            st.size += f.cold_size;
+            for (auto const &b : f.cold) st.compressed += b.size();
+        }
+        return st;
+    }
+
+    std::vector<buffer_memory> buffer_memory_usage() {
+        std::vector<buffer_memory> result;
+        for (file const &f : files) {
+            buffer_memory m = {f.filename, f.data.resident(), f.data.mapped(),
+                               f.data.heap(), 0};
+            for (auto const &b : f.cold) m.cache += b.capacity();
+            result.push_back(m);
         }
+        return result;
     }
 } // namespace ben
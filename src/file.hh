@@ -1,20 +1,92 @@
 #ifndef FILE_HH
 #define FILE_HH
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <vector>
 
+#include "bits.hh"
+#include "decode.hh"
+#include "memory.hh"
+#include "store.hh"
+
 namespace ben {
+    enum class radix { BIN, OCT, DEC, HEX };
+
     struct file {
         std::string filename;
-        std::vector<std::uint8_t> data;
+        buffer_data data;
         std::size_t cursor = 0;
+        /* Bit position inside the byte at cursor, 0 through 7. */
+        unsigned int bit_cursor = 0;
+
+        /* How values in this buffer are decoded. */
+        byte_order endian = byte_order::LITTLE;
+        bit_order bits = bit_order::MSB;
+        radix default_radix = radix::DEC;
+
+        /* Contents of cold buffer compressed in blocks, a block stored
+           as is if it does not shrink. DATA is empty meanwhile. */
+        std::vector<std::vector<std::uint8_t>> cold;
+        std::size_t cold_size = 0;
+        /* False once compression turned out not to pay. */
+        bool compressible = true;
+        /* Tick of last access through get_file or file_at. */
+        std::uint64_t last_use = 0;
+
+        /* Size of contents, even while cold. */
+        std::size_t size() const {
+            return cold.empty() ? data.size() : cold_size;
+        }
     };
 
     int load_file(std::string filename);
-    int add_file_buffer(std::string filename, std::vector<std::uint8_t> &buf);
+    /* Loads FILENAMES at once, in order. Returns buffer number for
+       each, or -1 if it could not be loaded. */
+    std::vector<int> load_files(std::vector<std::string> const &filenames);
+    int add_file_buffer(std::string filename, byte_buffer buf);
     file *get_file(std::string repr);
+    std::size_t file_count();
+    /* Unlike get_file, does not change default buffer. May be called
+       from parallel tasks only after thaw_files. */
+    file *file_at(std::size_t n);
+    /* Decompresses every cold buffer. Called before working on all
+       buffers in parallel. */
+    void thaw_files();
+    /* Buffer number of F, or file_count() if F is not a buffer. Unlike
+       file_at, neither decompresses nor marks buffers as used. */
+    std::size_t file_index(file const *f);
     void list_file();
+
+    /* Whether buffers not used recently are compressed in memory. */
+    bool cold_compress();
+    void set_cold_compress(bool on);
+    /* Compresses buffers except most recently used ones, if enabled.
+       Cold buffers are decompressed again by get_file, file_at or
+       thaw_files. Must be called only between commands, while no
+       buffer is in use. */
+    void compress_cold_files();
+
+    struct cold_stats {
+        std::size_t buffers;
+        /* Sizes of the buffers' contents and of their blocks. */
+        std::size_t size;
+        std::size_t compressed;
+    };
+    cold_stats cold_statistics();
+
+    struct buffer_memory {
+        std::string name;
+        std::size_t resident;
+        std::size_t mapped;
+        std::size_t heap;
+        /* Compressed blocks of cold buffer. */
+        std::size_t cache;
+    };
+    /* Memory taken by each buffer. Unlike file_at, leaves cold buffers
+       compressed. */
+    std::vector<buffer_memory> buffer_memory_usage();
 }
 
 #endif
@@ -0,0 +1,212 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "cpu.hh"
+#include "decode.hh"
+#include "hash.hh"
+
+namespace ben {
+    namespace {
+        constexpr std::uint32_t sha256_k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b,
+            0x59f111f1, 0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01,
+            0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7,
+            0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+            0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152,
+            0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+            0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc,
+            0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819,
+            0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116, 0x1e376c08,
+            0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f,
+            0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+            0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+        inline std::uint32_t rotr(std::uint32_t x, unsigned int n) {
+            return x >> n | x << (32 - n);
+        }
+
+        void sha256_block(std::uint32_t state[8], std::uint8_t const *block) {
+            std::uint32_t w[64];
+            for (int i = 0; i < 16; ++i) {
+                w[i] = decode<std::uint32_t, byte_order::BIG>(block + i * 4);
+            }
+            for (int i = 16; i < 64; ++i) {
+                std::uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^
+                                   w[i - 15] >> 3;
+                std::uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^
+                                   w[i - 2] >> 10;
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+            }
+
+            std::uint32_t a = state[0], b = state[1], c = state[2],
+                          d = state[3], e = state[4], f = state[5],
+                          g = state[6], h = state[7];
+            for (int i = 0; i < 64; ++i) {
+                std::uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+                std::uint32_t ch = (e & f) ^ (~e & g);
+                std::uint32_t t1 = h + s1 + ch + sha256_k[i] + w[i];
+                std::uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+                std::uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+                std::uint32_t t2 = s0 + maj;
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+            state[0] += a;
+            state[1] += b;
+            state[2] += c;
+            state[3] += d;
+            state[4] += e;
+            state[5] += f;
+            state[6] += g;
+            state[7] += h;
+        }
+
+        void sha256_blocks_generic(std::uint32_t state[8],
+                                   std::uint8_t const *data, std::size_t n) {
+            for (std::size_t i = 0; i < n; ++i) {
+                sha256_block(state, data + i * 64);
+            }
+        }
+
+#ifdef HAVE_X86_DISPATCH
+        /* SHA extensions keep state as ABEF and CDGH halves and run two
+           rounds per instruction. */
+        __attribute__((target("sha,sse4.1"))) void
+        sha256_blocks_shani(std::uint32_t state[8], std::uint8_t const *data,
+                            std::size_t n) {
+            __m128i const bswap =
+                _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+            __m128i tmp = _mm_shuffle_epi32(
+                _mm_loadu_si128(reinterpret_cast<__m128i const *>(state)),
+                0xb1);
+            __m128i st1 = _mm_shuffle_epi32(
+                _mm_loadu_si128(reinterpret_cast<__m128i const *>(state + 4)),
+                0x1b);
+            __m128i st0 = _mm_alignr_epi8(tmp, st1, 8);
+            st1 = _mm_blend_epi16(st1, tmp, 0xf0);
+
+            for (std::size_t b = 0; b < n; ++b) {
+                std::uint8_t const *block = data + b * 64;
+                __m128i abef = st0, cdgh = st1;
+                __m128i w[16];
+                for (int i = 0; i < 16; ++i) {
+                    if (i < 4) {
+                        w[i] = _mm_shuffle_epi8(
+                            _mm_loadu_si128(reinterpret_cast<__m128i const *>(
+                                block + i * 16)),
+                            bswap);
+                    } else {
+                        __m128i t = _mm_sha256msg1_epu32(w[i - 4], w[i - 3]);
+                        t = _mm_add_epi32(
+                            t, _mm_alignr_epi8(w[i - 1], w[i - 2], 4));
+                        w[i] = _mm_sha256msg2_epu32(t, w[i - 1]);
+                    }
+                    __m128i msg = _mm_add_epi32(
+                        w[i], _mm_loadu_si128(reinterpret_cast<__m128i const *>(
+                                  sha256_k + i * 4)));
+                    st1 = _mm_sha256rnds2_epu32(st1, st0, msg);
+                    st0 = _mm_sha256rnds2_epu32(st0, st1,
+                                                _mm_shuffle_epi32(msg, 0x0e));
+                }
+                st0 = _mm_add_epi32(st0, abef);
+                st1 = _mm_add_epi32(st1, cdgh);
+            }
+
+            tmp = _mm_shuffle_epi32(st0, 0x1b);
+            st1 = _mm_shuffle_epi32(st1, 0xb1);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(state),
+                             _mm_blend_epi16(tmp, st1, 0xf0));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(state + 4),
+                             _mm_alignr_epi8(st1, tmp, 8));
+        }
+#endif
+
+        void (*sha256_blocks)(std::uint32_t state[8], std::uint8_t const *data,
+                              std::size_t n) = sha256_blocks_generic;
+
+        char const *bind_sha256() {
+#ifdef HAVE_X86_DISPATCH
+            if (cpu::has(cpu::feature::SHA)) {
+                sha256_blocks = sha256_blocks_shani;
+                return "sha-ni";
+            }
+#endif
+            sha256_blocks = sha256_blocks_generic;
+            return "generic";
+        }
+    } // namespace
+
+    void hash_init() { cpu::register_kernel("sha256", &bind_sha256); }
+
+    sha256_digest sha256(std::uint8_t const *data, std::size_t len) {
+        std::uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                  0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                  0x1f83d9ab, 0x5be0cd19};
+
+        std::size_t full = len & ~std::size_t(63);
+        sha256_blocks(state, data, full / 64);
+
+        std::uint8_t tail[128] = {};
+        std::size_t rest = len - full;
+        std::memcpy(tail, data + full, rest);
+        tail[rest] = 0x80;
+        std::size_t tail_len = rest < 56 ? 64 : 128;
+        std::uint64_t bits = static_cast<std::uint64_t>(len) * 8;
+        for (int i = 0; i < 8; ++i) {
+            tail[tail_len - 1 - i] = bits >> (i * 8);
+        }
+        sha256_blocks(state, tail, tail_len / 64);
+
+        sha256_digest digest;
+        for (int i = 0; i < 8; ++i) {
+            digest[i * 4] = state[i] >> 24;
+            digest[i * 4 + 1] = state[i] >> 16;
+            digest[i * 4 + 2] = state[i] >> 8;
+            digest[i * 4 + 3] = state[i];
+        }
+        return digest;
+    }
+
+    std::string to_hex(std::uint8_t const *data, std::size_t len) {
+        static char const hex[] = "0123456789abcdef";
+        std::string s;
+        s.reserve(len * 2);
+        for (std::size_t i = 0; i < len; ++i) {
+            s.push_back(hex[data[i] >> 4]);
+            s.push_back(hex[data[i] & 0xf]);
+        }
+        return s;
+    }
+} // namespace ben
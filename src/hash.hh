@@ -0,0 +1,40 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HASH_HH
+#define HASH_HH
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace ben {
+    using sha256_digest = std::array<std::uint8_t, 32>;
+
+    /* Computes SHA-256 digest of LEN bytes at DATA. */
+    sha256_digest sha256(std::uint8_t const *data, std::size_t len);
+
+    /* Returns lowercase hexadecimal representation of DATA. */
+    std::string to_hex(std::uint8_t const *data, std::size_t len);
+
+    /* Binds hash kernels to the best variant for the CPU. */
+    void hash_init();
+} // namespace ben
+
+#endif
@@ -0,0 +1,55 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HEX_HH
+#define HEX_HH
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+namespace ben {
+    /* Returns the value of hex digit C, or -1 if C is not one. */
+    inline int hex_value(char c) {
+        if ('0' <= c && c <= '9') return c - '0';
+        if ('a' <= (c | 0x20) && (c | 0x20) <= 'f') {
+            return (c | 0x20) - 'a' + 10;
+        }
+        return -1;
+    }
+
+    /* Decodes pairs of hex digits in STR into bytes. */
+    inline std::string parse_hex_bytes(std::string const &str) {
+        if (str.size() % 2) {
+            throw std::runtime_error("Odd number of hex digits.");
+        }
+        std::string result;
+        for (std::size_t i = 0; i < str.size(); i += 2) {
+            int hi = hex_value(str[i]);
+            int lo = hex_value(str[i + 1]);
+            if (hi < 0 || lo < 0) {
+                throw std::runtime_error("Invalid hex digit.");
+            }
+            result.push_back(static_cast<char>(hi << 4 | lo));
+        }
+        return result;
+    }
+} // namespace ben
+
+#endif
@@ -16,12 +16,15 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <cctype>
 #include <csignal>
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <exception>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -30,24 +33,193 @@
 #include <readline/readline.h>
 
 #include "command.hh"
+#include "file.hh"
+#include "memory.hh"
 #include "interactive.hh"
+#include "output.hh"
 #include "parse.hh"
+#include "trace.hh"
+#include "unicode.hh"
 #include "variable.hh"
 
 namespace ben {
     namespace {
-        void execute_command_line(char const *cmd) {
-            command_chain *chain = parse_command_line(cmd);
-            command_chain *first = chain;
-            while (chain != nullptr) {
-                chain->stmt->execute();
+        bool repl_exited = false;
+
+        /* A line of --jsonl input, such as
+             {"id": 1, "command": "seek 10; cursor"}
+             {"id": 2, "args": ["print", "uint32", "hex"]}
+           COMMAND is parsed as in the REPL, while ARGS is executed as a
+           single command without any expansion. */
+        struct jsonl_request {
+            /* Raw JSON text of "id", echoed back in the response. */
+            std::string_view id;
+            std::string command;
+            std::vector<std::string> args;
+            bool has_args = false;
+        };
+
+        class request_parser {
+            std::string_view in;
+            std::size_t pos = 0;
 
-                chain = chain->next;
+            [[noreturn]] void fail(char const *what) {
+                throw std::runtime_error(std::string("Invalid request: ") +
+                                         what + " at " + std::to_string(pos) +
+                                         '.');
             }
-            command_chain_clean_up(first);
-        }
 
-        bool repl_exited = false;
+            void skip_space() {
+                while (pos < in.size() && (in[pos] == ' ' || in[pos] == '\t' ||
+                                           in[pos] == '\r' || in[pos] == '\n'))
+                    ++pos;
+            }
+
+            bool consume(char c) {
+                skip_space();
+                if (pos < in.size() && in[pos] == c) {
+                    ++pos;
+                    return true;
+                }
+                return false;
+            }
+
+            void expect(char c) {
+                if (!consume(c)) fail("unexpected character");
+            }
+
+            unsigned int hex4() {
+                if (in.size() - pos < 4) fail("bad escape");
+                unsigned int v = 0;
+                for (int i = 0; i < 4; ++i) {
+                    char c = in[pos++];
+                    v <<= 4;
+                    if (c >= '0' && c <= '9') {
+                        v |= c - '0';
+                    } else if (c >= 'a' && c <= 'f') {
+                        v |= c - 'a' + 10;
+                    } else if (c >= 'A' && c <= 'F') {
+                        v |= c - 'A' + 10;
+                    } else {
+                        fail("bad escape");
+                    }
+                }
+                return v;
+            }
+
+            std::string string() {
+                expect('"');
+                std::string out;
+                for (;;) {
+                    if (pos >= in.size()) fail("unterminated string");
+                    char c = in[pos++];
+                    if (c == '"') return out;
+                    if (c != '\\') {
+                        out.push_back(c);
+                        continue;
+                    }
+                    if (pos >= in.size()) fail("bad escape");
+                    c = in[pos++];
+                    switch (c) {
+                    case 'b':
+                        out.push_back('\b');
+                        break;
+                    case 'f':
+                        out.push_back('\f');
+                        break;
+                    case 'n':
+                        out.push_back('\n');
+                        break;
+                    case 'r':
+                        out.push_back('\r');
+                        break;
+                    case 't':
+                        out.push_back('\t');
+                        break;
+                    case 'u': {
+                        char32_t cp = hex4();
+                        if (cp >= 0xd800 && cp < 0xdc00 &&
+                            in.substr(pos, 2) == "\\u") {
+                            pos += 2;
+                            char32_t lo = hex4();
+                            if (lo < 0xdc00 || lo >= 0xe000) fail("bad escape");
+                            cp = 0x10000 + ((cp - 0xd800) << 10) +
+                                 (lo - 0xdc00);
+                        }
+                        append_utf8(out, cp);
+                        break;
+                    }
+                    default:
+                        out.push_back(c);
+                    }
+                }
+            }
+
+            void skip_value() {
+                skip_space();
+                if (pos >= in.size()) fail("value expected");
+                char c = in[pos];
+                if (c == '"') {
+                    string();
+                } else if (c == '{' || c == '[') {
+                    char close = c == '{' ? '}' : ']';
+                    ++pos;
+                    if (consume(close)) return;
+                    do {
+                        if (c == '{') {
+                            string();
+                            expect(':');
+                        }
+                        skip_value();
+                    } while (consume(','));
+                    expect(close);
+                } else {
+                    std::size_t begin = pos;
+                    while (pos < in.size() &&
+                           (std::isalnum(static_cast<unsigned char>(in[pos])) ||
+                            in[pos] == '-' || in[pos] == '+' || in[pos] == '.'))
+                        ++pos;
+                    if (pos == begin) fail("value expected");
+                }
+            }
+
+        public:
+            explicit request_parser(std::string_view in) : in(in) {}
+
+            jsonl_request parse() {
+                jsonl_request req;
+                expect('{');
+                if (!consume('}')) {
+                    do {
+                        std::string key = string();
+                        expect(':');
+                        skip_space();
+                        if (key == "id") {
+                            std::size_t begin = pos;
+                            skip_value();
+                            req.id = in.substr(begin, pos - begin);
+                        } else if (key == "command") {
+                            req.command = string();
+                        } else if (key == "args") {
+                            req.has_args = true;
+                            expect('[');
+                            if (!consume(']')) {
+                                do {
+                                    req.args.push_back(string());
+                                } while (consume(','));
+                                expect(']');
+                            }
+                        } else {
+                            skip_value();
+                        }
+                    } while (consume(','));
+                    expect('}');
+                }
+                skip_space();
+                if (pos != in.size()) fail("trailing characters");
+                return req;
+            }
+        };
     } // namespace
 
     int start_repl() {
@@ -72,6 +244,7 @@ namespace ben {
             } catch (std::exception const &e) {
                 std::cout << e.what() << '\n';
             }
+            compress_cold_files();
             if (std::strlen(line)) {
                 ::add_history(line);
             }
@@ -83,6 +256,37 @@ namespace ben {
         return 0;
     }
 
+    int start_jsonl() {
+        std::string line;
+        while (!repl_exited && std::getline(std::cin, line)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+
+            output::begin_response();
+            jsonl_request req;
+            int status;
+            try {
+                {
+                    memory::charge_scope scope(memory::subsystem::PARSER);
+                    trace::span span("parse", "request");
+                    req = request_parser(line).parse();
+                }
+                if (req.has_args) {
+                    status = command_execute(req.args);
+                } else {
+                    status = execute_command_line(req.command);
+                }
+            } catch (std::exception const &e) {
+                std::cout << e.what() << '\n';
+                status = 255;
+            }
+            output::end_response(req.id, status);
+            compress_cold_files();
+        }
+        return 0;
+    }
+
     void exit_repl() {
         repl_exited = true;
     }
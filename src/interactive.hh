@@ -21,6 +21,9 @@
 
 namespace ben {
     int start_repl();
+    /* Serves JSON requests read from stdin, one per line, until EOF
+       or `exit'. */
+    int start_jsonl();
     void exit_repl();
 }
 
@@ -0,0 +1,319 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "command.hh"
+#include "decode.hh"
+#include "file.hh"
+#include "hash.hh"
+#include "memory.hh"
+#include "option.hh"
+#include "parallel.hh"
+
+namespace ben {
+    namespace {
+        constexpr std::size_t entry_size = sizeof(sha256_digest);
+        /* One fence key is sampled every this many entries, so a lookup
+           touches at most one fence interval of the mapped table. */
+        constexpr std::size_t fence_step = 4096;
+
+        /*
+         * Known-hash database: a file of sorted, raw SHA-256 digests
+         * without any header. The table is memory-mapped and only every
+         * fence_step-th key prefix is read at load time, so opening a
+         * multi-gigabyte set costs a few page faults rather than a read
+         * of the whole file.
+         */
+        class hash_db {
+            std::string path;
+            std::uint8_t const *base = nullptr;
+            std::size_t count = 0;
+            std::size_t map_len = 0;
+            std::vector<std::uint64_t> fence;
+
+            static std::uint64_t prefix(std::uint8_t const *p) {
+                return decode<std::uint64_t, byte_order::BIG>(p);
+            }
+
+        public:
+            hash_db() = default;
+            hash_db(hash_db const &) = delete;
+            hash_db &operator=(hash_db const &) = delete;
+            ~hash_db() { close(); }
+
+            void open(std::string const &filename) {
+                int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd < 0) {
+                    throw std::runtime_error(std::strerror(errno));
+                }
+                struct stat st;
+                if (fstat(fd, &st) < 0) {
+                    int err = errno;
+                    ::close(fd);
+                    throw std::runtime_error(std::strerror(err));
+                }
+                std::size_t len = st.st_size;
+                if (len % entry_size != 0) {
+                    ::close(fd);
+                    throw std::runtime_error(
+                        "Database size is not a multiple of 32.");
+                }
+
+                void *p = nullptr;
+                if (len != 0) {
+                    p = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+                    if (p == MAP_FAILED) {
+                        int err = errno;
+                        ::close(fd);
+                        throw std::runtime_error(std::strerror(err));
+                    }
+                    madvise(p, len, MADV_RANDOM);
+                }
+                ::close(fd);
+
+                std::uint8_t const *b = static_cast<std::uint8_t const *>(p);
+                std::size_t n = len / entry_size;
+                std::vector<std::uint64_t> fen;
+                fen.reserve((n + fence_step - 1) / fence_step);
+                for (std::size_t i = 0; i < n; i += fence_step) {
+                    std::uint64_t key = prefix(b + i * entry_size);
+                    if (!fen.empty() && key < fen.back()) {
+                        munmap(p, len);
+                        throw std::runtime_error("Database is not sorted.");
+                    }
+                    fen.push_back(key);
+                }
+
+                close();
+                path = filename;
+                base = b;
+                count = n;
+                map_len = len;
+                fence = std::move(fen);
+            }
+
+            void close() {
+                if (base) munmap(const_cast<std::uint8_t *>(base), map_len);
+                path.clear();
+                base = nullptr;
+                count = 0;
+                map_len = 0;
+                fence.clear();
+            }
+
+            bool loaded() const { return !path.empty(); }
+
+            std::string const &filename() const { return path; }
+
+            std::size_t size() const { return count; }
+
+            bool contains(sha256_digest const &digest) const {
+                if (count == 0) return false;
+
+                std::uint64_t key = prefix(digest.data());
+                /* Entries sharing the key prefix may straddle a fence, so
+                   start from the last fence strictly below the key. */
+                std::size_t lo = std::lower_bound(fence.begin(), fence.end(),
+                                                  key) -
+                                 fence.begin();
+                std::size_t hi = std::upper_bound(fence.begin() + lo,
+                                                  fence.end(), key) -
+                                 fence.begin();
+                if (hi == 0) return false;
+                std::size_t first = (lo == 0 ? 0 : lo - 1) * fence_step;
+                std::size_t last = std::min(hi * fence_step, count);
+
+                while (first < last) {
+                    std::size_t mid = first + (last - first) / 2;
+                    int c = std::memcmp(base + mid * entry_size, digest.data(),
+                                        entry_size);
+                    if (c == 0) return true;
+                    if (c < 0) {
+                        first = mid + 1;
+                    } else {
+                        last = mid;
+                    }
+                }
+                return false;
+            }
+        };
+
+        hash_db db;
+
+        void help_known([[maybe_unused]] std::string cmd) {
+            std::cout << R"(usage: known load HASHDB
+       known unload
+       known check [BUF]
+       known scan
+       known scan --block SIZE [BUF]
+       known
+Look up SHA-256 digests of buffers in a known-hash database.
+HASHDB is a file of sorted raw 32-byte SHA-256 digests. It is
+memory-mapped and only a sparse index is read when loaded.
+  load    map HASHDB, replacing the previous database.
+  unload  unmap the database.
+  check   hash the buffer and tell whether it is known.
+  scan    hash every buffer in parallel. With --block, hash each
+          SIZE-byte aligned block of the buffer instead and print
+          offsets of known blocks.
+Without arguments, show the loaded database.
+)";
+        }
+
+        void print_verdict(bool known, sha256_digest const &digest) {
+            std::cout << (known ? "known   " : "unknown ")
+                      << to_hex(digest.data(), digest.size());
+        }
+
+        int known_check(file *f) {
+            sha256_digest digest = sha256(f->data.data(), f->data.size());
+            bool hit = db.contains(digest);
+            print_verdict(hit, digest);
+            std::cout << '\n';
+            return hit ? 0 : 1;
+        }
+
+        int known_scan_all() {
+            std::size_t n = file_count();
+            std::vector<sha256_digest> digests(n);
+            std::vector<char> hits(n);
+            thaw_files();
+            parallel_for(n, 1, [&](std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; ++i) {
+                    file *f = file_at(i);
+                    digests[i] = sha256(f->data.data(), f->data.size());
+                    hits[i] = db.contains(digests[i]);
+                }
+            });
+
+            std::size_t known = 0;
+            for (std::size_t i = 0; i < n; ++i) {
+                std::cout << '%' << i << ": ";
+                print_verdict(hits[i], digests[i]);
+                std::cout << "  " << file_at(i)->filename << '\n';
+                if (hits[i]) ++known;
+            }
+            std::cout << known << " of " << n << " buffers known\n";
+            return 0;
+        }
+
+        int known_scan_blocks(file *f, std::size_t block) {
+            std::size_t n = f->data.size() / block;
+            std::vector<char> hits(n);
+            parallel_for(n, 256, [&](std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; ++i) {
+                    hits[i] = db.contains(
+                        sha256(f->data.data() + i * block, block));
+                }
+            });
+
+            std::size_t known = 0;
+            for (std::size_t i = 0; i < n; ++i) {
+                if (!hits[i]) continue;
+                std::cout << std::hex << std::setw(8) << std::setfill('0')
+                          << i * block << std::dec << '\n';
+                ++known;
+            }
+            std::cout << known << " of " << n << " blocks known\n";
+            return 0;
+        }
+
+        int known(std::vector<std::string> const &args) {
+            enum { LOAD, UNLOAD, CHECK, SCAN, INFO };
+            int sub;
+            std::string filename;
+            file *f = nullptr;
+            std::size_t block = 0;
+            try {
+                option_matcher opt(args);
+                sub = opt.select_string(
+                    {"load", "unload", "check", "scan"}, INFO);
+                if (sub == LOAD) {
+                    filename = opt.get_string();
+                } else if (sub == CHECK) {
+                    f = opt.get_file_or_default();
+                } else if (sub == SCAN &&
+                           opt.try_select_string({"--block"}, 1) == 0) {
+                    block = opt.get_size();
+                    if (block == 0) {
+                        throw std::runtime_error(
+                            "Block size must be positive.");
+                    }
+                    f = opt.get_file_or_default();
+                }
+                opt.must_not_remain();
+            } catch (std::runtime_error const &e) {
+                std::cout << "known: " << e.what() << '\n';
+                return 1;
+            }
+
+            switch (sub) {
+            case LOAD:
+                try {
+                    memory::charge_scope scope(memory::subsystem::INDEXES);
+                    db.open(filename);
+                } catch (std::runtime_error const &e) {
+                    std::cout << "known: " << filename << ": " << e.what()
+                              << '\n';
+                    return 1;
+                }
+                std::cout << db.size() << " hashes\n";
+                return 0;
+
+            case UNLOAD:
+                db.close();
+                return 0;
+
+            case INFO:
+                if (db.loaded()) {
+                    std::cout << db.filename() << ": " << db.size()
+                              << " hashes\n";
+                } else {
+                    std::cout << "No database loaded.\n";
+                }
+                return 0;
+            }
+
+            if (!db.loaded()) {
+                std::cout << "known: No database loaded.\n";
+                return 1;
+            }
+
+            if (sub == CHECK) return known_check(f);
+            if (f) return known_scan_blocks(f, block);
+            return known_scan_all();
+        }
+    } // namespace
+
+    void known_init() { command_register("known", &known, &help_known); }
+} // namespace ben
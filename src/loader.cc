@@ -0,0 +1,433 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+
+#include "loader.hh"
+#include "parallel.hh"
+
+namespace ben {
+    namespace {
+        /* Largest single read; io_uring takes 32-bit lengths. */
+        constexpr std::size_t max_read = 1 << 30;
+
+        /* Reads FD to the end into BUF, whose first DONE bytes are
+           already read. BUF is expected to be sized to the file, and
+           grows only if the file turns out longer, as files in /proc
+           do. Returns errno value, or 0. */
+        int read_rest(int fd, byte_buffer &buf, std::size_t done) {
+            for (;;) {
+                if (done == buf.size()) {
+                    /* Check for end of file without growing BUF. */
+                    std::uint8_t probe[4096];
+                    ssize_t n = ::read(fd, probe, sizeof(probe));
+                    if (n < 0) {
+                        if (errno == EINTR) continue;
+                        return errno;
+                    }
+                    if (n == 0) return 0;
+                    buf.insert(buf.end(), probe, probe + n);
+                    done += n;
+                    buf.resize(std::max<std::size_t>(buf.size() * 2, 65536));
+                    continue;
+                }
+                ssize_t n = ::read(fd, buf.data() + done,
+                                   std::min(buf.size() - done, max_read));
+                if (n <= 0) {
+                    if (n < 0 && errno == EINTR) continue;
+                    buf.resize(done);
+                    return n < 0 ? errno : 0;
+                }
+                done += n;
+            }
+        }
+
+        int read_file(std::string const &path, byte_buffer &buf) {
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) return errno;
+            int err;
+            struct stat st;
+            if (::fstat(fd, &st) < 0) {
+                err = errno;
+            } else {
+                try {
+                    buf.resize(S_ISREG(st.st_mode) ? st.st_size : 0);
+                    err = read_rest(fd, buf, 0);
+                } catch (std::bad_alloc const &) {
+                    buf = byte_buffer();
+                    err = ENOMEM;
+                }
+            }
+            ::close(fd);
+            return err;
+        }
+
+        /* Reads files at INDICES on the thread pool. */
+        void read_pooled(std::vector<std::string> const &paths,
+                         std::vector<std::size_t> const &indices,
+                         std::vector<loaded_file> &results) {
+            parallel_for(indices.size(), 1,
+                         [&](std::size_t begin, std::size_t end) {
+                             for (std::size_t i = begin; i < end; ++i) {
+                                 loaded_file &r = results[indices[i]];
+                                 r.error = read_file(paths[indices[i]],
+                                                     r.data);
+                             }
+                         });
+        }
+
+#ifdef HAVE_IO_URING
+        /* Minimal io_uring driven with raw system calls. */
+        class ring {
+            int fd = -1;
+            void *sq_map = MAP_FAILED;
+            std::size_t sq_len = 0;
+            void *cq_map = MAP_FAILED;
+            std::size_t cq_len = 0;
+            io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+            std::size_t sqes_len = 0;
+
+            unsigned int entries;
+            unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+            unsigned int *cq_head, *cq_tail, *cq_mask;
+            io_uring_cqe *cqes;
+            /* Entries queued but not passed to kernel yet. */
+            unsigned int tail;
+            unsigned int unsubmitted = 0;
+
+            template <typename T> T *at(void *base, unsigned int off) {
+                return reinterpret_cast<T *>(static_cast<char *>(base) +
+                                             off);
+            }
+
+            void *map(std::size_t len, std::uint64_t off) {
+                return ::mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, fd, off);
+            }
+
+            int enter(unsigned int min_complete, unsigned int flags) {
+                __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+                int n = ::syscall(__NR_io_uring_enter, fd, unsubmitted,
+                                  min_complete, flags, nullptr, 0);
+                if (n < 0) {
+                    if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                        return 0;
+                    }
+                    /* Other errors mean the ring is used wrongly. */
+                    throw std::runtime_error(std::string("io_uring: ") +
+                                             std::strerror(errno));
+                }
+                unsubmitted -= n;
+                return n;
+            }
+
+        public:
+            explicit ring(unsigned int size) {
+                io_uring_params p;
+                std::memset(&p, 0, sizeof(p));
+                fd = ::syscall(__NR_io_uring_setup, size, &p);
+                if (fd < 0) return;
+
+                sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+                cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+                bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+                if (single) sq_len = cq_len = std::max(sq_len, cq_len);
+                sq_map = map(sq_len, IORING_OFF_SQ_RING);
+                if (sq_map == MAP_FAILED) return;
+                if (!single) {
+                    cq_map = map(cq_len, IORING_OFF_CQ_RING);
+                    if (cq_map == MAP_FAILED) return;
+                }
+                sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+                sqes = static_cast<io_uring_sqe *>(
+                    map(sqes_len, IORING_OFF_SQES));
+                if (sqes == MAP_FAILED) return;
+
+                void *cq = single ? sq_map : cq_map;
+                entries = p.sq_entries;
+                sq_head = at<unsigned int>(sq_map, p.sq_off.head);
+                sq_tail = at<unsigned int>(sq_map, p.sq_off.tail);
+                sq_mask = at<unsigned int>(sq_map, p.sq_off.ring_mask);
+                sq_array = at<unsigned int>(sq_map, p.sq_off.array);
+                cq_head = at<unsigned int>(cq, p.cq_off.head);
+                cq_tail = at<unsigned int>(cq, p.cq_off.tail);
+                cq_mask = at<unsigned int>(cq, p.cq_off.ring_mask);
+                cqes = at<io_uring_cqe>(cq, p.cq_off.cqes);
+                tail = *sq_tail;
+            }
+
+            ~ring() {
+                if (sqes != MAP_FAILED) ::munmap(sqes, sqes_len);
+                if (cq_map != MAP_FAILED) ::munmap(cq_map, cq_len);
+                if (sq_map != MAP_FAILED) ::munmap(sq_map, sq_len);
+                if (fd >= 0) ::close(fd);
+            }
+
+            ring(ring const &) = delete;
+            ring &operator=(ring const &) = delete;
+
+            bool ready() const { return sqes != MAP_FAILED; }
+
+            /* True if kernel knows every operation in OPS. */
+            bool supports(std::initializer_list<int> ops) {
+                constexpr unsigned int nops = 256;
+                std::vector<std::uint64_t> mem(
+                    (sizeof(io_uring_probe) +
+                     nops * sizeof(io_uring_probe_op)) /
+                        sizeof(std::uint64_t) +
+                    1);
+                auto *probe = reinterpret_cast<io_uring_probe *>(mem.data());
+                if (::syscall(__NR_io_uring_register, fd,
+                              IORING_REGISTER_PROBE, probe, nops) < 0) {
+                    return false;
+                }
+                for (int op : ops) {
+                    if (op > probe->last_op ||
+                        !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            /* Returns cleared entry to fill, which is submitted by next
+               wait(). */
+            io_uring_sqe *next() {
+                while (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) ==
+                       entries) {
+                    enter(0, 0);
+                }
+                unsigned int idx = tail & *sq_mask;
+                io_uring_sqe *sqe = &sqes[idx];
+                std::memset(sqe, 0, sizeof(*sqe));
+                sq_array[idx] = idx;
+                ++tail;
+                ++unsubmitted;
+                return sqe;
+            }
+
+            /* Submits queued entries and waits for a completion. */
+            void wait() { enter(1, IORING_ENTER_GETEVENTS); }
+
+            /* Calls F with user data and result of each completion. */
+            template <typename F> void reap(F f) {
+                unsigned int head = *cq_head;
+                while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+                    io_uring_cqe const &cqe = cqes[head & *cq_mask];
+                    std::uint64_t data = cqe.user_data;
+                    int res = cqe.res;
+                    __atomic_store_n(cq_head, ++head, __ATOMIC_RELEASE);
+                    f(data, res);
+                }
+            }
+        };
+
+        /* Files in flight at once; each has at most two requests
+           queued, so that completions never overflow the ring. */
+        constexpr std::size_t queue_depth = 64;
+
+        enum op_kind { OPEN, STAT, READ, CLOSE };
+
+        struct uring_file {
+            int fd = -1;
+            /* Requests in flight. */
+            unsigned int waiting = 0;
+            std::size_t done = 0;
+            struct statx stx;
+        };
+
+        /* Reads files through io_uring. Each file is opened and stated
+           together, then read into a buffer sized by statx in as few
+           requests as possible, then closed. Files which are not regular
+           or are seemingly empty are added to REST to be read otherwise.
+           Returns false if io_uring is not usable. */
+        bool read_uring(std::vector<std::string> const &paths,
+                        std::vector<loaded_file> &results,
+                        std::vector<std::size_t> &rest) {
+            ring r(2 * queue_depth);
+            if (!r.ready() || !r.supports({IORING_OP_OPENAT, IORING_OP_STATX,
+                                            IORING_OP_READ,
+                                            IORING_OP_CLOSE})) {
+                return false;
+            }
+
+            std::vector<uring_file> files(paths.size());
+            std::size_t next = 0;
+            std::size_t active = 0;
+
+            auto tag = [](std::size_t i, op_kind k) {
+                return static_cast<std::uint64_t>(i) << 2 | k;
+            };
+            auto start = [&](std::size_t i) {
+                io_uring_sqe *sqe = r.next();
+                sqe->opcode = IORING_OP_OPENAT;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = reinterpret_cast<std::uintptr_t>(paths[i].c_str());
+                sqe->open_flags = O_RDONLY | O_CLOEXEC;
+                sqe->user_data = tag(i, OPEN);
+
+                sqe = r.next();
+                sqe->opcode = IORING_OP_STATX;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = reinterpret_cast<std::uintptr_t>(paths[i].c_str());
+                sqe->len = STATX_TYPE | STATX_SIZE;
+                sqe->off = reinterpret_cast<std::uintptr_t>(&files[i].stx);
+                sqe->user_data = tag(i, STAT);
+
+                files[i].waiting = 2;
+                ++active;
+            };
+            auto read = [&](std::size_t i) {
+                uring_file &f = files[i];
+                byte_buffer &buf = results[i].data;
+                io_uring_sqe *sqe = r.next();
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = f.fd;
+                sqe->addr = reinterpret_cast<std::uintptr_t>(buf.data() +
+                                                             f.done);
+                sqe->len = std::min(buf.size() - f.done, max_read);
+                sqe->off = f.done;
+                sqe->user_data = tag(i, READ);
+                ++f.waiting;
+            };
+            auto finish = [&](std::size_t i) {
+                uring_file &f = files[i];
+                if (f.fd < 0) {
+                    --active;
+                    return;
+                }
+                io_uring_sqe *sqe = r.next();
+                sqe->opcode = IORING_OP_CLOSE;
+                sqe->fd = f.fd;
+                sqe->user_data = tag(i, CLOSE);
+                f.fd = -1;
+                ++f.waiting;
+            };
+            auto opened = [&](std::size_t i) {
+                uring_file &f = files[i];
+                loaded_file &res = results[i];
+                if (res.error) {
+                    finish(i);
+                    return;
+                }
+                if (!S_ISREG(f.stx.stx_mode) || f.stx.stx_size == 0) {
+                    rest.push_back(i);
+                    finish(i);
+                    return;
+                }
+                try {
+                    res.data.resize(f.stx.stx_size);
+                } catch (std::bad_alloc const &) {
+                    res.error = ENOMEM;
+                    finish(i);
+                    return;
+                }
+                read(i);
+            };
+            auto complete = [&](std::uint64_t data, int res) {
+                std::size_t i = data >> 2;
+                uring_file &f = files[i];
+                loaded_file &result = results[i];
+                --f.waiting;
+                switch (static_cast<op_kind>(data & 3)) {
+                case OPEN:
+                    if (res < 0) {
+                        result.error = -res;
+                    } else {
+                        f.fd = res;
+                    }
+                    if (!f.waiting) opened(i);
+                    break;
+                case STAT:
+                    if (res < 0 && !result.error) result.error = -res;
+                    if (!f.waiting) opened(i);
+                    break;
+                case READ:
+                    if (res == -EINTR || res == -EAGAIN) {
+                        read(i);
+                    } else if (res < 0 || res == 0) {
+                        /* Error or file shrank. */
+                        if (res < 0) result.error = -res;
+                        result.data.resize(f.done);
+                        finish(i);
+                    } else {
+                        f.done += res;
+                        if (f.done < result.data.size()) {
+                            read(i);
+                        } else {
+                            finish(i);
+                        }
+                    }
+                    break;
+                case CLOSE:
+                    --active;
+                    break;
+                }
+            };
+
+            while (next < paths.size() || active) {
+                while (next < paths.size() && active < queue_depth) {
+                    start(next++);
+                }
+                r.wait();
+                r.reap(complete);
+            }
+            return true;
+        }
+#endif
+    } // namespace
+
+    std::vector<loaded_file> read_files(std::vector<std::string> const &paths) {
+        std::vector<loaded_file> results(paths.size());
+        if (paths.size() == 1) {
+            results[0].error = read_file(paths[0], results[0].data);
+            return results;
+        }
+
+        std::vector<std::size_t> rest;
+#ifdef HAVE_IO_URING
+        if (!read_uring(paths, results, rest))
+#endif
+        {
+            rest.resize(paths.size());
+            for (std::size_t i = 0; i < rest.size(); ++i) rest[i] = i;
+        }
+        read_pooled(paths, rest, results);
+        return results;
+    }
+} // namespace ben
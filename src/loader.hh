@@ -0,0 +1,42 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOADER_HH
+#define LOADER_HH
+
+#include <string>
+#include <vector>
+
+#include "memory.hh"
+
+namespace ben {
+    struct loaded_file {
+        byte_buffer data;
+        /* errno value, or 0 if whole file was read. */
+        int error = 0;
+    };
+
+    /* Reads every file in PATHS, many at a time, into a buffer sized
+       to its length. Opens, stats and reads go through io_uring when
+       the kernel supports it, and run on the thread pool otherwise.
+       Results are in the order of PATHS. Throws std::runtime_error if
+       io_uring fails midway. */
+    std::vector<loaded_file> read_files(std::vector<std::string> const &paths);
+} // namespace ben
+
+#endif
@@ -18,12 +18,16 @@
 
 #include <clocale>
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include <getopt.h>
 
 #include "command.hh"
 #include "file.hh"
+#include "hash.hh"
 #include "interactive.hh"
+#include "output.hh"
 #include "variable.hh"
 
 /* Simply, to make settings for code completion easy. */
@@ -39,6 +43,9 @@ namespace {
 Load FILE's to buffer for analysis then launch interactive
 command line.
 
+  -j, --jsonl    Read commands as JSON objects, one per line, and
+                 print results as JSON lines instead of launching
+                 interactive command line.
   -h, --help     Print this message and exit.
   -v, --version  Print version and exit.
 )";
@@ -50,6 +57,7 @@ command line.
     }
 
     struct option options[] = {
+        {"jsonl", no_argument, nullptr, 'j'},
         {"help", no_argument, nullptr, 'h'},
         {"version", no_argument, nullptr, 'v'},
         {0, 0, 0, 0},
@@ -60,11 +68,16 @@ command line.
 int main(int argc, char **argv) {
     std::setlocale(LC_ALL, "");
 
+    bool jsonl = false;
+
     for (;;) {
-        int c = getopt_long(argc, argv, "hv", options, nullptr);
+        int c = getopt_long(argc, argv, "jhv", options, nullptr);
         if (c == -1) break;
 
         switch (c) {
+        case 'j':
+            jsonl = true;
+            break;
         case 'h':
             print_usage();
             return 0;
@@ -83,12 +96,35 @@ int main(int argc, char **argv) {
     ben::file_init();
     ben::printer_init();
     ben::zlib_init();
+    ben::search_init();
+    ben::unicode_init();
+    ben::simhash_init();
+    ben::known_init();
+    ben::rules_init();
+    ben::checksum_init();
+    ben::hash_init();
+    ben::cipher_init();
+    ben::view_init();
+    ben::render_init();
+    ben::store_init();
+    ben::trace_init();
+
+    std::vector<std::string> names(argv + optind, argv + argc);
+    if (jsonl) {
+        /* Initial response reports loaded buffers. */
+        ben::output::begin_response();
+        int status = 0;
+        for (int han : ben::load_files(names)) {
+            if (han < 0) status = 1;
+        }
+        ben::list_file();
+        ben::output::end_response("", status);
 
-    std::cout << "Loading files...\n";
-    for (int i = optind; i < argc; ++i) {
-        std::cout << " - Loading " << argv[i] << "...\n";
-        ben::load_file(argv[i]);
+        return ben::start_jsonl();
     }
+
+    std::cout << "Loading files...\n";
+    ben::load_files(names);
     ben::list_file();
 
     return ben::start_repl();
@@ -0,0 +1,362 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#endif
+
+#include "memory.hh"
+
+namespace ben {
+    namespace {
+        std::atomic<bool> use_huge_pages{true};
+
+        constexpr std::size_t nsubsystems =
+            static_cast<std::size_t>(memory::subsystem::COUNT);
+
+        char const *const subsystem_names[nsubsystems] = {
+            "buffers",   "decompression", "cache", "indexes",
+            "variables", "parser",        "other"};
+
+        thread_local memory::subsystem charged = memory::subsystem::OTHER;
+
+        struct counter {
+            std::atomic<std::size_t> bytes{0};
+            std::atomic<std::size_t> peak{0};
+
+            void add(std::size_t n) noexcept {
+                std::size_t now =
+                    bytes.fetch_add(n, std::memory_order_relaxed) + n;
+                std::size_t p = peak.load(std::memory_order_relaxed);
+                while (now > p && !peak.compare_exchange_weak(
+                                      p, now, std::memory_order_relaxed)) {
+                }
+            }
+
+            void sub(std::size_t n) noexcept {
+                bytes.fetch_sub(n, std::memory_order_relaxed);
+            }
+
+            memory::usage get() const noexcept {
+                return {bytes.load(std::memory_order_relaxed),
+                        peak.load(std::memory_order_relaxed)};
+            }
+        };
+
+        counter counters[nsubsystems];
+        counter total;
+        counter mapped;
+
+        void charge(memory::subsystem s, std::size_t n) noexcept {
+            counters[static_cast<std::size_t>(s)].add(n);
+            total.add(n);
+        }
+
+        void discharge(memory::subsystem s, std::size_t n) noexcept {
+            counters[static_cast<std::size_t>(s)].sub(n);
+            total.sub(n);
+        }
+
+        /* Precedes every block from operator new, keeping default new
+           alignment of what follows. */
+        struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) header {
+            std::size_t size;
+            memory::subsystem owner;
+        };
+
+        void *tracked_allocate(std::size_t n) noexcept {
+            void *raw = std::malloc(sizeof(header) + n);
+            if (!raw) return nullptr;
+            header *h = static_cast<header *>(raw);
+            h->size = n;
+            h->owner = charged;
+            charge(h->owner, n);
+            return h + 1;
+        }
+
+        void tracked_free(void *p) noexcept {
+            if (!p) return;
+            header *h = static_cast<header *>(p) - 1;
+            discharge(h->owner, h->size);
+            std::free(h);
+        }
+
+        void *allocate_or_throw(std::size_t n) {
+            if (n == 0) n = 1;
+            for (;;) {
+                if (void *p = tracked_allocate(n)) return p;
+                std::new_handler handler = std::get_new_handler();
+                if (!handler) throw std::bad_alloc();
+                handler();
+            }
+        }
+
+        void *allocate_nothrow(std::size_t n) noexcept {
+            try {
+                return allocate_or_throw(n);
+            } catch (...) {
+                return nullptr;
+            }
+        }
+
+        std::size_t round_up(std::size_t n, std::size_t align) {
+            return (n + align - 1) / align * align;
+        }
+
+        /* Size of default hugetlbfs page, or 0 if unknown. */
+        std::size_t hugetlb_page_size() {
+            static std::size_t const size = [] {
+                std::ifstream in("/proc/meminfo");
+                std::string line;
+                while (std::getline(in, line)) {
+                    if (line.compare(0, 13, "Hugepagesize:") == 0) {
+                        try {
+                            return std::stoul(line.substr(13)) * 1024;
+                        } catch (std::exception const &) {
+                            break;
+                        }
+                    }
+                }
+                return std::size_t{0};
+            }();
+            return size;
+        }
+
+        /* Online NUMA nodes, up to 64, parsed from a list such as
+           "0-1,3". */
+        std::uint64_t online_nodes() {
+            static std::uint64_t const mask = [] {
+                std::ifstream in("/sys/devices/system/node/online");
+                std::uint64_t m = 0;
+                unsigned int first, last;
+                while (in >> first) {
+                    last = first;
+                    if (in.peek() == '-') {
+                        in.get();
+                        if (!(in >> last)) break;
+                    }
+                    for (unsigned int n = first; n <= last && n < 64; ++n) {
+                        m |= std::uint64_t{1} << n;
+                    }
+                    if (in.peek() != ',') break;
+                    in.get();
+                }
+                return m;
+            }();
+            return mask;
+        }
+
+        /* Spreads pages of not yet touched mapping over all nodes. */
+        void interleave([[maybe_unused]] void *p,
+                        [[maybe_unused]] std::size_t len) {
+#if defined(SYS_mbind) && defined(MPOL_INTERLEAVE)
+            if (memory::numa_nodes() < 2) return;
+            unsigned long mask = online_nodes();
+            /* Failure only costs locality. */
+            ::syscall(SYS_mbind, p, len, MPOL_INTERLEAVE, &mask,
+                      sizeof(mask) * 8 + 1, 0);
+#endif
+        }
+
+        void *map_large(std::size_t len) {
+            std::size_t size = round_up(len, large_block);
+            bool huge = use_huge_pages.load(std::memory_order_relaxed);
+#ifdef MAP_HUGETLB
+            /* Reserved huge pages are used only if default page size
+               matches our rounding, so that munmap length is valid. */
+            if (huge && hugetlb_page_size() == large_block) {
+                void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                                 -1, 0);
+                if (p != MAP_FAILED) {
+                    interleave(p, size);
+                    return p;
+                }
+            }
+#endif
+            /* Map extra and trim, so that transparent huge pages can
+               back the whole block. */
+            void *raw = ::mmap(nullptr, size + large_block,
+                               PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (raw == MAP_FAILED) throw std::bad_alloc();
+            auto begin = reinterpret_cast<std::uintptr_t>(raw);
+            std::uintptr_t aligned = round_up(begin, large_block);
+            if (aligned != begin) ::munmap(raw, aligned - begin);
+            std::size_t tail = large_block - (aligned - begin);
+            if (tail) {
+                ::munmap(reinterpret_cast<void *>(aligned + size), tail);
+            }
+
+            void *p = reinterpret_cast<void *>(aligned);
+#ifdef MADV_HUGEPAGE
+            if (huge) ::madvise(p, size, MADV_HUGEPAGE);
+#endif
+            interleave(p, size);
+            return p;
+        }
+    } // namespace
+
+    void *buffer_allocate(std::size_t len) {
+        if (len < large_block) {
+            memory::charge_scope scope(memory::subsystem::BUFFERS);
+            return ::operator new(len);
+        }
+        void *p = map_large(len);
+        mapped.add(round_up(len, large_block));
+        return p;
+    }
+
+    void buffer_free(void *p, std::size_t len) noexcept {
+        if (len < large_block) {
+            ::operator delete(p);
+        } else {
+            ::munmap(p, round_up(len, large_block));
+            mapped.sub(round_up(len, large_block));
+        }
+    }
+
+    namespace memory {
+        bool huge_pages() {
+            return use_huge_pages.load(std::memory_order_relaxed);
+        }
+
+        void set_huge_pages(bool on) {
+            use_huge_pages.store(on, std::memory_order_relaxed);
+        }
+
+        unsigned int numa_nodes() {
+            std::size_t n = std::bitset<64>(online_nodes()).count();
+            return n ? n : 1;
+        }
+
+        char const *subsystem_name(subsystem s) {
+            return subsystem_names[static_cast<std::size_t>(s)];
+        }
+
+        subsystem current_subsystem() { return charged; }
+
+        charge_scope::charge_scope(subsystem s) : saved(charged) {
+            charged = s;
+        }
+
+        charge_scope::~charge_scope() { charged = saved; }
+
+        usage subsystem_usage(subsystem s) {
+            return counters[static_cast<std::size_t>(s)].get();
+        }
+
+        usage total_usage() { return total.get(); }
+
+        usage mapped_usage() { return mapped.get(); }
+
+        void *zlib_alloc(void *, unsigned int items, unsigned int size) {
+            return allocate_nothrow(std::size_t{items} * size);
+        }
+
+        void zlib_free(void *, void *p) { tracked_free(p); }
+
+        usage process_usage() {
+            usage u = {0, 0};
+            std::ifstream in("/proc/self/status");
+            std::string line;
+            while (std::getline(in, line)) {
+                std::size_t *field;
+                if (line.compare(0, 6, "VmRSS:") == 0) {
+                    field = &u.bytes;
+                } else if (line.compare(0, 6, "VmHWM:") == 0) {
+                    field = &u.peak;
+                } else {
+                    continue;
+                }
+                try {
+                    *field = std::stoul(line.substr(6)) * 1024;
+                } catch (std::exception const &) {
+                }
+            }
+            return u;
+        }
+
+        std::size_t resident_bytes(void const *p, std::size_t len) {
+            if (!len) return 0;
+            static std::size_t const page = ::sysconf(_SC_PAGESIZE);
+            auto begin = reinterpret_cast<std::uintptr_t>(p) / page * page;
+            std::size_t npages =
+                round_up(reinterpret_cast<std::uintptr_t>(p) + len - begin,
+                         page) /
+                page;
+            std::vector<unsigned char> vec(npages);
+            if (::mincore(reinterpret_cast<void *>(begin), npages * page,
+                          vec.data()) != 0) {
+                return 0;
+            }
+            std::size_t n = 0;
+            for (unsigned char v : vec) n += v & 1;
+            return n * page;
+        }
+    } // namespace memory
+} // namespace ben
+
+/* Global allocation functions, replaced so that heap memory can be
+   accounted per subsystem. Over-aligned forms keep their defaults and
+   are not counted. */
+
+void *operator new(std::size_t n) { return ben::allocate_or_throw(n); }
+
+void *operator new[](std::size_t n) { return ben::allocate_or_throw(n); }
+
+void *operator new(std::size_t n, std::nothrow_t const &) noexcept {
+    return ben::allocate_nothrow(n);
+}
+
+void *operator new[](std::size_t n, std::nothrow_t const &) noexcept {
+    return ben::allocate_nothrow(n);
+}
+
+void operator delete(void *p) noexcept { ben::tracked_free(p); }
+
+void operator delete[](void *p) noexcept { ben::tracked_free(p); }
+
+void operator delete(void *p, std::size_t) noexcept { ben::tracked_free(p); }
+
+void operator delete[](void *p, std::size_t) noexcept {
+    ben::tracked_free(p);
+}
+
+void operator delete(void *p, std::nothrow_t const &) noexcept {
+    ben::tracked_free(p);
+}
+
+void operator delete[](void *p, std::nothrow_t const &) noexcept {
+    ben::tracked_free(p);
+}
@@ -0,0 +1,144 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEMORY_HH
+#define MEMORY_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace ben {
+    /* Blocks this large or larger are mapped directly, aligned for
+       huge pages; smaller ones come from the heap. */
+    constexpr std::size_t large_block = 2 * 1024 * 1024;
+
+    /* Allocates LEN bytes for buffer contents. Large blocks are backed
+       by huge pages when possible, and interleaved over NUMA nodes so
+       that parallel scans draw on every node's memory bandwidth.
+       Throws std::bad_alloc on failure. */
+    void *buffer_allocate(std::size_t len);
+    /* Frees block of LEN bytes returned by buffer_allocate. */
+    void buffer_free(void *p, std::size_t len) noexcept;
+
+    template <typename T> struct buffer_allocator {
+        using value_type = T;
+
+        buffer_allocator() = default;
+        template <typename U>
+        buffer_allocator(buffer_allocator<U> const &) noexcept {}
+
+        T *allocate(std::size_t n) {
+            if (n > static_cast<std::size_t>(-1) / sizeof(T)) {
+                throw std::bad_array_new_length();
+            }
+            return static_cast<T *>(buffer_allocate(n * sizeof(T)));
+        }
+        void deallocate(T *p, std::size_t n) noexcept {
+            buffer_free(p, n * sizeof(T));
+        }
+
+        /* Default-initializes, so that sizing a buffer before reading
+           into it does not write it twice. */
+        template <typename U> void construct(U *p) {
+            ::new (static_cast<void *>(p)) U;
+        }
+        template <typename U, typename... Args>
+        void construct(U *p, Args &&...args) {
+            ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+        }
+
+        template <typename U>
+        bool operator==(buffer_allocator<U> const &) const noexcept {
+            return true;
+        }
+        template <typename U>
+        bool operator!=(buffer_allocator<U> const &) const noexcept {
+            return false;
+        }
+    };
+
+    /* Bytes added by resize are left indeterminate. */
+    using byte_buffer =
+        std::vector<std::uint8_t, buffer_allocator<std::uint8_t>>;
+
+    namespace memory {
+        /* Whether large blocks allocated from now on use huge pages. */
+        bool huge_pages();
+        void set_huge_pages(bool on);
+
+        /* Number of NUMA nodes large blocks are interleaved over. */
+        unsigned int numa_nodes();
+
+        /* Parts of ben heap memory is accounted to. Memory allocated
+           with operator new or zlib_alloc is charged to the subsystem
+           current in the allocating thread. Blocks mapped directly by
+           buffer_allocate are not heap and are counted apart. */
+        enum class subsystem {
+            BUFFERS,
+            DECOMPRESSION,
+            CACHE,
+            INDEXES,
+            VARIABLES,
+            PARSER,
+            OTHER,
+            COUNT
+        };
+
+        char const *subsystem_name(subsystem s);
+        subsystem current_subsystem();
+
+        /* Charges memory this thread allocates while alive to S.
+           Scopes may nest; parallel_for passes the scope on to its
+           tasks. */
+        class charge_scope {
+            subsystem saved;
+
+        public:
+            explicit charge_scope(subsystem s);
+            ~charge_scope();
+            charge_scope(charge_scope const &) = delete;
+            charge_scope &operator=(charge_scope const &) = delete;
+        };
+
+        struct usage {
+            std::size_t bytes;
+            std::size_t peak;
+        };
+        usage subsystem_usage(subsystem s);
+        /* All subsystems together. */
+        usage total_usage();
+        /* Large blocks mapped by buffer_allocate. */
+        usage mapped_usage();
+
+        /* Allocation functions for z_stream, so that zlib's working
+           memory is charged like any other. */
+        void *zlib_alloc(void *opaque, unsigned int items, unsigned int size);
+        void zlib_free(void *opaque, void *p);
+
+        /* Resident set size of the process and its peak, or zeros if
+           unknown. */
+        usage process_usage();
+        /* Bytes of pages overlapping [P, P + LEN) present in memory. */
+        std::size_t resident_bytes(void const *p, std::size_t len);
+    } // namespace memory
+} // namespace ben
+
+#endif
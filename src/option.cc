@@ -59,7 +59,8 @@ namespace ben {
 
     std::size_t option_matcher::select_string(std::vector<std::string> item,
                                               std::size_t def_ind) {
-        if (cursor < args.size()) {
+        /* Buffer reference can follow optional item, e.g. `endian %1'. */
+        if (cursor < args.size() && args[cursor][0] != '%') {
             std::string &it = args[cursor++];
 
             for (std::size_t i = 0; i < item.size(); ++i) {
@@ -73,6 +74,20 @@ namespace ben {
         return def_ind;
     }
 
+    std::size_t
+    option_matcher::try_select_string(std::vector<std::string> item,
+                                      std::size_t def_ind) {
+        if (cursor < args.size()) {
+            for (std::size_t i = 0; i < item.size(); ++i) {
+                if (item[i] == args[cursor]) {
+                    ++cursor;
+                    return i;
+                }
+            }
+        }
+        return def_ind;
+    }
+
     std::size_t option_matcher::get_size() {
         using namespace std::string_literals;
         try {
@@ -141,18 +156,39 @@ namespace ben {
                 arg.find_first_not_of("0123456789", 1) != std::string::npos) {
                 throw std::runtime_error("Invalid buffer representation.");
             }
-            file *f =  get_file(arg);
+            file *f = ben::get_file(arg);
             if (!f) {
                 throw std::runtime_error("Buffer not found."s);
             }
         }
-        file *f = get_file(""s);
+        file *f = ben::get_file(""s);
         if (!f) {
             throw std::runtime_error("No default buffer selected."s);
         }
         return f;
     }
 
+    file *option_matcher::get_file() {
+        using namespace std::string_literals;
+        if (cursor >= args.size()) {
+            throw std::runtime_error("Mandatory argument omitted."s);
+        }
+        std::string arg = args[cursor++];
+        if (arg.size() < 2 || arg[0] != '%' ||
+            arg.find_first_not_of("0123456789", 1) != std::string::npos) {
+            throw std::runtime_error("Invalid buffer representation.");
+        }
+        file *f = nullptr;
+        try {
+            f = file_at(std::stoul(arg.substr(1)));
+        } catch (std::out_of_range const &) {
+        }
+        if (!f) {
+            throw std::runtime_error("Buffer not found."s);
+        }
+        return f;
+    }
+
     std::vector<std::string> option_matcher::get_rest() {
         std::vector<std::string> result;
         result.insert(result.end(), args.begin() + cursor, args.end());
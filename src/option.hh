@@ -38,11 +38,19 @@ namespace ben {
         std::size_t select_string(std::vector<std::string>);
         std::size_t select_string(std::vector<std::string> item,
                                   std::size_t def_ind);
+        std::size_t try_select_string(std::vector<std::string> item,
+                                      std::size_t def_ind);
         std::size_t get_size();
         std::size_t get_size(std::size_t def);
         std::ptrdiff_t get_diff();
         std::ptrdiff_t get_diff(std::ptrdiff_t def);
         file *get_file_or_default();
+        /* Unlike get_file_or_default, BUF is mandatory and the default
+           buffer is left unchanged. */
+        file *get_file();
+
+        /* Number of arguments not consumed yet. */
+        std::size_t remaining() const { return args.size() - cursor; }
 
         std::vector<std::string> get_rest();
 
@@ -0,0 +1,372 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "output.hh"
+
+namespace ben {
+    namespace {
+        struct field {
+            std::string key;
+            /* Serialized value, or elements without brackets. */
+            std::string body;
+            bool array;
+        };
+
+        bool serving = false;
+        /* Number of active captures, including the response's. */
+        int capturing = 0;
+        std::streambuf *saved_buf;
+        /* Everything written to std::cout while a request is served. */
+        string_sink capture;
+        /* Fields of the result in the order first reported. Entries
+           past nfields are kept only for their capacity, so that
+           steady-state responses do not allocate. */
+        std::vector<field> fields;
+        std::size_t nfields;
+        std::string response;
+
+        field &find_field(std::string_view key, bool array) {
+            std::size_t i = 0;
+            while (i < nfields && fields[i].key != key) ++i;
+            if (i == nfields) {
+                if (nfields == fields.size()) fields.emplace_back();
+                fields[i].key.assign(key);
+                fields[i].body.clear();
+                ++nfields;
+            }
+            fields[i].array = array;
+            return fields[i];
+        }
+
+        /* Value reported later for the same key replaces the former
+           one, as when several commands run in one request. */
+        json_writer scalar_field(std::string_view key) {
+            field &f = find_field(key, false);
+            f.body.clear();
+            return json_writer(f.body);
+        }
+
+        json_writer array_element(std::string_view key) {
+            field &f = find_field(key, true);
+            json_writer w(f.body);
+            if (!f.body.empty()) w.raw(",");
+            return w;
+        }
+
+        /* Returns length of valid UTF-8 sequence at the beginning of S,
+           or 0. */
+        std::size_t utf8_length(std::string_view s) {
+            unsigned char c = s[0];
+            std::size_t n;
+            char32_t min;
+            if (c >= 0xc2 && c < 0xe0) {
+                n = 2;
+                min = 0x80;
+            } else if (c >= 0xe0 && c < 0xf0) {
+                n = 3;
+                min = 0x800;
+            } else if (c >= 0xf0 && c < 0xf5) {
+                n = 4;
+                min = 0x10000;
+            } else {
+                return 0;
+            }
+            if (s.size() < n) return 0;
+            char32_t cp = c & (0x3f >> (n - 1));
+            for (std::size_t i = 1; i < n; ++i) {
+                unsigned char d = s[i];
+                if ((d & 0xc0) != 0x80) return 0;
+                cp = cp << 6 | (d & 0x3f);
+            }
+            if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp < 0xe000)) {
+                return 0;
+            }
+            return n;
+        }
+
+        void write_all(std::string const &s) {
+            char const *p = s.data();
+            std::size_t left = s.size();
+            while (left) {
+                ssize_t n = ::write(STDOUT_FILENO, p, left);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    return;
+                }
+                p += n;
+                left -= n;
+            }
+        }
+    } // namespace
+
+    string_sink::int_type string_sink::overflow(int_type c) {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            text.push_back(traits_type::to_char_type(c));
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize string_sink::xsputn(char const *s, std::streamsize n) {
+        text.append(s, n);
+        return n;
+    }
+
+    fd_sink::fd_sink(int fd)
+        : fd(fd), buf(static_cast<char *>(
+                      std::aligned_alloc(4096, buffer_size))) {
+        if (!buf) throw std::bad_alloc();
+        setp(buf.get(), buf.get() + buffer_size);
+    }
+
+    /* Writes buffered bytes followed by [S, S + N) and empties the
+       buffer. */
+    bool fd_sink::write_out(char const *s, std::size_t n) {
+        ::iovec iov[2] = {{pbase(), static_cast<std::size_t>(pptr() - pbase())},
+                          {const_cast<char *>(s), n}};
+        ::iovec *v = iov;
+        int cnt = 2;
+        setp(buf.get(), buf.get() + buffer_size);
+        while (cnt) {
+            if (v->iov_len == 0) {
+                ++v;
+                --cnt;
+                continue;
+            }
+            ssize_t w = ::writev(fd, v, cnt);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                error = true;
+                return false;
+            }
+            while (cnt && static_cast<std::size_t>(w) >= v->iov_len) {
+                w -= v->iov_len;
+                ++v;
+                --cnt;
+            }
+            if (cnt) {
+                v->iov_base = static_cast<char *>(v->iov_base) + w;
+                v->iov_len -= w;
+            }
+        }
+        return true;
+    }
+
+    fd_sink::int_type fd_sink::overflow(int_type c) {
+        if (!write_out(nullptr, 0)) return traits_type::eof();
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize fd_sink::xsputn(char const *s, std::streamsize n) {
+        if (n <= epptr() - pptr()) {
+            std::memcpy(pptr(), s, n);
+            pbump(n);
+            return n;
+        }
+        return write_out(s, n) ? n : 0;
+    }
+
+    int fd_sink::sync() {
+        if (pptr() == pbase()) return 0;
+        return write_out(nullptr, 0) ? 0 : -1;
+    }
+
+    void json_writer::string(std::string_view s) {
+        static char const hex[] = "0123456789abcdef";
+        out.push_back('"');
+        std::size_t run = 0;
+        for (std::size_t i = 0; i < s.size(); ++i) {
+            unsigned char c = s[i];
+            if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\') continue;
+            if (c >= 0x80) {
+                std::size_t n = utf8_length(s.substr(i));
+                if (n) {
+                    i += n - 1;
+                    continue;
+                }
+            }
+
+            out.append(s.data() + run, i - run);
+            run = i + 1;
+            switch (c) {
+            case '"':
+                out.append("\\\"");
+                break;
+            case '\\':
+                out.append("\\\\");
+                break;
+            case '\n':
+                out.append("\\n");
+                break;
+            case '\t':
+                out.append("\\t");
+                break;
+            case '\r':
+                out.append("\\r");
+                break;
+            default:
+                /* Control characters, and bytes not forming UTF-8 which
+                   are taken as Latin-1. */
+                out.append("\\u00");
+                out.push_back(hex[c >> 4]);
+                out.push_back(hex[c & 0xf]);
+            }
+        }
+        out.append(s.data() + run, s.size() - run);
+        out.push_back('"');
+    }
+
+    void json_writer::number(std::uint64_t n) {
+        char buf[24];
+        out.append(buf, std::to_chars(buf, buf + sizeof(buf), n).ptr);
+    }
+
+    void json_writer::number(std::int64_t n) {
+        char buf[24];
+        out.append(buf, std::to_chars(buf, buf + sizeof(buf), n).ptr);
+    }
+
+    void json_writer::number(double d) {
+        if (!std::isfinite(d)) {
+            out.append("null");
+            return;
+        }
+        char buf[32];
+        out.append(buf, std::to_chars(buf, buf + sizeof(buf), d).ptr);
+    }
+
+    void json_writer::key(std::string_view k) {
+        string(k);
+        out.push_back(':');
+    }
+
+    namespace output {
+        bool structured() { return serving; }
+
+        bool captured() { return capturing > 0; }
+
+        void value_unsigned(std::string_view key, std::uint64_t v) {
+            scalar_field(key).number(v);
+        }
+
+        void value_signed(std::string_view key, std::int64_t v) {
+            scalar_field(key).number(v);
+        }
+
+        void value_double(std::string_view key, double v) {
+            scalar_field(key).number(v);
+        }
+
+        void value_bool(std::string_view key, bool v) {
+            scalar_field(key).boolean(v);
+        }
+
+        void value_string(std::string_view key, std::string_view v) {
+            scalar_field(key).string(v);
+        }
+
+        void element_unsigned(std::string_view key, std::uint64_t v) {
+            array_element(key).number(v);
+        }
+
+        void element_signed(std::string_view key, std::int64_t v) {
+            array_element(key).number(v);
+        }
+
+        void element_double(std::string_view key, double v) {
+            array_element(key).number(v);
+        }
+
+        void element_string(std::string_view key, std::string_view v) {
+            array_element(key).string(v);
+        }
+
+        redirect_scope::redirect_scope(std::streambuf *sink) {
+            std::cout.flush();
+            saved = std::cout.rdbuf(sink);
+            ++capturing;
+        }
+
+        redirect_scope::~redirect_scope() {
+            std::cout.flush();
+            std::cout.rdbuf(saved);
+            --capturing;
+        }
+
+        capture_scope::capture_scope() : saved_structured(serving) {
+            serving = false;
+        }
+
+        capture_scope::~capture_scope() { serving = saved_structured; }
+
+        void begin_response() {
+            std::cout.flush();
+            capture.text.clear();
+            nfields = 0;
+            saved_buf = std::cout.rdbuf(&capture);
+            serving = true;
+            ++capturing;
+        }
+
+        void end_response(std::string_view id, int status) {
+            std::cout.rdbuf(saved_buf);
+            serving = false;
+            --capturing;
+
+            response.clear();
+            json_writer w(response);
+            w.raw("{\"id\":");
+            w.raw(id.empty() ? "null" : id);
+            w.raw(",\"status\":");
+            w.number(static_cast<std::int64_t>(status));
+            w.raw(",\"result\":{");
+            for (std::size_t i = 0; i < nfields; ++i) {
+                if (i) w.raw(",");
+                w.key(fields[i].key);
+                if (fields[i].array) w.raw("[");
+                w.raw(fields[i].body);
+                if (fields[i].array) w.raw("]");
+            }
+            w.raw("},");
+            w.key(status ? "error" : "output");
+            w.string(capture.text);
+            w.raw("}\n");
+            write_all(response);
+        }
+    } // namespace output
+} // namespace ben
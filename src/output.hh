@@ -0,0 +1,177 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OUTPUT_HH
+#define OUTPUT_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace ben {
+    /* Appends JSON text to a caller-owned string, which keeps its
+       capacity across responses. */
+    class json_writer {
+        std::string &out;
+
+    public:
+        explicit json_writer(std::string &out) : out(out) {}
+
+        void raw(std::string_view s) { out.append(s); }
+        void string(std::string_view s);
+        void number(std::uint64_t n);
+        void number(std::int64_t n);
+        void number(double d);
+        void boolean(bool b) { out.append(b ? "true" : "false"); }
+        void key(std::string_view k);
+    };
+
+    /* Stream buffer appending everything written to a string. */
+    class string_sink : public std::streambuf {
+    public:
+        std::string text;
+
+    protected:
+        int_type overflow(int_type c) override;
+        std::streamsize xsputn(char const *s, std::streamsize n) override;
+    };
+
+    /* Stream buffer writing to file descriptor through a large aligned
+       buffer. A write not fitting in the buffer goes out together with
+       buffered bytes in a single writev, without being copied. Does
+       not own the descriptor. */
+    class fd_sink : public std::streambuf {
+        struct free_deleter {
+            void operator()(char *p) const { std::free(p); }
+        };
+
+        int fd;
+        std::unique_ptr<char, free_deleter> buf;
+        bool error = false;
+
+        bool write_out(char const *s, std::size_t n);
+
+    public:
+        static constexpr std::size_t buffer_size = 1 << 20;
+
+        explicit fd_sink(int fd);
+        ~fd_sink() override { sync(); }
+
+        /* True if any write failed. */
+        bool failed() const { return error; }
+
+    protected:
+        int_type overflow(int_type c) override;
+        std::streamsize xsputn(char const *s, std::streamsize n) override;
+        int sync() override;
+    };
+
+    namespace output {
+        /* True while a --jsonl request is being served. */
+        bool structured();
+        /* True while std::cout is redirected, so that output written
+           to stdout by other means would be lost. */
+        bool captured();
+
+        void value_unsigned(std::string_view key, std::uint64_t v);
+        void value_signed(std::string_view key, std::int64_t v);
+        void value_double(std::string_view key, double v);
+        void value_bool(std::string_view key, bool v);
+        void value_string(std::string_view key, std::string_view v);
+        void element_unsigned(std::string_view key, std::uint64_t v);
+        void element_signed(std::string_view key, std::int64_t v);
+        void element_double(std::string_view key, double v);
+        void element_string(std::string_view key, std::string_view v);
+
+        /* Reports V as field KEY of the result of current request.
+           Does nothing outside --jsonl mode. */
+        template <typename T> void value(std::string_view key, T v) {
+            if (!structured()) return;
+            if constexpr (std::is_same_v<T, bool>) {
+                value_bool(key, v);
+            } else if constexpr (std::is_floating_point_v<T>) {
+                value_double(key, v);
+            } else if constexpr (std::is_integral_v<T> &&
+                                 std::is_signed_v<T>) {
+                value_signed(key, v);
+            } else if constexpr (std::is_integral_v<T>) {
+                value_unsigned(key, v);
+            } else {
+                value_string(key, v);
+            }
+        }
+
+        /* Appends V to array field KEY of the result. */
+        template <typename T> void element(std::string_view key, T v) {
+            if (!structured()) return;
+            if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+                element_signed(key, v);
+            } else if constexpr (std::is_integral_v<T>) {
+                element_unsigned(key, v);
+            } else if constexpr (std::is_floating_point_v<T>) {
+                element_double(key, v);
+            } else {
+                element_string(key, v);
+            }
+        }
+
+        /* Redirects std::cout to SINK while alive, as for `>'.
+           Scopes may nest. */
+        class redirect_scope {
+            std::streambuf *saved;
+
+        public:
+            explicit redirect_scope(std::streambuf *sink);
+            ~redirect_scope();
+            redirect_scope(redirect_scope const &) = delete;
+            redirect_scope &operator=(redirect_scope const &) = delete;
+        };
+
+        /* Redirects std::cout into a string while alive, as for
+           command substitution. Structured results reported meanwhile
+           are discarded. */
+        class capture_scope {
+            string_sink sink;
+            redirect_scope redirect{&sink};
+            bool saved_structured;
+
+        public:
+            capture_scope();
+            ~capture_scope();
+            capture_scope(capture_scope const &) = delete;
+            capture_scope &operator=(capture_scope const &) = delete;
+
+            std::string &text() { return sink.text; }
+        };
+
+        /* Starts capturing std::cout and collecting result fields. */
+        void begin_response();
+        /* Writes a response line with ID (raw JSON text) and STATUS
+           to stdout in a single write, and stops capturing. Captured
+           text is reported as "output", or as "error" if STATUS is not
+           zero. */
+        void end_response(std::string_view id, int status);
+    } // namespace output
+} // namespace ben
+
+#endif
@@ -0,0 +1,317 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "memory.hh"
+#include "parallel.hh"
+#include "trace.hh"
+
+namespace ben {
+    namespace {
+        using clock = std::chrono::steady_clock;
+
+        std::size_t cpu_count() {
+            return std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        struct job {
+            std::function<void(std::size_t, std::size_t)> const &body;
+            std::size_t n;
+            std::size_t grain;
+            cancellation_token *token;
+            /* Subsystem of the submitting thread, charged for memory
+               the tasks allocate. */
+            memory::subsystem charged;
+            /* Chunks not yet run or skipped. */
+            std::atomic<std::size_t> remaining;
+            std::atomic<bool> failed{false};
+            std::exception_ptr error;
+            std::mutex error_mutex;
+
+            job(std::function<void(std::size_t, std::size_t)> const &body,
+                std::size_t n, std::size_t grain, cancellation_token *token,
+                std::size_t nchunks)
+                : body(body), n(n), grain(grain), token(token),
+                  charged(memory::current_subsystem()), remaining(nchunks) {}
+        };
+
+        /* Chunks [begin, end) of a job. */
+        struct task {
+            job *j;
+            std::size_t begin;
+            std::size_t end;
+        };
+
+        /* Deque of one thread. The owner pushes and pops at the back,
+           while idle threads steal from the front, taking the largest
+           ranges. */
+        struct worker_slot {
+            std::mutex mutex;
+            std::deque<task> tasks;
+            std::atomic<std::uint64_t> executed{0};
+            std::atomic<std::uint64_t> stolen{0};
+            std::atomic<std::uint64_t> busy_ns{0};
+        };
+
+        class thread_pool {
+            /* One slot per pool thread, and the last one for threads
+               outside the pool. */
+            std::vector<std::unique_ptr<worker_slot>> slots;
+            std::vector<std::thread> threads;
+            clock::time_point started;
+
+            std::mutex sleep_mutex;
+            std::condition_variable wake;
+            std::atomic<std::size_t> queued{0};
+            std::atomic<std::size_t> sleeping{0};
+            bool stopping = false;
+
+            std::mutex done_mutex;
+            std::condition_variable done;
+
+            void push(std::size_t slot, task t) {
+                {
+                    std::lock_guard<std::mutex> lock(slots[slot]->mutex);
+                    slots[slot]->tasks.push_back(t);
+                }
+                queued.fetch_add(1);
+                if (sleeping.load()) {
+                    std::lock_guard<std::mutex> lock(sleep_mutex);
+                    wake.notify_one();
+                }
+            }
+
+            bool pop(std::size_t slot, task &t) {
+                if (!queued.load()) return false;
+                {
+                    worker_slot &own = *slots[slot];
+                    std::lock_guard<std::mutex> lock(own.mutex);
+                    if (!own.tasks.empty()) {
+                        t = own.tasks.back();
+                        own.tasks.pop_back();
+                        queued.fetch_sub(1);
+                        return true;
+                    }
+                }
+                for (std::size_t i = 1; i < slots.size(); ++i) {
+                    worker_slot &victim = *slots[(slot + i) % slots.size()];
+                    std::lock_guard<std::mutex> lock(victim.mutex);
+                    if (!victim.tasks.empty()) {
+                        t = victim.tasks.front();
+                        victim.tasks.pop_front();
+                        queued.fetch_sub(1);
+                        slots[slot]->stolen.fetch_add(1);
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            /* Runs T, leaving halves of it in own deque for others to
+               steal. */
+            void run(std::size_t slot, task t) {
+                while (t.end - t.begin > 1) {
+                    std::size_t mid = t.begin + (t.end - t.begin) / 2;
+                    push(slot, {t.j, mid, t.end});
+                    t.end = mid;
+                }
+
+                job &j = *t.j;
+                if (!j.failed.load() && !(j.token && j.token->cancelled())) {
+                    clock::time_point begin = clock::now();
+                    std::size_t first = t.begin * j.grain;
+                    memory::charge_scope scope(j.charged);
+                    trace::span span("parallel", "task");
+                    try {
+                        j.body(first, std::min(j.n, first + j.grain));
+                    } catch (...) {
+                        std::lock_guard<std::mutex> lock(j.error_mutex);
+                        if (!j.error) j.error = std::current_exception();
+                        j.failed = true;
+                    }
+                    slots[slot]->busy_ns.fetch_add(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            clock::now() - begin)
+                            .count());
+                    slots[slot]->executed.fetch_add(1);
+                }
+                if (j.remaining.fetch_sub(1) == 1) {
+                    std::lock_guard<std::mutex> lock(done_mutex);
+                    done.notify_all();
+                }
+            }
+
+            void worker(std::size_t slot);
+
+            void start(std::size_t n) {
+                slots.clear();
+                for (std::size_t i = 0; i < n; ++i) {
+                    slots.push_back(std::make_unique<worker_slot>());
+                }
+                stopping = false;
+                started = clock::now();
+                for (std::size_t i = 0; i + 1 < n; ++i) {
+                    threads.emplace_back(&thread_pool::worker, this, i);
+                }
+            }
+
+            void stop() {
+                {
+                    std::lock_guard<std::mutex> lock(sleep_mutex);
+                    stopping = true;
+                    wake.notify_all();
+                }
+                for (std::thread &th : threads) th.join();
+                threads.clear();
+            }
+
+        public:
+            thread_pool() { start(cpu_count()); }
+            ~thread_pool() { stop(); }
+
+            std::size_t size() const { return slots.size(); }
+
+            /* Keeps the former size if threads cannot be created. */
+            void resize(std::size_t n) {
+                std::size_t old = slots.size();
+                stop();
+                try {
+                    start(n);
+                } catch (...) {
+                    stop();
+                    start(old);
+                    throw;
+                }
+            }
+
+            void execute(job &j, std::size_t nchunks);
+
+            std::vector<thread_stats> statistics() const {
+                double wall = std::chrono::duration_cast<
+                                  std::chrono::nanoseconds>(clock::now() -
+                                                            started)
+                                  .count();
+                std::vector<thread_stats> stats;
+                for (auto const &s : slots) {
+                    stats.push_back({s->executed.load(), s->stolen.load(),
+                                     wall > 0 ? s->busy_ns.load() / wall
+                                              : 0});
+                }
+                return stats;
+            }
+        };
+
+        /* Slot of current thread, or -1 outside the pool. */
+        thread_local int current_slot = -1;
+
+        void thread_pool::worker(std::size_t slot) {
+            current_slot = slot;
+            for (;;) {
+                task t;
+                if (pop(slot, t)) {
+                    run(slot, t);
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                sleeping.fetch_add(1);
+                wake.wait(lock, [this] { return stopping || queued.load(); });
+                sleeping.fetch_sub(1);
+                if (stopping) return;
+            }
+        }
+
+        void thread_pool::execute(job &j, std::size_t nchunks) {
+            std::size_t slot =
+                current_slot < 0 ? slots.size() - 1 : current_slot;
+            push(slot, {&j, 0, nchunks});
+
+            /* Help with any task while waiting, so that nested calls
+               from pool threads cannot starve. */
+            while (j.remaining.load()) {
+                task t;
+                if (pop(slot, t)) {
+                    run(slot, t);
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(done_mutex);
+                done.wait_for(lock, std::chrono::milliseconds(1),
+                              [&j] { return !j.remaining.load(); });
+            }
+        }
+
+        thread_pool &pool() {
+            static thread_pool instance;
+            return instance;
+        }
+    } // namespace
+
+    void parallel_for(std::size_t n, std::size_t grain,
+                      std::function<void(std::size_t, std::size_t)> body,
+                      cancellation_token *token) {
+        if (n == 0) return;
+        if (grain == 0) grain = 1;
+
+        std::size_t nchunks = (n + grain - 1) / grain;
+        if (nchunks == 1 || pool().size() == 1) {
+            for (std::size_t begin = 0; begin < n; begin += grain) {
+                if (token && token->cancelled()) break;
+                body(begin, std::min(n, begin + grain));
+            }
+            return;
+        }
+
+        job j(body, n, grain, token, nchunks);
+        pool().execute(j, nchunks);
+
+        if (j.error) std::rethrow_exception(j.error);
+    }
+
+    std::size_t thread_count() { return pool().size(); }
+
+    std::size_t max_thread_count() { return 4 * cpu_count(); }
+
+    void set_thread_count(std::size_t n) {
+        if (n == 0) n = cpu_count();
+        if (n > max_thread_count()) {
+            throw std::invalid_argument("Too many threads; at most " +
+                                        std::to_string(max_thread_count()) +
+                                        '.');
+        }
+        pool().resize(n);
+    }
+
+    std::vector<thread_stats> thread_statistics() {
+        return pool().statistics();
+    }
+} // namespace ben
@@ -0,0 +1,71 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARALLEL_HH
+#define PARALLEL_HH
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace ben {
+    /* Lets a caller stop parallel_for early. Chunks not yet started are
+       skipped once cancelled; running ones may poll cancelled(). */
+    class cancellation_token {
+        std::atomic<bool> flag{false};
+
+    public:
+        void cancel() { flag.store(true, std::memory_order_relaxed); }
+        bool cancelled() const {
+            return flag.load(std::memory_order_relaxed);
+        }
+    };
+
+    /* Splits [0, N) into chunks of GRAIN elements and calls BODY with
+       each chunk's [begin, end) on the shared thread pool. Returns when
+       every chunk is processed or skipped. Exception thrown from BODY
+       cancels the rest and is rethrown here. May be nested. */
+    void parallel_for(std::size_t n, std::size_t grain,
+                      std::function<void(std::size_t, std::size_t)> body,
+                      cancellation_token *token = nullptr);
+
+    /* Number of threads parallel_for runs on, including the caller. */
+    std::size_t thread_count();
+    /* Largest thread count accepted, a few times number of CPUs. */
+    std::size_t max_thread_count();
+    /* Restarts the pool with N threads; 0 means number of CPUs. Throws
+       std::invalid_argument if N exceeds max_thread_count(), or
+       std::system_error if threads cannot be created, in which case
+       the pool keeps its former size. */
+    void set_thread_count(std::size_t n);
+
+    struct thread_stats {
+        std::uint64_t tasks;
+        std::uint64_t steals;
+        /* Fraction of time spent running tasks since pool started. */
+        double busy;
+    };
+
+    /* One entry per pool thread, followed by one for threads outside
+       the pool, such as the main thread. */
+    std::vector<thread_stats> thread_statistics();
+} // namespace ben
+
+#endif
@@ -18,14 +18,23 @@
 
 #include <algorithm>
 #include <cctype>
+#include <cerrno>
 #include <cstddef>
+#include <cstring>
 #include <exception>
+#include <iostream>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "command.hh"
+#include "memory.hh"
+#include "output.hh"
 #include "parse.hh"
+#include "trace.hh"
 #include "variable.hh"
 
 namespace ben {
@@ -33,6 +42,7 @@ namespace ben {
         enum class token_type {
             NONE,
             STRING,
+            REDIRECT,
             END_STMT,
         };
 
@@ -42,6 +52,9 @@ namespace ben {
             std::size_t end = 0;
         };
 
+        std::size_t tokenize_substitution(std::string const &commandline,
+                                          std::size_t pos);
+
         std::size_t tokenize_quoted(std::string const &commandline,
                                     std::size_t pos) {
             char end;
@@ -59,6 +72,42 @@ namespace ben {
                 }
                 if (commandline[pos] == '\\') escaped = true;
                 if (commandline[pos] == end) return pos;
+                if (end == '"' && commandline[pos] == '$' &&
+                    pos + 1 < commandline.size() &&
+                    commandline[pos + 1] == '(') {
+                    pos = tokenize_substitution(commandline, pos + 1);
+                }
+            }
+
+            throw std::runtime_error("parse error at " + std::to_string(pos));
+        }
+
+        /* Returns position of `)' closing `$(' whose `(' is at POS, so
+           that spaces and `;' inside are kept in the token. */
+        std::size_t tokenize_substitution(std::string const &commandline,
+                                          std::size_t pos) {
+            int depth = 0;
+            bool escaped = false;
+            for (; pos < commandline.size(); ++pos) {
+                if (escaped) {
+                    escaped = false;
+                    continue;
+                }
+                switch (commandline[pos]) {
+                case '\\':
+                    escaped = true;
+                    break;
+                case '"':
+                case '\'':
+                    pos = tokenize_quoted(commandline, pos);
+                    break;
+                case '(':
+                    ++depth;
+                    break;
+                case ')':
+                    if (--depth == 0) return pos;
+                    break;
+                }
             }
 
             throw std::runtime_error("parse error at " + std::to_string(pos));
@@ -106,6 +155,17 @@ namespace ben {
                     escaped = true;
                     break;
 
+                case '>':
+                    /* `>' or `>>' is a token by itself. */
+                    PUSH_CURRENT();
+                    RENEW_TOKEN(token_type::REDIRECT);
+                    if (i + 1 < commandline.size() && commandline[i + 1] == '>')
+                        ++i;
+                    current.end = i + 1;
+                    tokens.push_back(current);
+                    current.type = token_type::NONE;
+                    break;
+
                 default:
                     /* STRING can be consist of multiple characters. */
                     if (current.type != token_type::STRING) {
@@ -114,6 +174,10 @@ namespace ben {
                     }
                     if (commandline[i] == '"' || commandline[i] == '\'') {
                         i = tokenize_quoted(commandline, i);
+                    } else if (commandline[i] == '$' &&
+                               i + 1 < commandline.size() &&
+                               commandline[i + 1] == '(') {
+                        i = tokenize_substitution(commandline, i + 1);
                     }
                     break;
                 }
@@ -176,6 +240,22 @@ namespace ben {
                     current->stmt = stmt;
 
                     for (; i < tokens.size(); ++i) {
+                        if (tokens[i].type == token_type::REDIRECT) {
+                            bool append =
+                                tokens[i].end - tokens[i].begin == 2;
+                            if (tokens[i + 1].type != token_type::STRING) {
+                                throw std::runtime_error(
+                                    "parse error at " +
+                                    std::to_string(tokens[i].end));
+                            }
+                            ++i;
+                            stmt->push_redirection(
+                                std::string(
+                                    commandline.begin() + tokens[i].begin,
+                                    commandline.begin() + tokens[i].end),
+                                append);
+                            continue;
+                        }
                         if (tokens[i].type != token_type::STRING) break;
 
                         stmt->push_arg(
@@ -192,15 +272,49 @@ namespace ben {
             str.insert(str.end(), s.begin(), s.end());
         }
 
+        /* Runs CMDLINE in this process and appends what it writes to
+           std::cout, without trailing newlines, as a shell does. */
+        void expand_command(std::string &str, std::string const &cmdline) {
+            output::capture_scope capture;
+            execute_command_line(cmdline);
+            std::string &out = capture.text();
+            std::size_t len = out.find_last_not_of('\n');
+            str.append(out, 0, len == std::string::npos ? 0 : len + 1);
+        }
+
         std::string unescape_string_literal(std::string const &str) {
-            enum class expand_type { NONE, MAYBE, PLAIN, BRACE };
+            enum class expand_type { NONE, MAYBE, PLAIN, BRACE, COMMAND };
             std::string result;
             bool double_quot = false;
             bool single_quot = false;
             expand_type var_expand = expand_type::NONE;
             std::string var_name;
             bool esc_sequence = false;
+            /* State of $(...) being read into var_name. */
+            int cmd_depth = 0;
+            char cmd_quot = 0;
+            bool cmd_escaped = false;
             for (char c : str) {
+                if (var_expand == expand_type::COMMAND) {
+                    if (cmd_escaped) {
+                        cmd_escaped = false;
+                    } else if (c == '\\' && cmd_quot != '\'') {
+                        cmd_escaped = true;
+                    } else if (cmd_quot) {
+                        if (c == cmd_quot) cmd_quot = 0;
+                    } else if (c == '"' || c == '\'') {
+                        cmd_quot = c;
+                    } else if (c == '(') {
+                        ++cmd_depth;
+                    } else if (c == ')' && cmd_depth-- == 0) {
+                        expand_command(result, var_name);
+                        var_name.clear();
+                        var_expand = expand_type::NONE;
+                        continue;
+                    }
+                    var_name.push_back(c);
+                    continue;
+                }
                 if (single_quot) {
                     if (c != '\'') single_quot = false;
                     result.push_back(c);
@@ -241,6 +355,11 @@ namespace ben {
                         if (c == '{') {
                             var_expand = expand_type::BRACE;
                             continue;
+                        } else if (c == '(') {
+                            var_expand = expand_type::COMMAND;
+                            cmd_depth = 0;
+                            cmd_quot = 0;
+                            continue;
                         } else {
                             var_expand = expand_type::PLAIN;
                         }
@@ -317,8 +436,33 @@ namespace ben {
         }
     } // namespace
 
+    int execute_command_line(std::string const &commandline) {
+        command_chain *chain = parse_command_line(commandline);
+        command_chain *first = chain;
+        int status = 0;
+        try {
+            while (chain != nullptr) {
+                status = chain->stmt->execute();
+
+                chain = chain->next;
+            }
+        } catch (...) {
+            command_chain_clean_up(first);
+            throw;
+        }
+        command_chain_clean_up(first);
+        return status;
+    }
+
     command_chain *parse_command_line(std::string commandline) {
-        return parse(commandline, tokenize(commandline));
+        memory::charge_scope scope(memory::subsystem::PARSER);
+        std::vector<token> tokens;
+        {
+            trace::span span("parse", "tokenize");
+            tokens = tokenize(commandline);
+        }
+        trace::span span("parse", "parse");
+        return parse(commandline, tokens);
     }
 
     void command_chain_clean_up(command_chain *obj) {
@@ -339,10 +483,52 @@ namespace ben {
     int command_statement::execute() {
         std::vector<std::string> args;
 
-        for (std::string const &str : command_line) {
-            args.push_back(unescape_string_literal(str));
+        {
+            trace::span span("parse", "expand");
+            for (std::string const &str : command_line) {
+                args.push_back(unescape_string_literal(str));
+            }
+        }
+
+        if (redirections.empty()) return command_execute(args);
+
+        /* As in shells, every target is opened but output goes only
+           to the last one. */
+        int fd = -1;
+        std::string target;
+        for (redirection const &r : redirections) {
+            if (fd >= 0) ::close(fd);
+            target = unescape_string_literal(r.target);
+            fd = ::open(target.c_str(),
+                        O_WRONLY | O_CREAT | O_CLOEXEC |
+                            (r.append ? O_APPEND : O_TRUNC),
+                        0666);
+            if (fd < 0) {
+                int errsave = errno;
+                std::cout << "ben: " << target << ": "
+                          << std::strerror(errsave) << '\n';
+                return 1;
+            }
         }
 
-        return command_execute(args);
+        int status;
+        bool failed;
+        try {
+            fd_sink sink(fd);
+            {
+                output::redirect_scope redirect(&sink);
+                status = command_execute(args);
+            }
+            failed = sink.failed();
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+        if (failed) {
+            std::cout << "ben: " << target << ": Write error.\n";
+            return 1;
+        }
+        return status;
     }
 } // namespace ben
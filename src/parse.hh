@@ -43,10 +43,20 @@ namespace ben {
     };
 
     class command_statement : public single_statement {
+        struct redirection {
+            std::string target;
+            bool append;
+        };
+
         std::vector<std::string> command_line;
+        std::vector<redirection> redirections;
 
     public:
         void push_arg(std::string arg) { command_line.push_back(arg); }
+        /* `> TARGET', or `>> TARGET' if APPEND is set. */
+        void push_redirection(std::string target, bool append) {
+            redirections.push_back({std::move(target), append});
+        }
 
         int execute() override;
     };
@@ -60,6 +70,10 @@ namespace ben {
     command_chain *parse_command_line(std::string commandline);
 
     void command_chain_clean_up(command_chain *obj);
+
+    /* Parses and executes COMMANDLINE, returning status of the last
+       statement. */
+    int execute_command_line(std::string const &commandline);
 } // namespace ben
 
 #endif
@@ -29,40 +29,117 @@
 #include <stdexcept>
 #include <string>
 
+#include "bits.hh"
 #include "command.hh"
+#include "decode.hh"
 #include "file.hh"
 #include "option.hh"
+#include "output.hh"
+#include "unicode.hh"
 
 namespace ben {
     namespace {
-        bool big_endian;
-
         void help_endian([[maybe_unused]] std::string cmd) {
-            std::cout << R"(usage: endian [big|little]
-       endian
+            std::cout << R"(usage: endian [big|little] [BUF]
+       endian [BUF]
 
-if big or little is specified, prints current value.
+Specify byte order used to decode values in BUF.
+If neither big nor little is specified, prints current value.
 )";
         }
 
         int endian(std::vector<std::string> const &args) {
             std::size_t en;
+            file *f;
             try {
                 option_matcher opt(args);
-                en = opt.select_string({"little", "big"}, big_endian ? 1 : 0);
+                en = opt.select_string({"little", "big"}, 2);
+                f = opt.get_file_or_default();
                 opt.must_not_remain();
             } catch (std::runtime_error const &e) {
                 std::cout << "endian: " << e.what() << '\n';
-                return 0;
+                return 1;
             }
 
             if (en == 0) {
-                big_endian = false;
+                f->endian = byte_order::LITTLE;
             } else if (en == 1) {
-                big_endian = true;
+                f->endian = byte_order::BIG;
             } else {
-                std::cout << (big_endian ? "big endian\n" : "little endian\n");
-                return 0;
+                std::cout << (f->endian == byte_order::BIG ? "big endian\n"
+                                                           : "little endian\n");
+                output::value("endian",
+                              f->endian == byte_order::BIG ? "big" : "little");
+            }
+            return 0;
+        }
+
+        void help_bitorder([[maybe_unused]] std::string cmd) {
+            std::cout << R"(usage: bitorder [msb|lsb] [BUF]
+       bitorder [BUF]
+
+Specify order of bits within a byte used to read bit fields in BUF.
+If neither msb nor lsb is specified, prints current value.
+)";
+        }
+
+        int bitorder(std::vector<std::string> const &args) {
+            std::size_t ord;
+            file *f;
+            try {
+                option_matcher opt(args);
+                ord = opt.select_string({"msb", "lsb"}, 2);
+                f = opt.get_file_or_default();
+                opt.must_not_remain();
+            } catch (std::runtime_error const &e) {
+                std::cout << "bitorder: " << e.what() << '\n';
+                return 1;
+            }
+
+            if (ord == 0) {
+                f->bits = bit_order::MSB;
+            } else if (ord == 1) {
+                f->bits = bit_order::LSB;
+            } else {
+                std::cout << (f->bits == bit_order::MSB ? "msb first\n"
+                                                        : "lsb first\n");
+                output::value("bitorder",
+                              f->bits == bit_order::MSB ? "msb" : "lsb");
+            }
+            return 0;
+        }
+
+        void help_radix([[maybe_unused]] std::string cmd) {
+            std::cout << R"(usage: radix [bin|oct|dec|hex] [BUF]
+       radix [BUF]
+
+Specify radix `print' uses for BUF when it is not given explicitly.
+If radix is not specified, prints current value.
+)";
+        }
+
+        int radix_command(std::vector<std::string> const &args) {
+            std::size_t rad;
+            file *f;
+            try {
+                option_matcher opt(args);
+                rad = opt.select_string({"bin", "oct", "dec", "hex"}, 4);
+                f = opt.get_file_or_default();
+                opt.must_not_remain();
+            } catch (std::runtime_error const &e) {
+                std::cout << "radix: " << e.what() << '\n';
+                return 1;
+            }
+
+            if (rad < 4) {
+                f->default_radix = static_cast<radix>(rad);
+            } else {
+                static char const *const names[] = {"bin", "oct", "dec",
+                                                    "hex"};
+                std::cout << names[static_cast<std::size_t>(f->default_radix)]
+                          << '\n';
+                output::value(
+                    "radix", names[static_cast<std::size_t>(f->default_radix)]);
             }
             return 0;
         }
@@ -81,10 +158,14 @@ if big or little is specified, prints current value.
 
         void help_print([[maybe_unused]] std::string cmd) {
             std::cout << R"(print TYPE [bin|oct|dec|hex] [BUFFER]
+       print bits N [bin|oct|dec|hex] [BUFFER]
 Interpret byte array beginning from cursor position as given TYPE
 and print.
-You can check and specify byte-order with `endian' command.
+You can check and specify byte-order of each buffer with `endian'
+command, and default radix with `radix' command.
 If BUFFER is omitted, use previously used buffer.
+`bits' reads N (1 to 64) bits from the bit cursor in the order
+specified with `bitorder' command. Use `seekbits' to advance it.
 
 Possible types;
   char    ASCII character.
@@ -98,38 +179,35 @@ Possible types;
   int64   two's complement 64-bit integer.
   float   IEEE 754 single precision floating point number.
   double  IEEE 754 double precision floating point number.
+  bits    unsigned bit field with N-bit width.
 )";
         }
 
-        inline void ordered_memcpy(void *dest, void *src, size_t n) {
-            if (big_endian) {
-                std::uint8_t buf[n];
-                std::memcpy(buf, src, n);
-                std::reverse(buf, buf + n);
-                std::memcpy(dest, buf, n);
-            } else {
-                std::memcpy(dest, src, n);
-            }
-        }
-
         bool check_buffer_size(file *f, unsigned int size) {
             return f->data.size() - f->cursor >= size;
         }
 
-        enum class print_style { BIN, OCT, DEC, HEX };
+        template <bit_order Order>
+        std::uint64_t peek_bits(file *f, unsigned int n) {
+            bit_reader<Order> reader(f->data.data() + f->cursor,
+                                     f->data.size() - f->cursor);
+            reader.skip(f->bit_cursor);
+            return reader.read(n);
+        }
 
-        template <typename T> void print_value(T value, print_style sty) {
-            if (sty == print_style::BIN) {
+        template <typename T> void print_value(T value, radix sty) {
+            output::value("value", value);
+            if (sty == radix::BIN) {
                 std::cout << std::bitset<sizeof(T) * 8>(value) << '\n';
             } else {
                 std::ios init(nullptr);
                 init.copyfmt(std::cout);
 
-                if (sty == print_style::OCT) {
+                if (sty == radix::OCT) {
                     std::cout << std::oct;
-                } else if (sty == print_style::DEC)
+                } else if (sty == radix::DEC)
                     std::cout << std::dec;
-                else if (sty == print_style::HEX)
+                else if (sty == radix::HEX)
                     std::cout << std::hex;
 
                 std::cout << +value << '\n';
@@ -138,32 +216,76 @@ Possible types;
             }
         }
 
+        enum class print_type {
+            CHAR,
+            UINT8,
+            UINT16,
+            UINT32,
+            UINT64,
+            INT8,
+            INT16,
+            INT32,
+            INT64,
+            FLOAT,
+            DOUBLE,
+            BITS
+        };
+
+        template <typename T, byte_order Order>
+        int print_decoded(file *f, radix style) {
+            if (!check_buffer_size(f, sizeof(T))) return 1;
+            print_value(decode<T, Order>(f->data.data() + f->cursor), style);
+            return 0;
+        }
+
+        /* Instantiated for each byte order so that decoding does not
+           branch on the buffer's endianness. */
+        template <byte_order Order>
+        int print_number(file *f, print_type type, radix style) {
+            switch (type) {
+            case print_type::UINT8:
+                return print_decoded<std::uint8_t, Order>(f, style);
+            case print_type::UINT16:
+                return print_decoded<std::uint16_t, Order>(f, style);
+            case print_type::UINT32:
+                return print_decoded<std::uint32_t, Order>(f, style);
+            case print_type::UINT64:
+                return print_decoded<std::uint64_t, Order>(f, style);
+            case print_type::INT8:
+                return print_decoded<std::int8_t, Order>(f, style);
+            case print_type::INT16:
+                return print_decoded<std::int16_t, Order>(f, style);
+            case print_type::INT32:
+                return print_decoded<std::int32_t, Order>(f, style);
+            case print_type::INT64:
+                return print_decoded<std::int64_t, Order>(f, style);
+            case print_type::FLOAT:
+                return print_decoded<float, Order>(f, style);
+            case print_type::DOUBLE:
+                return print_decoded<double, Order>(f, style);
+            default:
+                std::cout << "Unknown type.\n";
+                return 1;
+            }
+        }
+
         int print(std::vector<std::string> const &args) {
-            using namespace std::string_literals;
-            enum print_type {
-                CHAR,
-                UINT8,
-                UINT16,
-                UINT32,
-                UINT64,
-                INT8,
-                INT16,
-                INT32,
-                INT64,
-                FLOAT,
-                DOUBLE
-            };
             print_type type;
-            print_style style;
+            std::size_t nbits = 0;
+            std::size_t style_ind;
             file *f;
             try {
                 option_matcher opt(args);
                 type = static_cast<print_type>(opt.select_string(
                     {"char", "uint8", "uint16", "uint32", "uint64", "int8",
-                     "int16", "int32", "int64", "float", "double"}));
-                style = static_cast<print_style>(opt.select_string(
-                    {"bin", "oct", "dec", "hex"},
-                    static_cast<std::size_t>(print_style::DEC)));
+                     "int16", "int32", "int64", "float", "double", "bits"}));
+                if (type == print_type::BITS) {
+                    nbits = opt.get_size();
+                    if (nbits == 0 || nbits > 64) {
+                        throw std::runtime_error("N must be 1 to 64.");
+                    }
+                }
+                style_ind = opt.select_string({"bin", "oct", "dec", "hex"}, 4);
                 f = opt.get_file_or_default();
                 opt.must_not_remain();
             } catch (std::runtime_error const &e) {
@@ -174,100 +296,80 @@ Possible types;
                 help_print(args[0]);
                 return 1;
             }
+            radix style = style_ind < 4 ? static_cast<radix>(style_ind)
+                                        : f->default_radix;
 
-            std::ios init(nullptr);
-            init.copyfmt(std::cout);
-
-            switch (type) {
-            case CHAR:
+            if (type == print_type::CHAR) {
                 if (!check_buffer_size(f, 1)) return 1;
                 print_char(f->data[f->cursor]);
                 std::cout << '\n';
-                break;
-            case UINT8:
-                if (!check_buffer_size(f, 1)) return 1;
-                print_value(f->data[f->cursor], style);
-                break;
-            case UINT16: {
-                if (!check_buffer_size(f, 2)) return 1;
-                uint16_t num;
-                ordered_memcpy(&num, f->data.data() + f->cursor, 2);
-                print_value(num, style);
-                break;
-            }
-            case UINT32: {
-                if (!check_buffer_size(f, 4)) return 1;
-                uint32_t num;
-                ordered_memcpy(&num, f->data.data() + f->cursor, 4);
-                print_value(num, style);
-                break;
-            }
-            case UINT64: {
-                if (!check_buffer_size(f, 8)) return 1;
-                uint64_t num;
-                ordered_memcpy(&num, f->data.data() + f->cursor, 8);
-                print_value(num, style);
-                break;
-            }
-            case INT8:
-                if (!check_buffer_size(f, 1)) return 1;
-                print_value(f->data[f->cursor], style);
-                break;
-            case INT16: {
-                if (!check_buffer_size(f, 2)) return 1;
-                int16_t num;
-                ordered_memcpy(&num, f->data.data() + f->cursor, 2);
-                print_value(num, style);
-                break;
-            }
-            case INT32: {
-                if (!check_buffer_size(f, 4)) return 1;
-                int32_t num;
-                ordered_memcpy(&num, f->data.data() + f->cursor, 4);
-                print_value(num, style);
-                break;
-            }
-            case INT64: {
-                if (!check_buffer_size(f, 8)) return 1;
-                int64_t num;
-                ordered_memcpy(&num, f->data.data() + f->cursor, 8);
-                print_value(num, style);
-                break;
-            }
-            case FLOAT: {
-                if (!check_buffer_size(f, 4)) return 1;
-                float num;
-                ordered_memcpy(&num, f->data.data() + f->cursor, 4);
-                print_value(num, style);
-                break;
+                output::value("value", f->data[f->cursor]);
+                return 0;
             }
-            case DOUBLE: {
-                if (!check_buffer_size(f, 8)) return 1;
-                double num;
-                ordered_memcpy(&num, f->data.data() + f->cursor, 8);
-                print_value(num, style);
-                break;
+            if (type == print_type::BITS) {
+                if (!check_buffer_size(f, (f->bit_cursor + nbits + 7) / 8))
+                    return 1;
+                std::uint64_t num = f->bits == bit_order::MSB
+                                        ? peek_bits<bit_order::MSB>(f, nbits)
+                                        : peek_bits<bit_order::LSB>(f, nbits);
+                if (style == radix::BIN) {
+                    std::cout
+                        << std::bitset<64>(num).to_string().substr(64 - nbits)
+                        << '\n';
+                    output::value("value", num);
+                } else {
+                    print_value(num, style);
+                }
+                return 0;
             }
-            default:
-                std::cout << "Unknown type.\n";
-                return 1;
+
+            if (f->endian == byte_order::BIG) {
+                return print_number<byte_order::BIG>(f, type, style);
             }
-            return 0;
+            return print_number<byte_order::LITTLE>(f, type, style);
         }
 
         void help_str([[maybe_unused]] std::string cmd) {
-            std::cout << R"(usage: string [LEN [BUF]]
+            std::cout << R"(usage: string [--utf8|--utf16le|--utf16be] [LEN [BUF]]
 Print LEN bytes beginning from cursor as ASCII string.
 If LEN is not specified, prints following printable ASCII
 characters.
+With --utf8, --utf16le or --utf16be, decode bytes in the encoding.
+Bytes of invalid or unprintable characters are printed escaped.
 )";
         }
 
+        void print_encoded(text_encoding enc, std::uint8_t const *p,
+                           std::size_t len) {
+            std::string out;
+            std::size_t i = 0;
+            while (i < len) {
+                std::size_t n = printable_run(enc, p + i, len - i);
+                transcode_to_utf8(enc, p + i, n, out);
+                i += n;
+                if (i >= len) break;
+
+                char32_t cp;
+                std::size_t bad = decode_char(enc, p + i, len - i, cp);
+                if (bad == 0) bad = std::min(unit_size(enc), len - i);
+                std::cout << out;
+                out.clear();
+                for (std::size_t j = 0; j < bad; ++j) {
+                    print_char(p[i + j]);
+                }
+                i += bad;
+            }
+            std::cout << out << '\n';
+        }
+
         int str(std::vector<std::string> const &args) {
+            std::size_t enc;
             std::size_t len;
             file *f;
             try {
                 option_matcher opt(args);
+                enc = opt.try_select_string(
+                    {"--ascii", "--utf8", "--utf16le", "--utf16be"}, 0);
                 len = opt.get_size(0);
                 f = opt.get_file_or_default();
                 opt.must_not_remain();
@@ -276,6 +378,19 @@ characters.
                 return 1;
             }
 
+            if (enc != 0) {
+                text_encoding encoding = static_cast<text_encoding>(enc);
+                std::uint8_t const *p = f->data.data() + f->cursor;
+                std::size_t rest = f->data.size() - f->cursor;
+                if (len != 0) {
+                    print_encoded(encoding, p, std::min(len, rest));
+                } else {
+                    std::size_t n = printable_run(encoding, p, rest);
+                    if (n) print_encoded(encoding, p, n);
+                }
+                return 0;
+            }
+
             if (len != 0) {
                 for (std::size_t point = f->cursor;
                      point < f->data.size() && point < f->cursor + len; ++point)
@@ -391,6 +506,8 @@ Dump bytes around cursor like xxd(1).
     void printer_init() {
         command_register("print", &print, &help_print);
         command_register("endian", &endian, &help_endian);
+        command_register("bitorder", &bitorder, &help_bitorder);
+        command_register("radix", &radix_command, &help_radix);
         command_register("string", &str, &help_str);
         command_register("xd", &xd, &help_xd);
     }
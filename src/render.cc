@@ -0,0 +1,361 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "command.hh"
+#include "file.hh"
+#include "option.hh"
+#include "output.hh"
+#include "parallel.hh"
+
+namespace ben {
+    namespace {
+        /* Images have at most this many pixels; larger buffers are
+           rendered with several bytes per pixel. */
+        constexpr std::size_t max_pixels = 1024 * 1024;
+        constexpr std::size_t linear_width = 256;
+        /* Entropy is computed over at least this many bytes. */
+        constexpr std::size_t entropy_window = 256;
+
+        struct rgb {
+            std::uint8_t r, g, b;
+        };
+
+        constexpr rgb background = {0x80, 0x80, 0x80};
+
+        struct image {
+            std::size_t width;
+            std::size_t height;
+            std::vector<std::uint8_t> pixels;
+
+            void set(std::size_t x, std::size_t y, rgb c) {
+                std::uint8_t *p = &pixels[(y * width + x) * 3];
+                p[0] = c.r;
+                p[1] = c.g;
+                p[2] = c.b;
+            }
+        };
+
+        /* Maps distance D along Hilbert curve filling SIDE x SIDE square
+           to coordinates. */
+        void hilbert_point(std::size_t side, std::size_t d, std::size_t &x,
+                           std::size_t &y) {
+            x = y = 0;
+            for (std::size_t s = 1; s < side; s *= 2) {
+                std::size_t rx = 1 & (d / 2);
+                std::size_t ry = 1 & (d ^ rx);
+                if (ry == 0) {
+                    if (rx == 1) {
+                        x = s - 1 - x;
+                        y = s - 1 - y;
+                    }
+                    std::swap(x, y);
+                }
+                x += s * rx;
+                y += s * ry;
+                d /= 4;
+            }
+        }
+
+        /* Colours bytes by class: zero, 0xff, printable ASCII, other
+           ASCII and the rest. */
+        enum byte_class { ZERO, FF, PRINTABLE, LOW, HIGH, NCLASS };
+
+        constexpr rgb class_colors[NCLASS] = {
+            {0x00, 0x00, 0x00}, {0xff, 0xff, 0xff}, {0x37, 0x7e, 0xb8},
+            {0x4d, 0xaf, 0x4a}, {0xe4, 0x1a, 0x1c}};
+
+        std::array<std::uint8_t, 256> make_class_table() {
+            std::array<std::uint8_t, 256> t;
+            for (int b = 0; b < 256; ++b) {
+                t[b] = b == 0      ? ZERO
+                       : b == 0xff ? FF
+                       : b >= 0x20 && b < 0x7f ? PRINTABLE
+                       : b < 0x80  ? LOW
+                                   : HIGH;
+            }
+            return t;
+        }
+
+        rgb class_color(std::uint8_t const *p, std::size_t len) {
+            static std::array<std::uint8_t, 256> const table =
+                make_class_table();
+            std::size_t count[NCLASS] = {};
+            for (std::size_t i = 0; i < len; ++i) ++count[table[p[i]]];
+
+            double r = 0, g = 0, b = 0;
+            for (int c = 0; c < NCLASS; ++c) {
+                r += class_colors[c].r * count[c];
+                g += class_colors[c].g * count[c];
+                b += class_colors[c].b * count[c];
+            }
+            return {static_cast<std::uint8_t>(r / len + 0.5),
+                    static_cast<std::uint8_t>(g / len + 0.5),
+                    static_cast<std::uint8_t>(b / len + 0.5)};
+        }
+
+        /* Shannon entropy of a window sliding forward over the buffer,
+           updated per byte entering or leaving it. */
+        class sliding_entropy {
+            std::uint8_t const *data;
+            std::size_t count[256] = {};
+            std::size_t begin = 0;
+            std::size_t end = 0;
+            /* Sum of c * log2(c) over all counts. */
+            double clogc = 0;
+
+            static double f(std::size_t c) {
+                static std::array<double, entropy_window + 1> const table =
+                    [] {
+                        std::array<double, entropy_window + 1> t;
+                        for (std::size_t i = 0; i < t.size(); ++i) {
+                            t[i] = i ? i * std::log2(static_cast<double>(i))
+                                     : 0;
+                        }
+                        return t;
+                    }();
+                return c < table.size()
+                           ? table[c]
+                           : c * std::log2(static_cast<double>(c));
+            }
+
+            void add(std::uint8_t b, int delta) {
+                clogc -= f(count[b]);
+                count[b] += delta;
+                clogc += f(count[b]);
+            }
+
+        public:
+            explicit sliding_entropy(std::uint8_t const *data) : data(data) {}
+
+            /* Moves window to [BEGIN, BEGIN + LEN); BEGIN must not
+               decrease. Returns entropy normalized to [0, 1]. */
+            double move(std::size_t new_begin, std::size_t len) {
+                std::size_t new_end = new_begin + len;
+                if (new_begin >= end) {
+                    std::fill(std::begin(count), std::end(count), 0);
+                    for (std::size_t i = new_begin; i < new_end; ++i) {
+                        ++count[data[i]];
+                    }
+                    clogc = 0;
+                    for (std::size_t c : count) clogc += f(c);
+                    begin = new_begin;
+                    end = new_end;
+                }
+                for (; begin < new_begin; ++begin) add(data[begin], -1);
+                for (; end < new_end; ++end) add(data[end], 1);
+
+                double n = static_cast<double>(len);
+                double e = std::log2(n) - clogc / n;
+                e /= std::log2(std::min<double>(n, 256));
+                return e >= 0 ? std::min(e, 1.0) : 0;
+            }
+        };
+
+        /* Colours entropy from black through blue to pink. */
+        rgb entropy_color(double e) {
+            double red = 0;
+            if (e > 0.5) {
+                double v = e - 0.5;
+                red = std::pow(4 * v - 4 * v * v, 4);
+            }
+            return {static_cast<std::uint8_t>(255 * red), 0,
+                    static_cast<std::uint8_t>(255 * e * e)};
+        }
+
+        image render_buffer(buffer_data const &data, bool hilbert,
+                            bool entropy) {
+            std::size_t size = data.size();
+            std::size_t npix = std::min(size, max_pixels);
+            std::size_t per_pixel = (size + npix - 1) / npix;
+            npix = (size + per_pixel - 1) / per_pixel;
+
+            image img;
+            if (hilbert) {
+                std::size_t side = 1;
+                while (side * side < npix) side *= 2;
+                img.width = img.height = side;
+            } else {
+                img.width = std::min(npix, linear_width);
+                img.height = (npix + img.width - 1) / img.width;
+            }
+            img.pixels.resize(img.width * img.height * 3);
+
+            auto place = [&](std::size_t d, rgb c) {
+                std::size_t x = d % img.width, y = d / img.width;
+                if (hilbert) hilbert_point(img.width, d, x, y);
+                img.set(x, y, c);
+            };
+            for (std::size_t d = npix; d < img.width * img.height; ++d) {
+                place(d, background);
+            }
+
+            parallel_for(npix, 4096, [&](std::size_t begin, std::size_t end) {
+                sliding_entropy window(data.data());
+                std::size_t win = std::min(std::max(per_pixel, entropy_window),
+                                           size);
+                for (std::size_t d = begin; d < end; ++d) {
+                    std::size_t off = d * per_pixel;
+                    rgb c;
+                    if (entropy) {
+                        c = entropy_color(
+                            window.move(std::min(off, size - win), win));
+                    } else {
+                        c = class_color(data.data() + off,
+                                        std::min(per_pixel, size - off));
+                    }
+                    place(d, c);
+                }
+            });
+            return img;
+        }
+
+        void put_be32(std::string &s, std::uint32_t v) {
+            for (int i = 3; i >= 0; --i) s.push_back(v >> (i * 8));
+        }
+
+        void put_chunk(std::string &s, char const *type,
+                       std::string const &body) {
+            put_be32(s, body.size());
+            std::string data = std::string(type, 4) + body;
+            s += data;
+            put_be32(s, crc32(0, reinterpret_cast<Bytef const *>(data.data()),
+                              data.size()));
+        }
+
+        std::string encode_png(image const &img) {
+            std::size_t stride = img.width * 3;
+            std::vector<std::uint8_t> raw;
+            raw.reserve((stride + 1) * img.height);
+            for (std::size_t y = 0; y < img.height; ++y) {
+                raw.push_back(0);
+                raw.insert(raw.end(), img.pixels.begin() + y * stride,
+                           img.pixels.begin() + (y + 1) * stride);
+            }
+
+            uLongf zlen = compressBound(raw.size());
+            std::string z(zlen, '\0');
+            if (compress2(reinterpret_cast<Bytef *>(&z[0]), &zlen, raw.data(),
+                          raw.size(), Z_DEFAULT_COMPRESSION) != Z_OK) {
+                throw std::runtime_error("zlib error: compression failed.");
+            }
+            z.resize(zlen);
+
+            std::string png("\x89PNG\r\n\x1a\n", 8);
+            std::string ihdr;
+            put_be32(ihdr, img.width);
+            put_be32(ihdr, img.height);
+            ihdr += std::string("\x08\x02\x00\x00\x00", 5);
+            put_chunk(png, "IHDR", ihdr);
+            put_chunk(png, "IDAT", z);
+            put_chunk(png, "IEND", "");
+            return png;
+        }
+
+        std::string encode_ppm(image const &img) {
+            std::string ppm = "P6\n" + std::to_string(img.width) + ' ' +
+                              std::to_string(img.height) + "\n255\n";
+            ppm.append(img.pixels.begin(), img.pixels.end());
+            return ppm;
+        }
+
+        bool has_suffix(std::string const &s, std::string const &suffix) {
+            return s.size() >= suffix.size() &&
+                   s.compare(s.size() - suffix.size(), suffix.size(),
+                             suffix) == 0;
+        }
+
+        void help_render([[maybe_unused]] std::string cmd) {
+            std::cout << R"(usage: render FILE [--hilbert] [--entropy] [BUF]
+Render the buffer as an image and write it to FILE.
+Image is written as PPM if FILE ends with .ppm, and PNG otherwise.
+Each pixel covers one or more bytes so that the image has at most
+1048576 pixels. Pixels are laid out row by row, 256 per row, or
+along a Hilbert curve with --hilbert, which keeps neighbouring bytes
+close in the image.
+Pixels are coloured by byte class: black for 0x00, white for 0xff,
+blue for printable ASCII, green for other ASCII and red for the rest.
+With --entropy, they are coloured by Shannon entropy of the bytes,
+over at least 256 bytes, from black through blue to pink.
+)";
+        }
+
+        int render(std::vector<std::string> const &args) {
+            std::string filename;
+            bool hilbert = false;
+            bool entropy = false;
+            file *f;
+            try {
+                option_matcher opt(args);
+                filename = opt.get_string();
+                for (;;) {
+                    std::size_t flag =
+                        opt.try_select_string({"--hilbert", "--entropy"}, 2);
+                    if (flag == 2) break;
+                    (flag == 0 ? hilbert : entropy) = true;
+                }
+                f = opt.get_file_or_default();
+                opt.must_not_remain();
+            } catch (std::runtime_error const &e) {
+                std::cout << "render: " << e.what() << '\n';
+                return 1;
+            }
+
+            if (f->data.empty()) {
+                std::cout << "render: Buffer is empty.\n";
+                return 1;
+            }
+
+            std::string out;
+            image img;
+            try {
+                img = render_buffer(f->data, hilbert, entropy);
+                out = has_suffix(filename, ".ppm") ? encode_ppm(img)
+                                                   : encode_png(img);
+            } catch (std::runtime_error const &e) {
+                std::cout << "render: " << e.what() << '\n';
+                return 1;
+            }
+
+            std::ofstream of(filename, std::ios::binary);
+            if (!of.write(out.data(), out.size())) {
+                std::cout << "render: " << filename
+                          << ": Failed to write file.\n";
+                return 1;
+            }
+            std::cout << img.width << 'x' << img.height << '\n';
+            output::value("width", img.width);
+            output::value("height", img.height);
+            return 0;
+        }
+    } // namespace
+
+    void render_init() { command_register("render", &render, &help_render); }
+} // namespace ben
@@ -0,0 +1,1237 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "command.hh"
+#include "decode.hh"
+#include "file.hh"
+#include "hex.hh"
+#include "memory.hh"
+#include "option.hh"
+#include "parallel.hh"
+
+namespace ben {
+    namespace {
+        /* Matches of a single string recorded per buffer are capped so
+           that a short pattern in a uniform region cannot exhaust
+           memory. */
+        constexpr std::size_t max_matches = 1000000;
+
+        inline std::uint8_t fold(std::uint8_t c) {
+            return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+        }
+
+        struct pattern {
+            std::vector<std::uint8_t> bytes;
+            bool nocase;
+            std::size_t string_id;
+        };
+
+        struct match {
+            std::size_t offset;
+            std::size_t length;
+
+            bool operator<(match const &other) const {
+                return offset < other.offset;
+            }
+        };
+
+        /*
+         * Aho-Corasick automaton over case-folded input, holding every
+         * string of every rule so that a buffer is scanned once however
+         * many rules are loaded. Bytes not appearing in any pattern share
+         * one input class, which keeps the dense transition table small.
+         * Case-sensitive patterns are verified on hit.
+         */
+        class automaton {
+            std::array<std::uint16_t, 256> cls = {};
+            std::size_t nclass = 1;
+            std::vector<std::uint32_t> delta;
+            std::vector<std::uint32_t> out_begin;
+            std::vector<std::uint32_t> out;
+            std::vector<pattern> pats;
+
+        public:
+            void build(std::vector<pattern> patterns) {
+                pats = std::move(patterns);
+
+                std::array<bool, 256> used = {};
+                for (pattern const &p : pats) {
+                    for (std::uint8_t b : p.bytes) used[fold(b)] = true;
+                }
+                std::array<std::uint16_t, 256> folded = {};
+                nclass = 1;
+                for (int c = 0; c < 256; ++c) {
+                    if (used[c]) folded[c] = nclass++;
+                }
+                for (int c = 0; c < 256; ++c) cls[c] = folded[fold(c)];
+
+                /* Transition to the root is never a trie edge, so 0 marks
+                   a missing child while the trie is being built. */
+                delta.assign(nclass, 0);
+                std::vector<std::vector<std::uint32_t>> own(1);
+                for (std::size_t i = 0; i < pats.size(); ++i) {
+                    std::uint32_t s = 0;
+                    for (std::uint8_t b : pats[i].bytes) {
+                        std::size_t idx = s * nclass + cls[b];
+                        if (!delta[idx]) {
+                            delta[idx] = own.size();
+                            own.emplace_back();
+                            delta.resize(own.size() * nclass);
+                        }
+                        s = delta[idx];
+                    }
+                    own[s].push_back(i);
+                }
+
+                std::vector<std::uint32_t> fail(own.size());
+                std::vector<std::uint32_t> queue;
+                for (std::size_t c = 0; c < nclass; ++c) {
+                    if (delta[c]) queue.push_back(delta[c]);
+                }
+                for (std::size_t qi = 0; qi < queue.size(); ++qi) {
+                    std::uint32_t s = queue[qi];
+                    /* Failure target is shallower, so its output list is
+                       already complete. */
+                    own[s].insert(own[s].end(), own[fail[s]].begin(),
+                                  own[fail[s]].end());
+                    for (std::size_t c = 0; c < nclass; ++c) {
+                        std::size_t idx = s * nclass + c;
+                        std::uint32_t next = delta[fail[s] * nclass + c];
+                        if (delta[idx]) {
+                            fail[delta[idx]] = next;
+                            queue.push_back(delta[idx]);
+                        } else {
+                            delta[idx] = next;
+                        }
+                    }
+                }
+
+                out_begin.clear();
+                out.clear();
+                for (auto const &o : own) {
+                    out_begin.push_back(out.size());
+                    out.insert(out.end(), o.begin(), o.end());
+                }
+                out_begin.push_back(out.size());
+            }
+
+            /* Appends matches in DATA to MATCHES, indexed by string id. */
+            void scan(std::uint8_t const *data, std::size_t len,
+                      std::vector<std::vector<match>> &matches) const {
+                if (pats.empty()) return;
+
+                std::uint32_t s = 0;
+                for (std::size_t i = 0; i < len; ++i) {
+                    s = delta[s * nclass + cls[data[i]]];
+                    if (out_begin[s] == out_begin[s + 1]) continue;
+
+                    for (std::size_t k = out_begin[s]; k < out_begin[s + 1];
+                         ++k) {
+                        pattern const &p = pats[out[k]];
+                        std::size_t n = p.bytes.size();
+                        std::size_t start = i + 1 - n;
+                        if (!p.nocase &&
+                            std::memcmp(data + start, p.bytes.data(), n)) {
+                            continue;
+                        }
+                        std::vector<match> &m = matches[p.string_id];
+                        if (m.size() < max_matches) m.push_back({start, n});
+                    }
+                }
+            }
+        };
+
+        enum class op : std::uint8_t {
+            PUSH,
+            FILESIZE,
+            MATCHED,
+            COUNT,
+            OFFSET,
+            LENGTH,
+            AT,
+            IN,
+            OF,
+            READ,
+            NEG,
+            BIT_NOT,
+            NOT,
+            ADD,
+            SUB,
+            MUL,
+            DIV,
+            MOD,
+            SHL,
+            SHR,
+            BIT_AND,
+            BIT_OR,
+            BIT_XOR,
+            EQ,
+            NE,
+            LT,
+            LE,
+            GT,
+            GE,
+            AND,
+            OR,
+        };
+
+        /* ARG is an immediate for PUSH, a string id for string operators,
+           a set index for OF and an index of read_funcs for READ. */
+        struct insn {
+            op code;
+            std::int64_t arg;
+        };
+
+        struct read_func {
+            char const *name;
+            unsigned int size;
+            bool is_signed;
+            byte_order order;
+        };
+
+        constexpr read_func read_funcs[] = {
+            {"int8", 1, true, byte_order::LITTLE},
+            {"int16", 2, true, byte_order::LITTLE},
+            {"int32", 4, true, byte_order::LITTLE},
+            {"uint8", 1, false, byte_order::LITTLE},
+            {"uint16", 2, false, byte_order::LITTLE},
+            {"uint32", 4, false, byte_order::LITTLE},
+            {"int8be", 1, true, byte_order::BIG},
+            {"int16be", 2, true, byte_order::BIG},
+            {"int32be", 4, true, byte_order::BIG},
+            {"uint8be", 1, false, byte_order::BIG},
+            {"uint16be", 2, false, byte_order::BIG},
+            {"uint32be", 4, false, byte_order::BIG},
+        };
+
+        template <byte_order Order>
+        std::int64_t read_value(read_func const &fn, std::uint8_t const *p) {
+            switch (fn.size) {
+            case 1:
+                return fn.is_signed ? decode<std::int8_t, Order>(p)
+                                    : decode<std::uint8_t, Order>(p);
+            case 2:
+                return fn.is_signed ? decode<std::int16_t, Order>(p)
+                                    : decode<std::uint16_t, Order>(p);
+            default:
+                return fn.is_signed ? decode<std::int32_t, Order>(p)
+                                    : decode<std::uint32_t, Order>(p);
+            }
+        }
+
+        struct rule {
+            std::string name;
+            std::vector<insn> code;
+            std::vector<std::vector<std::size_t>> sets;
+        };
+
+        struct rule_set {
+            std::vector<rule> rules;
+            std::size_t string_count = 0;
+            automaton ac;
+        };
+
+        /*
+         * Compiles YARA-like rule source:
+         *
+         *   rule name : tags {
+         *       meta:      key = value ...
+         *       strings:   $a = "text" [nocase] [ascii] [wide]
+         *                  $b = { 4d 5a 90 00 }
+         *       condition: $a at 0 and #b > 3 and uint32(@a + 4) < filesize
+         *   }
+         *
+         * Strings of all rules are gathered into one pattern list for the
+         * automaton, and each condition becomes stack machine code.
+         */
+        class rule_compiler {
+            enum class tok {
+                END,
+                IDENT,
+                STRING_ID,
+                COUNT_ID,
+                OFFSET_ID,
+                LENGTH_ID,
+                NUMBER,
+                TEXT,
+                PUNCT,
+            };
+
+            std::string const &src;
+            std::size_t pos = 0;
+            std::size_t line = 1;
+
+            tok kind = tok::END;
+            std::string text;
+            std::int64_t number = 0;
+            std::size_t token_line = 1;
+
+            rule_set &rs;
+            std::vector<pattern> &patterns;
+            std::vector<std::pair<std::string, std::size_t>> strings;
+            rule *cur = nullptr;
+
+            [[noreturn]] void error(std::string const &msg) const {
+                throw std::runtime_error("line " + std::to_string(token_line) +
+                                         ": " + msg);
+            }
+
+            static bool is_ident_start(char c) {
+                return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                       c == '_';
+            }
+
+            static bool is_ident_char(char c) {
+                return is_ident_start(c) || (c >= '0' && c <= '9');
+            }
+
+            void skip_space() {
+                while (pos < src.size()) {
+                    if (src[pos] == '\n') {
+                        ++line;
+                        ++pos;
+                    } else if (std::isspace(
+                                   static_cast<unsigned char>(src[pos]))) {
+                        ++pos;
+                    } else if (src.compare(pos, 2, "//") == 0) {
+                        while (pos < src.size() && src[pos] != '\n') ++pos;
+                    } else if (src.compare(pos, 2, "/*") == 0) {
+                        std::size_t end = src.find("*/", pos + 2);
+                        if (end == std::string::npos) {
+                            token_line = line;
+                            error("Unterminated comment.");
+                        }
+                        line += std::count(src.begin() + pos,
+                                           src.begin() + end, '\n');
+                        pos = end + 2;
+                    } else {
+                        break;
+                    }
+                }
+            }
+
+            std::string read_ident() {
+                std::size_t start = pos;
+                while (pos < src.size() && is_ident_char(src[pos])) ++pos;
+                return src.substr(start, pos - start);
+            }
+
+            void lex_number() {
+                std::size_t start = pos;
+                int base = 10;
+                if (src.compare(pos, 2, "0x") == 0) {
+                    base = 16;
+                    pos += 2;
+                }
+                std::uint64_t val = 0;
+                std::size_t digits = 0;
+                for (; pos < src.size(); ++pos, ++digits) {
+                    int d = hex_value(src[pos]);
+                    if (d < 0 || d >= base) break;
+                    auto limit = static_cast<std::uint64_t>(INT64_MAX - d);
+                    if (val > limit / base) {
+                        error("Number is out of range.");
+                    }
+                    val = val * base + d;
+                }
+                if (digits == 0) error("Invalid number.");
+                std::uint64_t unit = 1;
+                if (src.compare(pos, 2, "KB") == 0) {
+                    unit = 1024;
+                } else if (src.compare(pos, 2, "MB") == 0) {
+                    unit = 1024 * 1024;
+                }
+                if (unit != 1) {
+                    pos += 2;
+                    if (val > INT64_MAX / unit) {
+                        error("Number is out of range.");
+                    }
+                    val *= unit;
+                }
+                if (pos < src.size() && is_ident_char(src[pos])) {
+                    error("Invalid number: " +
+                          src.substr(start, pos + 1 - start));
+                }
+                kind = tok::NUMBER;
+                number = val;
+            }
+
+            void lex_text() {
+                ++pos;
+                text.clear();
+                for (;;) {
+                    if (pos >= src.size() || src[pos] == '\n') {
+                        error("Unterminated string.");
+                    }
+                    char c = src[pos++];
+                    if (c == '"') break;
+                    if (c != '\\') {
+                        text.push_back(c);
+                        continue;
+                    }
+                    if (pos >= src.size()) error("Unterminated string.");
+                    c = src[pos++];
+                    switch (c) {
+                    case 'n':
+                        text.push_back('\n');
+                        break;
+                    case 'r':
+                        text.push_back('\r');
+                        break;
+                    case 't':
+                        text.push_back('\t');
+                        break;
+                    case '"':
+                    case '\\':
+                        text.push_back(c);
+                        break;
+                    case 'x': {
+                        int hi = pos < src.size() ? hex_value(src[pos]) : -1;
+                        int lo = pos + 1 < src.size() ? hex_value(src[pos + 1])
+                                                      : -1;
+                        if (hi < 0 || lo < 0) error("Invalid \\x escape.");
+                        text.push_back(static_cast<char>(hi << 4 | lo));
+                        pos += 2;
+                        break;
+                    }
+                    default:
+                        error(std::string("Unknown escape \\") + c + '.');
+                    }
+                }
+                kind = tok::TEXT;
+            }
+
+            void next() {
+                skip_space();
+                token_line = line;
+                if (pos >= src.size()) {
+                    kind = tok::END;
+                    text.clear();
+                    return;
+                }
+
+                char c = src[pos];
+                if (is_ident_start(c)) {
+                    kind = tok::IDENT;
+                    text = read_ident();
+                    return;
+                }
+                if (c >= '0' && c <= '9') {
+                    lex_number();
+                    return;
+                }
+                if (c == '"') {
+                    lex_text();
+                    return;
+                }
+
+                char n = pos + 1 < src.size() ? src[pos + 1] : '\0';
+                if ((c == '$' || c == '#' || c == '@' || c == '!') &&
+                    (is_ident_start(n) || (c == '$' && n == '*'))) {
+                    ++pos;
+                    kind = c == '$'   ? tok::STRING_ID
+                           : c == '#' ? tok::COUNT_ID
+                           : c == '@' ? tok::OFFSET_ID
+                                      : tok::LENGTH_ID;
+                    text = read_ident();
+                    if (c == '$' && pos < src.size() && src[pos] == '*') {
+                        text.push_back('*');
+                        ++pos;
+                    }
+                    return;
+                }
+
+                static char const *const puncts[] = {
+                    "..", "==", "!=", "<=", ">=", "<<", ">>", "{", "}",
+                    "(",  ")",  "[",  "]",  ":",  "=",  ",",  "<", ">",
+                    "+",  "-",  "*",  "\\", "%",  "&",  "|",  "^", "~"};
+                for (char const *p : puncts) {
+                    std::size_t len = std::strlen(p);
+                    if (src.compare(pos, len, p) == 0) {
+                        kind = tok::PUNCT;
+                        text = p;
+                        pos += len;
+                        return;
+                    }
+                }
+                error(std::string("Unexpected character '") + c + "'.");
+            }
+
+            bool is_punct(char const *p) const {
+                return kind == tok::PUNCT && text == p;
+            }
+
+            bool is_keyword(char const *k) const {
+                return kind == tok::IDENT && text == k;
+            }
+
+            void expect_punct(char const *p) {
+                if (!is_punct(p)) error(std::string("Expected '") + p + "'.");
+                next();
+            }
+
+            void expect_keyword(char const *k) {
+                if (!is_keyword(k)) error(std::string("Expected ") + k + '.');
+                next();
+            }
+
+            /* Reads the body of a hex string; the opening brace is
+               already consumed by the lexer. */
+            std::vector<std::uint8_t> read_hex_string() {
+                std::vector<std::uint8_t> bytes;
+                int hi = -1;
+                for (;;) {
+                    skip_space();
+                    token_line = line;
+                    if (pos >= src.size()) error("Unterminated hex string.");
+                    char c = src[pos++];
+                    if (c == '}') break;
+                    if (c == '?' || c == '[' || c == '(') {
+                        error("Hex wildcards, jumps and alternatives are "
+                              "not supported.");
+                    }
+                    int d = hex_value(c);
+                    if (d < 0) error("Invalid hex string.");
+                    if (hi < 0) {
+                        hi = d;
+                    } else {
+                        bytes.push_back(hi << 4 | d);
+                        hi = -1;
+                    }
+                }
+                if (hi >= 0) error("Odd number of hex digits.");
+                next();
+                return bytes;
+            }
+
+            void add_pattern(std::vector<std::uint8_t> bytes, bool nocase,
+                             std::size_t id) {
+                if (nocase) {
+                    for (std::uint8_t &b : bytes) b = fold(b);
+                }
+                patterns.push_back({std::move(bytes), nocase, id});
+            }
+
+            void parse_string_def() {
+                std::string name = text;
+                if (name.back() == '*') error("Invalid string name.");
+                for (auto const &s : strings) {
+                    if (s.first == name) {
+                        error("Duplicated string $" + name + '.');
+                    }
+                }
+                next();
+                expect_punct("=");
+
+                std::size_t id = rs.string_count;
+                if (is_punct("{")) {
+                    std::vector<std::uint8_t> bytes = read_hex_string();
+                    if (bytes.empty()) error("Empty string.");
+                    add_pattern(std::move(bytes), false, id);
+                } else if (kind == tok::TEXT) {
+                    std::vector<std::uint8_t> bytes(text.begin(), text.end());
+                    if (bytes.empty()) error("Empty string.");
+                    next();
+                    bool nocase = false, ascii = false, wide = false;
+                    for (;;) {
+                        if (is_keyword("nocase")) {
+                            nocase = true;
+                        } else if (is_keyword("ascii")) {
+                            ascii = true;
+                        } else if (is_keyword("wide")) {
+                            wide = true;
+                        } else {
+                            break;
+                        }
+                        next();
+                    }
+                    if (wide) {
+                        std::vector<std::uint8_t> w;
+                        for (std::uint8_t b : bytes) {
+                            w.push_back(b);
+                            w.push_back(0);
+                        }
+                        add_pattern(std::move(w), nocase, id);
+                    }
+                    if (ascii || !wide) {
+                        add_pattern(std::move(bytes), nocase, id);
+                    }
+                } else {
+                    error("Expected string or hex string.");
+                }
+                ++rs.string_count;
+                strings.emplace_back(name, id);
+            }
+
+            std::size_t lookup_string(std::string const &name) const {
+                for (auto const &s : strings) {
+                    if (s.first == name) return s.second;
+                }
+                error("Undefined string $" + name + '.');
+            }
+
+            void emit(op code, std::int64_t arg = 0) {
+                cur->code.push_back({code, arg});
+            }
+
+            /* Parses `them' or a parenthesized list of strings, possibly
+               with trailing wildcards, and returns index of the set. */
+            std::size_t parse_set() {
+                std::vector<std::size_t> set;
+                if (is_keyword("them")) {
+                    next();
+                    for (auto const &s : strings) set.push_back(s.second);
+                } else {
+                    expect_punct("(");
+                    for (;;) {
+                        if (kind != tok::STRING_ID) error("Expected string.");
+                        if (text.back() == '*') {
+                            std::string prefix(text, 0, text.size() - 1);
+                            std::size_t found = set.size();
+                            for (auto const &s : strings) {
+                                if (s.first.compare(0, prefix.size(),
+                                                    prefix) == 0) {
+                                    set.push_back(s.second);
+                                }
+                            }
+                            if (found == set.size()) {
+                                error("No string matches $" + text + '.');
+                            }
+                        } else {
+                            set.push_back(lookup_string(text));
+                        }
+                        next();
+                        if (!is_punct(",")) break;
+                        next();
+                    }
+                    expect_punct(")");
+                }
+                if (set.empty()) error("Set of strings is empty.");
+                cur->sets.push_back(std::move(set));
+                return cur->sets.size() - 1;
+            }
+
+            /* QUANT is the minimum number of matched strings, or -1 for
+               `all' and -2 for `none'. The `of' keyword is current. */
+            void parse_of(std::int64_t quant) {
+                expect_keyword("of");
+                std::size_t set = parse_set();
+                std::int64_t size = cur->sets[set].size();
+                emit(op::PUSH, quant == -1 ? size : quant == -2 ? 1 : quant);
+                emit(op::OF, set);
+                if (quant == -2) emit(op::NOT);
+            }
+
+            void parse_primary() {
+                if (kind == tok::NUMBER) {
+                    std::int64_t n = number;
+                    next();
+                    if (is_keyword("of")) {
+                        parse_of(n);
+                    } else {
+                        emit(op::PUSH, n);
+                    }
+                } else if (kind == tok::STRING_ID) {
+                    std::size_t id = lookup_string(text);
+                    next();
+                    if (is_keyword("at")) {
+                        next();
+                        parse_bit_or();
+                        emit(op::AT, id);
+                    } else if (is_keyword("in")) {
+                        next();
+                        expect_punct("(");
+                        parse_bit_or();
+                        expect_punct("..");
+                        parse_bit_or();
+                        expect_punct(")");
+                        emit(op::IN, id);
+                    } else {
+                        emit(op::MATCHED, id);
+                    }
+                } else if (kind == tok::COUNT_ID) {
+                    emit(op::COUNT, lookup_string(text));
+                    next();
+                } else if (kind == tok::OFFSET_ID ||
+                           kind == tok::LENGTH_ID) {
+                    op code = kind == tok::OFFSET_ID ? op::OFFSET : op::LENGTH;
+                    std::size_t id = lookup_string(text);
+                    next();
+                    if (is_punct("[")) {
+                        next();
+                        parse_bit_or();
+                        expect_punct("]");
+                    } else {
+                        emit(op::PUSH, 1);
+                    }
+                    emit(code, id);
+                } else if (is_punct("(")) {
+                    next();
+                    parse_or();
+                    expect_punct(")");
+                } else if (is_keyword("filesize")) {
+                    next();
+                    emit(op::FILESIZE);
+                } else if (is_keyword("true") || is_keyword("false")) {
+                    emit(op::PUSH, text == "true");
+                    next();
+                } else if (is_keyword("any") || is_keyword("all") ||
+                           is_keyword("none")) {
+                    std::int64_t quant = text == "any"   ? 1
+                                         : text == "all" ? -1
+                                                         : -2;
+                    next();
+                    parse_of(quant);
+                } else if (kind == tok::IDENT) {
+                    auto fn = std::find_if(
+                        std::begin(read_funcs), std::end(read_funcs),
+                        [&](read_func const &f) { return text == f.name; });
+                    if (fn == std::end(read_funcs)) {
+                        error("Unknown identifier " + text + '.');
+                    }
+                    next();
+                    expect_punct("(");
+                    parse_bit_or();
+                    expect_punct(")");
+                    emit(op::READ, fn - std::begin(read_funcs));
+                } else {
+                    error("Expected expression.");
+                }
+            }
+
+            void parse_unary() {
+                if (is_punct("-") || is_punct("~")) {
+                    op code = text == "-" ? op::NEG : op::BIT_NOT;
+                    next();
+                    parse_unary();
+                    emit(code);
+                } else {
+                    parse_primary();
+                }
+            }
+
+            struct binary_op {
+                char const *token;
+                op code;
+            };
+
+            /* Parses left-associative binary operators OPS whose operands
+               are parsed by OPERAND. */
+            template <std::size_t N>
+            void parse_binary(binary_op const (&ops)[N],
+                              void (rule_compiler::*operand)()) {
+                (this->*operand)();
+                for (;;) {
+                    binary_op const *found = nullptr;
+                    for (binary_op const &o : ops) {
+                        if (is_punct(o.token)) found = &o;
+                    }
+                    if (!found) return;
+                    next();
+                    (this->*operand)();
+                    emit(found->code);
+                }
+            }
+
+            void parse_mul() {
+                static binary_op const ops[] = {
+                    {"*", op::MUL}, {"\\", op::DIV}, {"%", op::MOD}};
+                parse_binary(ops, &rule_compiler::parse_unary);
+            }
+
+            void parse_add() {
+                static binary_op const ops[] = {{"+", op::ADD},
+                                                {"-", op::SUB}};
+                parse_binary(ops, &rule_compiler::parse_mul);
+            }
+
+            void parse_shift() {
+                static binary_op const ops[] = {{"<<", op::SHL},
+                                                {">>", op::SHR}};
+                parse_binary(ops, &rule_compiler::parse_add);
+            }
+
+            void parse_bit_and() {
+                static binary_op const ops[] = {{"&", op::BIT_AND}};
+                parse_binary(ops, &rule_compiler::parse_shift);
+            }
+
+            void parse_bit_xor() {
+                static binary_op const ops[] = {{"^", op::BIT_XOR}};
+                parse_binary(ops, &rule_compiler::parse_bit_and);
+            }
+
+            void parse_bit_or() {
+                static binary_op const ops[] = {{"|", op::BIT_OR}};
+                parse_binary(ops, &rule_compiler::parse_bit_xor);
+            }
+
+            void parse_relation() {
+                static binary_op const ops[] = {
+                    {"==", op::EQ}, {"!=", op::NE}, {"<", op::LT},
+                    {"<=", op::LE}, {">", op::GT},  {">=", op::GE}};
+                parse_bit_or();
+                for (binary_op const &o : ops) {
+                    if (is_punct(o.token)) {
+                        next();
+                        parse_bit_or();
+                        emit(o.code);
+                        return;
+                    }
+                }
+            }
+
+            void parse_not() {
+                if (is_keyword("not")) {
+                    next();
+                    parse_not();
+                    emit(op::NOT);
+                } else {
+                    parse_relation();
+                }
+            }
+
+            void parse_and() {
+                parse_not();
+                while (is_keyword("and")) {
+                    next();
+                    parse_not();
+                    emit(op::AND);
+                }
+            }
+
+            void parse_or() {
+                parse_and();
+                while (is_keyword("or")) {
+                    next();
+                    parse_and();
+                    emit(op::OR);
+                }
+            }
+
+            void parse_meta() {
+                while (kind == tok::IDENT && !is_keyword("strings") &&
+                       !is_keyword("condition")) {
+                    next();
+                    expect_punct("=");
+                    if (is_punct("-")) next();
+                    if (kind != tok::TEXT && kind != tok::NUMBER &&
+                        !is_keyword("true") && !is_keyword("false")) {
+                        error("Invalid meta value.");
+                    }
+                    next();
+                }
+            }
+
+            void parse_rule() {
+                expect_keyword("rule");
+                if (kind != tok::IDENT) error("Expected rule name.");
+                for (rule const &r : rs.rules) {
+                    if (r.name == text) {
+                        error("Duplicated rule " + text + '.');
+                    }
+                }
+                rs.rules.emplace_back();
+                cur = &rs.rules.back();
+                cur->name = text;
+                strings.clear();
+                next();
+
+                if (is_punct(":")) {
+                    next();
+                    while (kind == tok::IDENT) next();
+                }
+                expect_punct("{");
+                if (is_keyword("meta")) {
+                    next();
+                    expect_punct(":");
+                    parse_meta();
+                }
+                if (is_keyword("strings")) {
+                    next();
+                    expect_punct(":");
+                    if (kind != tok::STRING_ID) error("Expected string.");
+                    while (kind == tok::STRING_ID) parse_string_def();
+                }
+                expect_keyword("condition");
+                expect_punct(":");
+                parse_or();
+                expect_punct("}");
+            }
+
+        public:
+            rule_compiler(std::string const &src, rule_set &rs,
+                          std::vector<pattern> &patterns)
+                : src(src), rs(rs), patterns(patterns) {}
+
+            void compile() {
+                next();
+                while (kind != tok::END) parse_rule();
+            }
+        };
+
+        rule_set compile_rules(std::string const &src) {
+            rule_set rs;
+            std::vector<pattern> patterns;
+            rule_compiler(src, rs, patterns).compile();
+            rs.ac.build(std::move(patterns));
+            return rs;
+        }
+
+        struct value {
+            std::int64_t v;
+            bool defined;
+        };
+
+        constexpr value undefined = {0, false};
+
+        value arith(op code, std::int64_t a, std::int64_t b) {
+            /* Wrap around on overflow as unsigned arithmetic does. */
+            std::uint64_t ua = a, ub = b;
+            switch (code) {
+            case op::ADD:
+                return {static_cast<std::int64_t>(ua + ub), true};
+            case op::SUB:
+                return {static_cast<std::int64_t>(ua - ub), true};
+            case op::MUL:
+                return {static_cast<std::int64_t>(ua * ub), true};
+            case op::DIV:
+            case op::MOD:
+                if (b == 0 || (a == INT64_MIN && b == -1)) return undefined;
+                return {code == op::DIV ? a / b : a % b, true};
+            case op::SHL:
+            case op::SHR:
+                if (b < 0) return undefined;
+                if (b >= 64) return {0, true};
+                return {code == op::SHL ? static_cast<std::int64_t>(ua << b)
+                                        : a >> b,
+                        true};
+            case op::BIT_AND:
+                return {a & b, true};
+            case op::BIT_OR:
+                return {a | b, true};
+            case op::BIT_XOR:
+                return {a ^ b, true};
+            case op::EQ:
+                return {a == b, true};
+            case op::NE:
+                return {a != b, true};
+            case op::LT:
+                return {a < b, true};
+            case op::LE:
+                return {a <= b, true};
+            case op::GT:
+                return {a > b, true};
+            default:
+                return {a >= b, true};
+            }
+        }
+
+        /*
+         * Runs the condition of R. Following YARA, reads beyond the buffer
+         * and out-of-range match indices yield an undefined value, which
+         * propagates through arithmetic and is false in the end.
+         */
+        bool evaluate(rule const &r, file const *f,
+                      std::vector<std::vector<match>> const &matches) {
+            std::uint8_t const *data = f->data.data();
+            std::int64_t size = f->data.size();
+            std::vector<value> st;
+            st.reserve(16);
+
+            auto pop = [&st]() {
+                value v = st.back();
+                st.pop_back();
+                return v;
+            };
+
+            for (insn const &in : r.code) {
+                switch (in.code) {
+                case op::PUSH:
+                    st.push_back({in.arg, true});
+                    break;
+
+                case op::FILESIZE:
+                    st.push_back({size, true});
+                    break;
+
+                case op::MATCHED:
+                    st.push_back({!matches[in.arg].empty(), true});
+                    break;
+
+                case op::COUNT:
+                    st.push_back(
+                        {static_cast<std::int64_t>(matches[in.arg].size()),
+                         true});
+                    break;
+
+                case op::OFFSET:
+                case op::LENGTH: {
+                    value i = pop();
+                    auto const &m = matches[in.arg];
+                    if (!i.defined || i.v < 1 ||
+                        static_cast<std::uint64_t>(i.v) > m.size()) {
+                        st.push_back(undefined);
+                    } else {
+                        match const &hit = m[i.v - 1];
+                        st.push_back({static_cast<std::int64_t>(
+                                          in.code == op::OFFSET ? hit.offset
+                                                                : hit.length),
+                                      true});
+                    }
+                    break;
+                }
+
+                case op::AT:
+                case op::IN: {
+                    value hi = pop();
+                    value lo = in.code == op::IN ? pop() : hi;
+                    if (!lo.defined || !hi.defined) {
+                        st.push_back(undefined);
+                        break;
+                    }
+                    auto const &m = matches[in.arg];
+                    std::size_t from = std::max<std::int64_t>(lo.v, 0);
+                    auto itr = std::lower_bound(m.begin(), m.end(),
+                                                match{from, 0});
+                    st.push_back({itr != m.end() && hi.v >= 0 &&
+                                      itr->offset <=
+                                          static_cast<std::uint64_t>(hi.v),
+                                  true});
+                    break;
+                }
+
+                case op::OF: {
+                    value quant = pop();
+                    std::int64_t n = 0;
+                    for (std::size_t id : r.sets[in.arg]) {
+                        if (!matches[id].empty()) ++n;
+                    }
+                    st.push_back(quant.defined ? value{n >= quant.v, true}
+                                               : undefined);
+                    break;
+                }
+
+                case op::READ: {
+                    value off = pop();
+                    read_func const &fn = read_funcs[in.arg];
+                    if (!off.defined || off.v < 0 || off.v > size ||
+                        size - off.v < static_cast<std::int64_t>(fn.size)) {
+                        st.push_back(undefined);
+                    } else if (fn.order == byte_order::LITTLE) {
+                        st.push_back(
+                            {read_value<byte_order::LITTLE>(fn, data + off.v),
+                             true});
+                    } else {
+                        st.push_back(
+                            {read_value<byte_order::BIG>(fn, data + off.v),
+                             true});
+                    }
+                    break;
+                }
+
+                case op::NEG:
+                case op::BIT_NOT:
+                case op::NOT: {
+                    value a = pop();
+                    if (a.defined) {
+                        a.v = in.code == op::NEG
+                                  ? static_cast<std::int64_t>(
+                                        -static_cast<std::uint64_t>(a.v))
+                              : in.code == op::BIT_NOT ? ~a.v
+                                                       : !a.v;
+                    }
+                    st.push_back(a);
+                    break;
+                }
+
+                case op::AND:
+                case op::OR: {
+                    value b = pop();
+                    value a = pop();
+                    /* A defined operand decides the result by itself when
+                       it is the absorbing element. */
+                    bool absorb = in.code == op::OR;
+                    if ((a.defined && !!a.v == absorb) ||
+                        (b.defined && !!b.v == absorb)) {
+                        st.push_back({absorb, true});
+                    } else if (!a.defined || !b.defined) {
+                        st.push_back(undefined);
+                    } else {
+                        st.push_back({!absorb, true});
+                    }
+                    break;
+                }
+
+                default: {
+                    value b = pop();
+                    value a = pop();
+                    st.push_back(a.defined && b.defined
+                                     ? arith(in.code, a.v, b.v)
+                                     : undefined);
+                    break;
+                }
+                }
+            }
+            return st.back().defined && st.back().v;
+        }
+
+        /* Scans F once for strings of every rule and returns indices of
+           rules whose condition holds. */
+        std::vector<std::size_t> match_rules(rule_set const &rs,
+                                             file const *f) {
+            std::vector<std::vector<match>> matches(rs.string_count);
+            rs.ac.scan(f->data.data(), f->data.size(), matches);
+            /* Strings with both ascii and wide forms are recorded out of
+               order. */
+            for (auto &m : matches) {
+                if (!std::is_sorted(m.begin(), m.end())) {
+                    std::sort(m.begin(), m.end());
+                }
+            }
+
+            std::vector<std::size_t> result;
+            for (std::size_t i = 0; i < rs.rules.size(); ++i) {
+                if (evaluate(rs.rules[i], f, matches)) result.push_back(i);
+            }
+            return result;
+        }
+
+        rule_set loaded;
+
+        void help_rules([[maybe_unused]] std::string cmd) {
+            std::cout << R"(usage: rules load FILE
+       rules scan [BUF]
+       rules scan --all
+       rules
+Match YARA-like rules against buffers.
+  load  compile rules in FILE, replacing the loaded ones.
+  scan  print names of rules matching the buffer. With --all, every
+        buffer is scanned in parallel and matching rules are printed
+        for each buffer.
+Without arguments, list the loaded rules.
+
+Rules are written as;
+  rule NAME {
+      strings:
+          $a = "text" [nocase] [ascii] [wide]
+          $b = { 4d 5a 90 00 }
+      condition:
+          $a at 0 and #b > 3 and uint32(@a + 4) < filesize
+  }
+Conditions support `and', `or', `not', comparison, arithmetic and
+bitwise operators, `$s at X', `$s in (X..Y)', #s (count), @s[i]
+(offset), !s[i] (length), `filesize', `any|all|none|N of them' and
+`of ($a, $b*)', and reads by int8..int32, uint8..uint32 and their
+big-endian variants such as uint32be.
+)";
+        }
+
+        int rules(std::vector<std::string> const &args) {
+            enum { LOAD, SCAN, LIST };
+            int sub;
+            std::string filename;
+            bool all = false;
+            file *f = nullptr;
+            try {
+                option_matcher opt(args);
+                sub = opt.select_string({"load", "scan"}, LIST);
+                if (sub == LOAD) {
+                    filename = opt.get_string();
+                } else if (sub == SCAN) {
+                    all = opt.try_select_string({"--all"}, 1) == 0;
+                    if (!all) f = opt.get_file_or_default();
+                }
+                opt.must_not_remain();
+            } catch (std::runtime_error const &e) {
+                std::cout << "rules: " << e.what() << '\n';
+                return 1;
+            }
+
+            if (sub == LOAD) {
+                std::ifstream in(filename);
+                if (!in) {
+                    std::cout << "rules: " << filename
+                              << ": Failed to open file.\n";
+                    return 1;
+                }
+                std::string src{std::istreambuf_iterator<char>(in),
+                                std::istreambuf_iterator<char>()};
+                try {
+                    memory::charge_scope scope(memory::subsystem::INDEXES);
+                    loaded = compile_rules(src);
+                } catch (std::runtime_error const &e) {
+                    std::cout << "rules: " << filename << ": " << e.what()
+                              << '\n';
+                    return 1;
+                }
+                std::cout << loaded.rules.size() << " rules, "
+                          << loaded.string_count << " strings\n";
+                return 0;
+            }
+
+            if (sub == LIST) {
+                for (rule const &r : loaded.rules) {
+                    std::cout << r.name << '\n';
+                }
+                return 0;
+            }
+
+            if (!all) {
+                for (std::size_t i : match_rules(loaded, f)) {
+                    std::cout << loaded.rules[i].name << '\n';
+                }
+                return 0;
+            }
+
+            thaw_files();
+            std::vector<std::vector<std::size_t>> result(file_count());
+            parallel_for(result.size(), 1,
+                         [&](std::size_t begin, std::size_t end) {
+                             for (std::size_t i = begin; i < end; ++i) {
+                                 result[i] = match_rules(loaded, file_at(i));
+                             }
+                         });
+            for (std::size_t i = 0; i < result.size(); ++i) {
+                if (result[i].empty()) continue;
+                std::cout << '%' << i << ':';
+                for (std::size_t r : result[i]) {
+                    std::cout << ' ' << loaded.rules[r].name;
+                }
+                std::cout << '\n';
+            }
+            return 0;
+        }
+    } // namespace
+
+    void rules_init() { command_register("rules", &rules, &help_rules); }
+} // namespace ben
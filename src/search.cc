@@ -0,0 +1,532 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iomanip>
+#include <ios>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "bits.hh"
+#include "command.hh"
+#include "cpu.hh"
+#include "file.hh"
+#include "hex.hh"
+#include "option.hh"
+#include "output.hh"
+#include "parallel.hh"
+
+namespace ben {
+    namespace {
+        struct bit_pattern {
+            std::uint64_t value = 0;
+            unsigned int length = 0;
+        };
+
+        bit_pattern parse_bit_pattern(std::string const &str) {
+            unsigned int digit_bits;
+            if (str.size() > 2 && str[0] == '0' && (str[1] | 0x20) == 'b') {
+                digit_bits = 1;
+            } else if (str.size() > 2 && str[0] == '0' &&
+                       (str[1] | 0x20) == 'x') {
+                digit_bits = 4;
+            } else {
+                throw std::runtime_error("PATTERN must begin with 0b or 0x.");
+            }
+
+            bit_pattern pat;
+            for (std::size_t i = 2; i < str.size(); ++i) {
+                int digit = hex_value(str[i]);
+                if (digit < 0 || digit >> digit_bits) {
+                    throw std::runtime_error("Invalid digit in PATTERN.");
+                }
+                if (pat.length + digit_bits > 64) {
+                    throw std::runtime_error("PATTERN exceeds 64 bits.");
+                }
+                pat.value = pat.value << digit_bits | digit;
+                pat.length += digit_bits;
+            }
+            return pat;
+        }
+
+        /* Bytes following byte I at which a pattern may start: for
+           some shift S, byte I + 1 equals F1[S] and, with two filters,
+           byte I + 2 equals F2[S]. */
+        struct byte_filter {
+            std::uint8_t const *data;
+            std::size_t size;
+            unsigned int nfilter;
+            std::uint8_t f1[8];
+            std::uint8_t f2[8];
+        };
+
+        /* Appends to OUT candidates I in [BEGIN, END) passing filter F,
+           and returns offset where it stopped; remaining bytes are left
+           to the caller. */
+        using filter_fn = std::size_t (*)(byte_filter const &f,
+                                          std::size_t begin, std::size_t end,
+                                          std::vector<std::size_t> &out);
+
+        std::size_t filter_generic(byte_filter const &, std::size_t begin,
+                                   std::size_t, std::vector<std::size_t> &) {
+            return begin;
+        }
+
+#ifdef __SSE2__
+        std::size_t filter_sse2(byte_filter const &f, std::size_t begin,
+                                std::size_t end,
+                                std::vector<std::size_t> &out) {
+            __m128i f1[8], f2[8];
+            for (unsigned int s = 0; s < 8; ++s) {
+                f1[s] = _mm_set1_epi8(f.f1[s]);
+                f2[s] = _mm_set1_epi8(f.f2[s]);
+            }
+            std::size_t i = begin;
+            for (; i + 16 <= end && f.size - i >= 18; i += 16) {
+                __m128i v1 = _mm_loadu_si128(
+                    reinterpret_cast<__m128i const *>(f.data + i + 1));
+                __m128i v2 = _mm_loadu_si128(
+                    reinterpret_cast<__m128i const *>(f.data + i + 2));
+                __m128i acc = _mm_setzero_si128();
+                for (unsigned int s = 0; s < 8; ++s) {
+                    __m128i eq = _mm_cmpeq_epi8(v1, f1[s]);
+                    if (f.nfilter == 2) {
+                        eq = _mm_and_si128(eq, _mm_cmpeq_epi8(v2, f2[s]));
+                    }
+                    acc = _mm_or_si128(acc, eq);
+                }
+                unsigned int hits = _mm_movemask_epi8(acc);
+                while (hits) {
+                    out.push_back(i + __builtin_ctz(hits));
+                    hits &= hits - 1;
+                }
+            }
+            return i;
+        }
+#endif
+
+#ifdef HAVE_X86_DISPATCH
+        __attribute__((target("avx2"))) std::size_t
+        filter_avx2(byte_filter const &f, std::size_t begin, std::size_t end,
+                    std::vector<std::size_t> &out) {
+            __m256i f1[8], f2[8];
+            for (unsigned int s = 0; s < 8; ++s) {
+                f1[s] = _mm256_set1_epi8(f.f1[s]);
+                f2[s] = _mm256_set1_epi8(f.f2[s]);
+            }
+            std::size_t i = begin;
+            for (; i + 32 <= end && f.size - i >= 34; i += 32) {
+                __m256i v1 = _mm256_loadu_si256(
+                    reinterpret_cast<__m256i const *>(f.data + i + 1));
+                __m256i v2 = _mm256_loadu_si256(
+                    reinterpret_cast<__m256i const *>(f.data + i + 2));
+                __m256i acc = _mm256_setzero_si256();
+                for (unsigned int s = 0; s < 8; ++s) {
+                    __m256i eq = _mm256_cmpeq_epi8(v1, f1[s]);
+                    if (f.nfilter == 2) {
+                        eq = _mm256_and_si256(eq,
+                                              _mm256_cmpeq_epi8(v2, f2[s]));
+                    }
+                    acc = _mm256_or_si256(acc, eq);
+                }
+                unsigned int hits = _mm256_movemask_epi8(acc);
+                while (hits) {
+                    out.push_back(i + __builtin_ctz(hits));
+                    hits &= hits - 1;
+                }
+            }
+            return i;
+        }
+
+        __attribute__((target("avx512bw"))) std::size_t
+        filter_avx512bw(byte_filter const &f, std::size_t begin,
+                        std::size_t end, std::vector<std::size_t> &out) {
+            __m512i f1[8], f2[8];
+            for (unsigned int s = 0; s < 8; ++s) {
+                f1[s] = _mm512_set1_epi8(f.f1[s]);
+                f2[s] = _mm512_set1_epi8(f.f2[s]);
+            }
+            std::size_t i = begin;
+            for (; i + 64 <= end && f.size - i >= 66; i += 64) {
+                __m512i v1 = _mm512_loadu_si512(f.data + i + 1);
+                __m512i v2 = _mm512_loadu_si512(f.data + i + 2);
+                std::uint64_t hits = 0;
+                for (unsigned int s = 0; s < 8; ++s) {
+                    std::uint64_t eq = _mm512_cmpeq_epi8_mask(v1, f1[s]);
+                    if (f.nfilter == 2) {
+                        eq &= _mm512_cmpeq_epi8_mask(v2, f2[s]);
+                    }
+                    hits |= eq;
+                }
+                while (hits) {
+                    out.push_back(i + __builtin_ctzll(hits));
+                    hits &= hits - 1;
+                }
+            }
+            return i;
+        }
+#endif
+
+        filter_fn filter_bytes = filter_generic;
+
+        char const *bind_filter() {
+#ifdef HAVE_X86_DISPATCH
+            if (cpu::has(cpu::feature::AVX512BW)) {
+                filter_bytes = filter_avx512bw;
+                return "avx512bw";
+            }
+            if (cpu::has(cpu::feature::AVX2)) {
+                filter_bytes = filter_avx2;
+                return "avx2";
+            }
+#endif
+#ifdef __SSE2__
+            filter_bytes = filter_sse2;
+            return "sse2";
+#else
+            filter_bytes = filter_generic;
+            return "generic";
+#endif
+        }
+
+        /* Searches bit pattern at all 8 bit shifts at once.
+           Byte 1 and 2 after each candidate start byte are fully covered
+           by the pattern at every shift when it is long enough, so they
+           are compared against the 8 precomputed shifted variants first
+           and only the survivors are checked bit by bit. */
+        template <bit_order Order> class bit_searcher {
+            std::uint8_t const *data;
+            std::size_t size;
+            bit_pattern pat;
+            std::size_t start_bit;
+            std::uint64_t mask;
+            byte_filter filter = {};
+
+            std::uint64_t window(std::size_t i, unsigned int s) const {
+                if (size - i >= 9) {
+                    std::uint64_t w;
+                    std::memcpy(&w, data + i, 8);
+                    if (Order == bit_order::MSB) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+                        w = __builtin_bswap64(w);
+#endif
+                        if (s) w = w << s | data[i + 8] >> (8 - s);
+                        return w >> (64 - pat.length);
+                    } else {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+                        w = __builtin_bswap64(w);
+#endif
+                        if (s) {
+                            std::uint64_t next = data[i + 8];
+                            w = w >> s | next << (64 - s);
+                        }
+                        return w & mask;
+                    }
+                }
+                bit_reader<Order> reader(data + i, size - i);
+                reader.skip(s);
+                return reader.read(pat.length);
+            }
+
+            void check(std::size_t i, std::vector<std::size_t> &out) const {
+                for (unsigned int s = 0; s < 8; ++s) {
+                    std::size_t bit = i * 8 + s;
+                    if (bit < start_bit) continue;
+                    if (bit + pat.length > size * 8) break;
+                    if (window(i, s) == pat.value) out.push_back(bit);
+                }
+            }
+
+        public:
+            bit_searcher(std::uint8_t const *data, std::size_t size,
+                         bit_pattern pat, std::size_t start_bit)
+                : data(data), size(size), pat(pat), start_bit(start_bit) {
+                mask = pat.length == 64 ? ~std::uint64_t(0)
+                                        : (std::uint64_t(1) << pat.length) - 1;
+                filter.data = data;
+                filter.size = size;
+                if (pat.length >= 24) {
+                    filter.nfilter = 2;
+                } else if (pat.length >= 16) {
+                    filter.nfilter = 1;
+                }
+                for (unsigned int s = 0; s < 8 && filter.nfilter; ++s) {
+                    if (Order == bit_order::MSB) {
+                        filter.f1[s] = pat.value >> (pat.length - 16 + s);
+                        if (filter.nfilter == 2) {
+                            filter.f2[s] = pat.value >> (pat.length - 24 + s);
+                        }
+                    } else {
+                        filter.f1[s] = pat.value >> (8 - s);
+                        if (filter.nfilter == 2) {
+                            filter.f2[s] = pat.value >> (16 - s);
+                        }
+                    }
+                }
+            }
+
+            /* Finds matches beginning in bytes [BEGIN, END). */
+            void scan(std::size_t begin, std::size_t end,
+                      std::vector<std::size_t> &out) const {
+                std::size_t i = begin;
+                if (filter.nfilter) {
+                    std::vector<std::size_t> candidates;
+                    i = filter_bytes(filter, begin, end, candidates);
+                    for (std::size_t c : candidates) check(c, out);
+                }
+                for (; i < end; ++i) {
+                    check(i, out);
+                }
+            }
+        };
+
+        template <bit_order Order>
+        std::vector<std::size_t> find_bits(file const *f, bit_pattern pat,
+                                           std::size_t start_bit) {
+            constexpr std::size_t chunk_size = 1 << 20;
+
+            bit_searcher<Order> searcher(f->data.data(), f->data.size(), pat,
+                                         start_bit);
+            std::size_t first = start_bit / 8;
+            std::size_t nbytes = f->data.size() - first;
+            std::vector<std::vector<std::size_t>> chunk_result(
+                (nbytes + chunk_size - 1) / chunk_size);
+            parallel_for(nbytes, chunk_size,
+                         [&](std::size_t begin, std::size_t end) {
+                             searcher.scan(first + begin, first + end,
+                                           chunk_result[begin / chunk_size]);
+                         });
+
+            std::vector<std::size_t> result;
+            for (std::vector<std::size_t> const &r : chunk_result) {
+                result.insert(result.end(), r.begin(), r.end());
+            }
+            return result;
+        }
+
+        /* Finds PAT in DATA at offsets [BEGIN, END). */
+        void find_bytes(std::uint8_t const *data, std::size_t size,
+                        std::string const &pat, std::size_t begin,
+                        std::size_t end, std::vector<std::size_t> &out) {
+            std::size_t limit = std::min(size, end + pat.size() - 1);
+            std::uint8_t const *p = data + begin;
+            std::uint8_t const *last = data + limit;
+            while (static_cast<std::size_t>(last - p) >= pat.size()) {
+                void const *found =
+                    ::memmem(p, last - p, pat.data(), pat.size());
+                if (!found) break;
+                p = static_cast<std::uint8_t const *>(found);
+                out.push_back(p - data);
+                ++p;
+            }
+        }
+
+        constexpr std::size_t find_chunk_size = 1 << 20;
+
+        struct find_task {
+            file const *f;
+            std::size_t buffer;
+            std::size_t begin;
+            std::size_t end;
+            std::vector<std::size_t> found;
+        };
+
+        /* Every buffer is split into chunks of similar size, so that
+           workers are balanced by bytes rather than by buffers. */
+        std::vector<find_task> find_tasks(std::vector<std::size_t> const &bufs,
+                                          std::size_t start) {
+            std::vector<find_task> tasks;
+            for (std::size_t n : bufs) {
+                file const *f = file_at(n);
+                for (std::size_t b = start; b < f->data.size();
+                     b += find_chunk_size) {
+                    tasks.push_back(
+                        {f, n, b, std::min(f->data.size(), b + find_chunk_size),
+                         {}});
+                }
+            }
+            return tasks;
+        }
+
+        void run_find_tasks(std::vector<find_task> &tasks,
+                            std::string const &pat) {
+            parallel_for(tasks.size(), 1,
+                         [&](std::size_t begin, std::size_t end) {
+                             for (std::size_t i = begin; i < end; ++i) {
+                                 find_task &t = tasks[i];
+                                 find_bytes(t.f->data.data(), t.f->data.size(),
+                                            pat, t.begin, t.end, t.found);
+                             }
+                         });
+        }
+
+        void help_find([[maybe_unused]] std::string cmd) {
+            std::cout << R"(usage: find [--hex] PATTERN [BUF]
+       find --all [--hex] PATTERN
+Search byte sequence PATTERN from cursor to the end of the buffer,
+print offsets of matches and move cursor to the first one.
+With --hex, PATTERN is given as hex digits, e.g. 7f454c46.
+With --all, every loaded buffer is searched in parallel from its
+beginning, and matches are printed grouped by buffer. Cursors are
+not moved.
+)";
+        }
+
+        int find(std::vector<std::string> const &args) {
+            bool all = false;
+            bool hex = false;
+            std::string pat;
+            file *f = nullptr;
+            try {
+                option_matcher opt(args);
+                for (;;) {
+                    std::size_t flag =
+                        opt.try_select_string({"--all", "--hex"}, 2);
+                    if (flag == 2) break;
+                    (flag == 0 ? all : hex) = true;
+                }
+                pat = opt.get_string();
+                if (hex) pat = parse_hex_bytes(pat);
+                if (pat.empty()) throw std::runtime_error("Empty PATTERN.");
+                if (!all) f = opt.get_file_or_default();
+                opt.must_not_remain();
+            } catch (std::runtime_error const &e) {
+                std::cout << "find: " << e.what() << '\n';
+                return 1;
+            }
+
+            std::vector<std::size_t> bufs;
+            std::size_t start = 0;
+            if (all) {
+                for (std::size_t i = 0; i < file_count(); ++i) {
+                    bufs.push_back(i);
+                }
+            } else {
+                std::size_t i = file_index(f);
+                if (i < file_count()) bufs.push_back(i);
+                start = f->cursor;
+            }
+
+            std::vector<find_task> tasks = find_tasks(bufs, start);
+            run_find_tasks(tasks, pat);
+
+            std::ios init(nullptr);
+            init.copyfmt(std::cout);
+            bool any = false;
+            std::size_t first = 0;
+            std::size_t current = file_count();
+            for (find_task const &t : tasks) {
+                if (t.found.empty()) continue;
+                if (all && t.buffer != current) {
+                    std::cout << '%' << std::dec << t.buffer << ": "
+                              << t.f->filename << '\n';
+                    current = t.buffer;
+                }
+                if (!any) first = t.found.front();
+                any = true;
+                for (std::size_t off : t.found) {
+                    if (all) std::cout << "  ";
+                    std::cout << std::hex << std::setw(8) << std::setfill('0')
+                              << off << '\n';
+                    if (all) output::element("buffers", t.buffer);
+                    output::element("offsets", off);
+                }
+            }
+            std::cout.copyfmt(init);
+
+            if (!any) {
+                std::cout << "Pattern not found.\n";
+                return 1;
+            }
+            if (!all) {
+                f->cursor = first;
+                f->bit_cursor = 0;
+            }
+            return 0;
+        }
+
+        void help_findbits([[maybe_unused]] std::string cmd) {
+            std::cout << R"(usage: findbits PATTERN [BUF]
+Search bit PATTERN at any bit offset, from bit cursor to the end
+of the buffer. PATTERN is written as 0b followed by binary digits
+or 0x followed by hex digits, up to 64 bits. Bits are matched in
+the order specified with `bitorder' command, so that `print bits'
+at the found position prints PATTERN.
+Matches are printed as BYTE.BIT, and cursor moves to the first one.
+)";
+        }
+
+        int findbits(std::vector<std::string> const &args) {
+            bit_pattern pat;
+            file *f;
+            try {
+                option_matcher opt(args);
+                pat = parse_bit_pattern(opt.get_string());
+                f = opt.get_file_or_default();
+                opt.must_not_remain();
+            } catch (std::runtime_error const &e) {
+                std::cout << "findbits: " << e.what() << '\n';
+                return 1;
+            }
+
+            std::size_t start_bit = f->cursor * 8 + f->bit_cursor;
+            std::vector<std::size_t> found =
+                f->bits == bit_order::MSB
+                    ? find_bits<bit_order::MSB>(f, pat, start_bit)
+                    : find_bits<bit_order::LSB>(f, pat, start_bit);
+            if (found.empty()) {
+                std::cout << "Pattern not found.\n";
+                return 1;
+            }
+
+            std::ios init(nullptr);
+            init.copyfmt(std::cout);
+            for (std::size_t bit : found) {
+                std::cout << std::hex << std::setw(8) << std::setfill('0')
+                          << (bit >> 3) << '.' << (bit & 7) << '\n';
+                output::element("offsets", bit >> 3);
+                output::element("bits", bit & 7);
+            }
+            std::cout.copyfmt(init);
+
+            f->cursor = found.front() >> 3;
+            f->bit_cursor = found.front() & 7;
+
+            return 0;
+        }
+    } // namespace
+
+    void search_init() {
+        command_register("find", &find, &help_find);
+        command_register("findbits", &findbits, &help_findbits);
+        cpu::register_kernel("findbits", &bind_filter);
+    }
+} // namespace ben
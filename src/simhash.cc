@@ -0,0 +1,532 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "command.hh"
+#include "file.hh"
+#include "option.hh"
+#include "parallel.hh"
+
+namespace ben {
+    namespace {
+        enum class sim_algo { CTPH, LSH };
+
+        /*
+         * Context triggered piecewise hash, in the manner of spamsum and
+         * ssdeep. A rolling hash over 7 bytes decides where a piece ends,
+         * and each piece contributes one base64 character of its FNV
+         * hash. The signature is made for the block size and its double.
+         */
+        namespace ctph {
+            constexpr std::uint32_t rolling_window = 7;
+            constexpr std::uint32_t min_block_size = 3;
+            constexpr std::uint32_t hash_prime = 0x01000193;
+            constexpr std::uint32_t hash_init = 0x28021967;
+            constexpr std::size_t signature_length = 64;
+
+            char const b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                               "abcdefghijklmnopqrstuvwxyz"
+                               "0123456789+/";
+
+            struct roll_state {
+                std::uint8_t window[rolling_window] = {};
+                std::uint32_t h1 = 0, h2 = 0, h3 = 0;
+                std::uint32_t n = 0;
+
+                std::uint32_t roll(std::uint8_t c) {
+                    h2 -= h1;
+                    h2 += rolling_window * c;
+                    h1 += c;
+                    h1 -= window[n % rolling_window];
+                    window[n % rolling_window] = c;
+                    ++n;
+                    h3 = (h3 << 5) ^ c;
+                    return h1 + h2 + h3;
+                }
+            };
+
+            std::string digest(std::uint8_t const *data, std::size_t size) {
+                std::uint32_t block_size = min_block_size;
+                while (static_cast<std::uint64_t>(block_size) *
+                           signature_length <
+                       size) {
+                    block_size *= 2;
+                }
+
+                for (;;) {
+                    std::string sig1, sig2;
+                    roll_state rs;
+                    std::uint32_t h = 0;
+                    std::uint32_t s1 = hash_init, s2 = hash_init;
+                    for (std::size_t i = 0; i < size; ++i) {
+                        std::uint8_t c = data[i];
+                        h = rs.roll(c);
+                        s1 = (s1 * hash_prime) ^ c;
+                        s2 = (s2 * hash_prime) ^ c;
+
+                        if (h % block_size == block_size - 1) {
+                            if (sig1.size() < signature_length - 1) {
+                                sig1.push_back(b64[s1 % 64]);
+                                s1 = hash_init;
+                            }
+                        }
+                        if (h % (block_size * 2) == block_size * 2 - 1) {
+                            if (sig2.size() < signature_length / 2 - 1) {
+                                sig2.push_back(b64[s2 % 64]);
+                                s2 = hash_init;
+                            }
+                        }
+                    }
+                    if (h != 0) {
+                        sig1.push_back(b64[s1 % 64]);
+                        sig2.push_back(b64[s2 % 64]);
+                    }
+
+                    if (block_size > min_block_size &&
+                        sig1.size() < signature_length / 2) {
+                        block_size /= 2;
+                        continue;
+                    }
+                    return std::to_string(block_size) + ':' + sig1 + ':' +
+                           sig2;
+                }
+            }
+
+            /* Sequences of more than 3 identical characters carry little
+               information, and are shortened before comparison. */
+            std::string eliminate_sequences(std::string const &s) {
+                std::string r;
+                for (std::size_t i = 0; i < s.size(); ++i) {
+                    if (i >= 3 && s[i] == s[i - 1] && s[i] == s[i - 2] &&
+                        s[i] == s[i - 3]) {
+                        continue;
+                    }
+                    r.push_back(s[i]);
+                }
+                return r;
+            }
+
+            bool has_common_substring(std::string const &a,
+                                      std::string const &b) {
+                if (a.size() < rolling_window || b.size() < rolling_window) {
+                    return false;
+                }
+                for (std::size_t i = 0; i + rolling_window <= a.size(); ++i) {
+                    if (b.find(a.substr(i, rolling_window)) !=
+                        std::string::npos) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            /* Insertion and deletion cost 1, substitution costs 2. */
+            std::size_t edit_distance(std::string const &a,
+                                      std::string const &b) {
+                std::vector<std::size_t> prev(b.size() + 1), cur(b.size() + 1);
+                for (std::size_t j = 0; j <= b.size(); ++j) prev[j] = j;
+                for (std::size_t i = 1; i <= a.size(); ++i) {
+                    cur[0] = i;
+                    for (std::size_t j = 1; j <= b.size(); ++j) {
+                        std::size_t sub =
+                            prev[j - 1] + (a[i - 1] == b[j - 1] ? 0 : 2);
+                        cur[j] = std::min({prev[j] + 1, cur[j - 1] + 1, sub});
+                    }
+                    std::swap(prev, cur);
+                }
+                return prev[b.size()];
+            }
+
+            unsigned int score_strings(std::string const &a,
+                                       std::string const &b,
+                                       std::uint32_t block_size) {
+                if (!has_common_substring(a, b)) return 0;
+
+                std::size_t score = edit_distance(a, b) * signature_length /
+                                    (a.size() + b.size());
+                score = 100 * score / signature_length;
+                if (score >= 100) return 0;
+                score = 100 - score;
+
+                /* Small block sizes cannot claim high similarity with
+                   short signatures. */
+                constexpr std::uint32_t enough =
+                    (99 + rolling_window) / rolling_window * min_block_size;
+                if (block_size < enough) {
+                    std::size_t cap = block_size / min_block_size *
+                                      std::min(a.size(), b.size());
+                    score = std::min(score, cap);
+                }
+                return score;
+            }
+
+            struct parsed {
+                std::uint32_t block_size;
+                std::string sig1;
+                std::string sig2;
+            };
+
+            parsed parse(std::string const &digest) {
+                std::size_t c1 = digest.find(':');
+                std::size_t c2 = digest.find(':', c1 + 1);
+                return {static_cast<std::uint32_t>(
+                            std::stoul(digest.substr(0, c1))),
+                        eliminate_sequences(digest.substr(c1 + 1, c2 - c1 - 1)),
+                        eliminate_sequences(digest.substr(c2 + 1))};
+            }
+
+            /* 0 (unrelated) to 100 (identical). */
+            unsigned int compare(std::string const &d1,
+                                 std::string const &d2) {
+                parsed a = parse(d1);
+                parsed b = parse(d2);
+
+                if (a.block_size == b.block_size) {
+                    if (a.sig1 == b.sig1) return 100;
+                    return std::max(
+                        score_strings(a.sig1, b.sig1, a.block_size),
+                        score_strings(a.sig2, b.sig2, a.block_size * 2));
+                } else if (a.block_size == b.block_size * 2) {
+                    return score_strings(a.sig1, b.sig2, a.block_size);
+                } else if (a.block_size * 2 == b.block_size) {
+                    return score_strings(a.sig2, b.sig1, b.block_size);
+                }
+                return 0;
+            }
+        } // namespace ctph
+
+        /*
+         * Locality sensitive hash in the manner of TLSH. Triplets taken
+         * from a sliding window of 5 bytes are counted into 128 buckets,
+         * and each bucket is encoded in 2 bits by which quartile its count
+         * falls into. The header holds a checksum, logarithm of length
+         * and ratios of quartiles.
+         */
+        namespace lsh {
+            constexpr std::size_t nbuckets = 128;
+            constexpr std::size_t min_size = 50;
+
+            std::array<std::uint8_t, 256> const pearson_table = [] {
+                std::array<std::uint8_t, 256> t{};
+                for (unsigned int i = 0; i < 256; ++i) t[i] = i;
+                std::uint32_t x = 0x9e3779b9;
+                for (unsigned int i = 255; i > 0; --i) {
+                    x ^= x << 13;
+                    x ^= x >> 17;
+                    x ^= x << 5;
+                    std::swap(t[i], t[x % (i + 1)]);
+                }
+                return t;
+            }();
+
+            inline std::uint8_t pearson(std::uint8_t salt, std::uint8_t a,
+                                        std::uint8_t b, std::uint8_t c) {
+                std::uint8_t h = pearson_table[salt];
+                h = pearson_table[h ^ a];
+                h = pearson_table[h ^ b];
+                return pearson_table[h ^ c];
+            }
+
+            struct digest_value {
+                std::uint8_t checksum;
+                std::uint8_t lvalue;
+                std::uint8_t q1ratio;
+                std::uint8_t q2ratio;
+                std::array<std::uint8_t, nbuckets> code;
+            };
+
+            std::uint8_t log_length(std::size_t size) {
+                double l = std::log(static_cast<double>(size)) / std::log(1.5);
+                return static_cast<std::uint8_t>(std::min(255.0, l));
+            }
+
+            digest_value compute(std::uint8_t const *data, std::size_t size) {
+                if (size < min_size) {
+                    throw std::runtime_error("Buffer is too small for lsh.");
+                }
+
+                std::array<std::uint32_t, nbuckets> bucket{};
+                std::uint8_t checksum = 0;
+                for (std::size_t i = 4; i < size; ++i) {
+                    std::uint8_t c0 = data[i], c1 = data[i - 1],
+                                 c2 = data[i - 2], c3 = data[i - 3],
+                                 c4 = data[i - 4];
+                    checksum = pearson(0, c0, c1, checksum);
+                    ++bucket[pearson(2, c0, c1, c2) % nbuckets];
+                    ++bucket[pearson(3, c0, c1, c3) % nbuckets];
+                    ++bucket[pearson(5, c0, c2, c3) % nbuckets];
+                    ++bucket[pearson(7, c0, c2, c4) % nbuckets];
+                    ++bucket[pearson(11, c0, c1, c4) % nbuckets];
+                    ++bucket[pearson(13, c0, c3, c4) % nbuckets];
+                }
+
+                std::array<std::uint32_t, nbuckets> sorted = bucket;
+                std::sort(sorted.begin(), sorted.end());
+                std::uint32_t q1 = sorted[nbuckets / 4 - 1];
+                std::uint32_t q2 = sorted[nbuckets / 2 - 1];
+                std::uint32_t q3 = sorted[nbuckets * 3 / 4 - 1];
+                if (q3 == 0) {
+                    throw std::runtime_error(
+                        "Buffer does not have enough variety for lsh.");
+                }
+
+                digest_value d;
+                d.checksum = checksum;
+                d.lvalue = log_length(size);
+                d.q1ratio = (q1 * 100 / q3) % 16;
+                d.q2ratio = (q2 * 100 / q3) % 16;
+                for (std::size_t i = 0; i < nbuckets; ++i) {
+                    std::uint32_t b = bucket[i];
+                    d.code[i] = b <= q1 ? 0 : b <= q2 ? 1 : b <= q3 ? 2 : 3;
+                }
+                return d;
+            }
+
+            std::string to_string(digest_value const &d) {
+                static char const hex[] = "0123456789ABCDEF";
+                std::string s;
+                auto put = [&](std::uint8_t b) {
+                    s.push_back(hex[b >> 4]);
+                    s.push_back(hex[b & 0xf]);
+                };
+                put(d.checksum);
+                put(d.lvalue);
+                put(d.q1ratio << 4 | d.q2ratio);
+                for (std::size_t i = 0; i < nbuckets; i += 4) {
+                    put(d.code[i] << 6 | d.code[i + 1] << 4 |
+                        d.code[i + 2] << 2 | d.code[i + 3]);
+                }
+                return s;
+            }
+
+            digest_value from_string(std::string const &s) {
+                auto get = [&](std::size_t pos) {
+                    return static_cast<std::uint8_t>(
+                        std::stoul(s.substr(pos * 2, 2), nullptr, 16));
+                };
+                digest_value d;
+                d.checksum = get(0);
+                d.lvalue = get(1);
+                d.q1ratio = get(2) >> 4;
+                d.q2ratio = get(2) & 0xf;
+                for (std::size_t i = 0; i < nbuckets; i += 4) {
+                    std::uint8_t b = get(3 + i / 4);
+                    d.code[i] = b >> 6;
+                    d.code[i + 1] = b >> 4 & 3;
+                    d.code[i + 2] = b >> 2 & 3;
+                    d.code[i + 3] = b & 3;
+                }
+                return d;
+            }
+
+            unsigned int mod_diff(unsigned int a, unsigned int b,
+                                  unsigned int r) {
+                unsigned int d = a > b ? a - b : b - a;
+                return std::min(d, r - d);
+            }
+
+            /* 0 for identical; larger is more different. */
+            unsigned int distance(std::string const &s1,
+                                  std::string const &s2) {
+                digest_value a = from_string(s1);
+                digest_value b = from_string(s2);
+
+                unsigned int diff = 0;
+                unsigned int ld = mod_diff(a.lvalue, b.lvalue, 256);
+                diff += ld <= 1 ? ld : ld * 12;
+                unsigned int q1d = mod_diff(a.q1ratio, b.q1ratio, 16);
+                diff += q1d <= 1 ? q1d : (q1d - 1) * 12;
+                unsigned int q2d = mod_diff(a.q2ratio, b.q2ratio, 16);
+                diff += q2d <= 1 ? q2d : (q2d - 1) * 12;
+                if (a.checksum != b.checksum) ++diff;
+                for (std::size_t i = 0; i < nbuckets; ++i) {
+                    unsigned int x = a.code[i] > b.code[i]
+                                         ? a.code[i] - b.code[i]
+                                         : b.code[i] - a.code[i];
+                    diff += x == 3 ? 6 : x;
+                }
+                return diff;
+            }
+        } // namespace lsh
+
+        std::string sim_digest(sim_algo algo, file const *f) {
+            if (algo == sim_algo::CTPH) {
+                return ctph::digest(f->data.data(), f->data.size());
+            }
+            return lsh::to_string(
+                lsh::compute(f->data.data(), f->data.size()));
+        }
+
+        unsigned int sim_compare(sim_algo algo, std::string const &d1,
+                                 std::string const &d2) {
+            if (algo == sim_algo::CTPH) return ctph::compare(d1, d2);
+            return lsh::distance(d1, d2);
+        }
+
+        /* Digests of every buffer, computed in parallel. Buffers whose
+           digest can't be computed get empty string. */
+        std::vector<std::string> digest_all(sim_algo algo) {
+            std::vector<std::string> digests(file_count());
+            thaw_files();
+            parallel_for(digests.size(), 1,
+                         [&](std::size_t begin, std::size_t end) {
+                             for (std::size_t i = begin; i < end; ++i) {
+                                 try {
+                                     digests[i] = sim_digest(algo, file_at(i));
+                                 } catch (std::runtime_error const &) {
+                                 }
+                             }
+                         });
+            return digests;
+        }
+
+        void help_simhash([[maybe_unused]] std::string cmd) {
+            std::cout << R"(usage: simhash [ctph|lsh] [BUF]
+       simhash [ctph|lsh] --all
+Compute similarity digest of the buffer.
+  ctph  context triggered piecewise hash like ssdeep (default).
+  lsh   locality sensitive hash like TLSH. Needs at least 50 bytes.
+With --all, digests of every buffer are computed in parallel.
+)";
+        }
+
+        int simhash(std::vector<std::string> const &args) {
+            sim_algo algo;
+            bool all;
+            file *f = nullptr;
+            try {
+                option_matcher opt(args);
+                algo = static_cast<sim_algo>(
+                    opt.try_select_string({"ctph", "lsh"}, 0));
+                all = opt.try_select_string({"--all"}, 1) == 0;
+                if (!all) f = opt.get_file_or_default();
+                opt.must_not_remain();
+            } catch (std::runtime_error const &e) {
+                std::cout << "simhash: " << e.what() << '\n';
+                return 1;
+            }
+
+            if (!all) {
+                try {
+                    std::cout << sim_digest(algo, f) << '\n';
+                } catch (std::runtime_error const &e) {
+                    std::cout << "simhash: " << e.what() << '\n';
+                    return 1;
+                }
+                return 0;
+            }
+
+            std::vector<std::string> digests = digest_all(algo);
+            for (std::size_t i = 0; i < digests.size(); ++i) {
+                std::cout << '%' << i << ": "
+                          << (digests[i].empty() ? "-" : digests[i]) << '\n';
+            }
+            return 0;
+        }
+
+        void help_simcmp([[maybe_unused]] std::string cmd) {
+            std::cout << R"(usage: simcmp [ctph|lsh] BUF1 BUF2
+       simcmp [ctph|lsh] --all [THRESHOLD]
+Compare similarity digests of two buffers.
+ctph gives score from 0 (unrelated) to 100 (identical); lsh gives
+distance, where 0 means identical and larger is more different.
+With --all, every pair of loaded buffers is compared, and pairs with
+ctph score at least THRESHOLD (default 1) or lsh distance at most
+THRESHOLD (default 100) are printed.
+)";
+        }
+
+        int simcmp(std::vector<std::string> const &args) {
+            sim_algo algo;
+            bool all;
+            std::size_t threshold = 0;
+            file *f1 = nullptr;
+            file *f2 = nullptr;
+            try {
+                option_matcher opt(args);
+                algo = static_cast<sim_algo>(
+                    opt.try_select_string({"ctph", "lsh"}, 0));
+                all = opt.try_select_string({"--all"}, 1) == 0;
+                if (all) {
+                    threshold = opt.get_size(algo == sim_algo::CTPH ? 1 : 100);
+                } else {
+                    f1 = opt.get_file();
+                    f2 = opt.get_file();
+                }
+                opt.must_not_remain();
+            } catch (std::runtime_error const &e) {
+                std::cout << "simcmp: " << e.what() << '\n';
+                return 1;
+            }
+
+            if (!all) {
+                try {
+                    std::cout << sim_compare(algo, sim_digest(algo, f1),
+                                             sim_digest(algo, f2))
+                              << '\n';
+                } catch (std::runtime_error const &e) {
+                    std::cout << "simcmp: " << e.what() << '\n';
+                    return 1;
+                }
+                return 0;
+            }
+
+            std::vector<std::string> digests = digest_all(algo);
+            std::size_t n = digests.size();
+            std::vector<std::vector<std::pair<std::size_t, unsigned int>>>
+                matches(n);
+            parallel_for(n, 1, [&](std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; ++i) {
+                    if (digests[i].empty()) continue;
+                    for (std::size_t j = i + 1; j < n; ++j) {
+                        if (digests[j].empty()) continue;
+                        unsigned int s =
+                            sim_compare(algo, digests[i], digests[j]);
+                        if (algo == sim_algo::CTPH ? s >= threshold
+                                                   : s <= threshold) {
+                            matches[i].emplace_back(j, s);
+                        }
+                    }
+                }
+            });
+
+            for (std::size_t i = 0; i < n; ++i) {
+                for (auto const &m : matches[i]) {
+                    std::cout << '%' << i << " %" << m.first << ": "
+                              << m.second << '\n';
+                }
+            }
+            return 0;
+        }
+    } // namespace
+
+    void simhash_init() {
+        command_register("simhash", &simhash, &help_simhash);
+        command_register("simcmp", &simcmp, &help_simcmp);
+    }
+} // namespace ben
@@ -0,0 +1,535 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <ios>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "command.hh"
+#include "file.hh"
+#include "memory.hh"
+#include "output.hh"
+#include "parallel.hh"
+#include "store.hh"
+
+namespace ben {
+    namespace {
+        constexpr std::size_t preferred_block_size = 16 * 1024;
+
+        /* Blocks are mapped one by one, so they are at least a page. */
+        std::size_t block_size() {
+            static std::size_t const size = std::max<std::size_t>(
+                preferred_block_size, ::sysconf(_SC_PAGESIZE));
+            return size;
+        }
+
+        bool dedup_enabled = false;
+
+        std::uint64_t rotl(std::uint64_t x, int r) {
+            return x << r | x >> (64 - r);
+        }
+
+        /* Hashes a whole block in four independent lanes, as in
+           XXH64. Matches are verified, so it only has to be fast and
+           spread well. */
+        std::uint64_t hash_block(std::uint8_t const *p) {
+            constexpr std::uint64_t p1 = 0x9e3779b185ebca87;
+            constexpr std::uint64_t p2 = 0xc2b2ae3d27d4eb4f;
+            std::uint64_t lane[4] = {p1 + p2, p2, 0, 0 - p1};
+            for (std::size_t i = 0; i < block_size(); i += 32) {
+                std::uint64_t w[4];
+                std::memcpy(w, p + i, sizeof(w));
+                for (int j = 0; j < 4; ++j) {
+                    lane[j] = rotl(lane[j] + w[j] * p2, 31) * p1;
+                }
+            }
+            std::uint64_t h = rotl(lane[0], 1) + rotl(lane[1], 7) +
+                              rotl(lane[2], 12) + rotl(lane[3], 18);
+            h ^= h >> 33;
+            h *= p2;
+            h ^= h >> 29;
+            return h;
+        }
+
+        /* Unique blocks live in slots of an anonymous memory file,
+           which buffers map. A slot is freed, and its memory returned,
+           when no buffer refers to it any longer. */
+        class block_store {
+            int fd;
+            std::size_t capacity = 0;
+            std::uint32_t nslots = 0;
+            std::vector<std::uint32_t> refs;
+            std::vector<std::uint64_t> hashes;
+            std::vector<std::uint32_t> free_slots;
+            std::unordered_multimap<std::uint64_t, std::uint32_t> index;
+            std::vector<std::uint8_t> scratch;
+            std::size_t nbuffers = 0;
+            std::size_t contents = 0;
+            std::mutex mutex;
+
+            off_t offset(std::uint32_t slot) const {
+                return static_cast<off_t>(slot) * block_size();
+            }
+
+            bool write_at(std::uint8_t const *p, std::size_t len, off_t off) {
+                while (len) {
+                    ssize_t n = ::pwrite(fd, p, len, off);
+                    if (n < 0) {
+                        if (errno == EINTR) continue;
+                        return false;
+                    }
+                    p += n;
+                    len -= n;
+                    off += n;
+                }
+                return true;
+            }
+
+            /* True if SLOT holds [P, P + LEN) followed by zeros. */
+            bool holds(std::uint32_t slot, std::uint8_t const *p,
+                       std::size_t len) {
+                scratch.resize(block_size());
+                if (::pread(fd, scratch.data(), scratch.size(),
+                            offset(slot)) !=
+                    static_cast<ssize_t>(scratch.size())) {
+                    return false;
+                }
+                return std::memcmp(scratch.data(), p, len) == 0 &&
+                       std::all_of(scratch.begin() + len, scratch.end(),
+                                   [](std::uint8_t b) { return b == 0; });
+            }
+
+            bool allocate(std::uint32_t &slot) {
+                if (!free_slots.empty()) {
+                    slot = free_slots.back();
+                    free_slots.pop_back();
+                    return true;
+                }
+                if (nslots == capacity) {
+                    std::size_t grown = std::max<std::size_t>(capacity * 2, 64);
+                    if (::ftruncate(fd, grown * block_size()) < 0) {
+                        return false;
+                    }
+                    capacity = grown;
+                }
+                slot = nslots++;
+                refs.resize(nslots);
+                hashes.resize(nslots);
+                return true;
+            }
+
+            void unref(std::uint32_t slot) {
+                if (--refs[slot]) return;
+                ::fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                            offset(slot), block_size());
+                auto range = index.equal_range(hashes[slot]);
+                for (auto it = range.first; it != range.second; ++it) {
+                    if (it->second == slot) {
+                        index.erase(it);
+                        break;
+                    }
+                }
+                free_slots.push_back(slot);
+            }
+
+            bool add_locked(std::uint8_t const *p, std::size_t len,
+                            std::vector<std::uint64_t> const &h,
+                            std::vector<std::uint32_t> &slots) {
+                std::size_t bs = block_size();
+                /* New blocks consecutive both in P and in the file are
+                   written together. */
+                std::size_t run_begin = 0, run_len = 0;
+                std::uint32_t run_slot = 0;
+                auto flush = [&] {
+                    if (!run_len) return true;
+                    std::size_t off = run_begin * bs;
+                    std::size_t n = std::min(run_len * bs, len - off);
+                    run_len = 0;
+                    return write_at(p + off, n, offset(run_slot));
+                };
+
+                for (std::size_t i = 0; i < h.size(); ++i) {
+                    std::uint8_t const *block = p + i * bs;
+                    std::size_t blen = std::min(bs, len - i * bs);
+                    auto range = index.equal_range(h[i]);
+                    /* Candidate may be among blocks not written yet. */
+                    if (range.first != range.second && !flush()) {
+                        return false;
+                    }
+                    auto it = std::find_if(range.first, range.second,
+                                           [&](auto const &e) {
+                                               return holds(e.second, block,
+                                                            blen);
+                                           });
+                    std::uint32_t slot;
+                    if (it != range.second) {
+                        slot = it->second;
+                        ++refs[slot];
+                    } else {
+                        if (!allocate(slot)) return false;
+                        refs[slot] = 1;
+                        hashes[slot] = h[i];
+                        index.emplace(h[i], slot);
+                        if (run_len && run_begin + run_len == i &&
+                            run_slot + run_len == slot) {
+                            ++run_len;
+                        } else {
+                            if (!flush()) {
+                                slots.push_back(slot);
+                                return false;
+                            }
+                            run_begin = i;
+                            run_slot = slot;
+                            run_len = 1;
+                        }
+                    }
+                    slots.push_back(slot);
+                }
+                return flush();
+            }
+
+        public:
+            block_store() : fd(::memfd_create("ben-blocks", MFD_CLOEXEC)) {}
+
+            bool ready() const { return fd >= 0; }
+
+            /* Stores blocks of [P, P + LEN), whose hashes are H, and
+               sets SLOTS to where they are. */
+            bool add(std::uint8_t const *p, std::size_t len,
+                     std::vector<std::uint64_t> const &h,
+                     std::vector<std::uint32_t> &slots) {
+                std::lock_guard<std::mutex> lock(mutex);
+                slots.clear();
+                if (!add_locked(p, len, h, slots)) {
+                    for (std::uint32_t s : slots) unref(s);
+                    slots.clear();
+                    return false;
+                }
+                ++nbuffers;
+                contents += len;
+                return true;
+            }
+
+            /* Adds a buffer made of SLOTS, which are in use. */
+            void retain(std::vector<std::uint32_t> const &slots,
+                        std::size_t len) {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (std::uint32_t s : slots) ++refs[s];
+                ++nbuffers;
+                contents += len;
+            }
+
+            void remove(std::vector<std::uint32_t> const &slots,
+                        std::size_t len) {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (std::uint32_t s : slots) unref(s);
+                --nbuffers;
+                contents -= len;
+            }
+
+            /* Maps SLOTS contiguously, read-only. */
+            std::uint8_t const *map(std::vector<std::uint32_t> const &slots) {
+                std::size_t bs = block_size();
+                std::size_t total = slots.size() * bs;
+                void *base = ::mmap(nullptr, total, PROT_NONE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                                    -1, 0);
+                if (base == MAP_FAILED) return nullptr;
+                auto *p = static_cast<std::uint8_t *>(base);
+                for (std::size_t i = 0; i < slots.size();) {
+                    /* Slots in sequence share one mapping. */
+                    std::size_t j = i + 1;
+                    while (j < slots.size() && slots[j] == slots[j - 1] + 1) {
+                        ++j;
+                    }
+                    if (::mmap(p + i * bs, (j - i) * bs, PROT_READ,
+                               MAP_SHARED | MAP_FIXED, fd,
+                               offset(slots[i])) == MAP_FAILED) {
+                        ::munmap(base, total);
+                        return nullptr;
+                    }
+                    i = j;
+                }
+                return p;
+            }
+
+            store::stats statistics() {
+                std::lock_guard<std::mutex> lock(mutex);
+                return {block_size(), nbuffers, contents,
+                        nslots - free_slots.size()};
+            }
+        };
+
+        /* Never destroyed, as buffers may outlive static objects. */
+        block_store &the_store() {
+            static block_store *s = new block_store;
+            return *s;
+        }
+
+        void help_mem([[maybe_unused]] std::string cmd) {
+            std::cout << R"(usage: mem
+Show how much memory ben takes. Resident is memory of the process
+present in RAM, mapped what contents of large buffers take outside the
+heap, and heap what is allocated by ben itself, charged to the
+subsystem allocating it:
+  buffers        contents of smaller buffers, and loading
+  decompression  `zlib', including working memory of zlib
+  cache          compressed cold buffers (see `mode cold-compress')
+  indexes        databases of `known' and compiled `rules'
+  variables      shell variables
+  parser         command lines being parsed
+  other          everything else
+Peak is the largest amount taken at once so far.
+After `mode dedup on', buffers of at least one block created from then
+on are stored as blocks, each distinct block once; dedup is off by
+default. For each buffer, memory mapped for contents, heap for contents,
+compressed cold contents and how much of the first two is resident are
+shown. Shared contents count for every buffer sharing them.
+)";
+        }
+
+        void show_subsystems() {
+            memory::usage proc = memory::process_usage();
+            memory::usage mapped = memory::mapped_usage();
+            memory::usage heap = memory::total_usage();
+            std::cout << "resident      " << proc.bytes << " (peak "
+                      << proc.peak << ")\n"
+                      << "mapped        " << mapped.bytes << " (peak "
+                      << mapped.peak << ")\n"
+                      << "heap          " << heap.bytes << " (peak "
+                      << heap.peak << ")\n";
+            output::value("resident", proc.bytes);
+            output::value("peak_resident", proc.peak);
+            output::value("mapped", mapped.bytes);
+            output::value("peak_mapped", mapped.peak);
+            output::value("heap", heap.bytes);
+            output::value("peak_heap", heap.peak);
+
+            std::ios init(nullptr);
+            init.copyfmt(std::cout);
+            std::cout << "subsystem             heap          peak\n";
+            for (std::size_t i = 0;
+                 i < static_cast<std::size_t>(memory::subsystem::COUNT); ++i) {
+                auto s = static_cast<memory::subsystem>(i);
+                memory::usage u = memory::subsystem_usage(s);
+                std::cout << std::left << std::setw(14)
+                          << memory::subsystem_name(s) << std::right
+                          << std::setw(10) << u.bytes << std::setw(14)
+                          << u.peak << '\n';
+                std::cout.copyfmt(init);
+                output::element("subsystems", memory::subsystem_name(s));
+                output::element("subsystem_heap", u.bytes);
+                output::element("subsystem_peak", u.peak);
+            }
+        }
+
+        void show_buffers() {
+            std::vector<buffer_memory> bufs = buffer_memory_usage();
+            if (bufs.empty()) return;
+
+            std::ios init(nullptr);
+            init.copyfmt(std::cout);
+            std::cout << "buffer    resident      mapped        heap"
+                         "       cache  name\n";
+            for (std::size_t i = 0; i < bufs.size(); ++i) {
+                buffer_memory const &m = bufs[i];
+                std::cout << '%' << std::left << std::setw(5) << i
+                          << std::right << std::setw(12) << m.resident
+                          << std::setw(12) << m.mapped << std::setw(12)
+                          << m.heap << std::setw(12) << m.cache << "  "
+                          << m.name << '\n';
+                std::cout.copyfmt(init);
+                output::element("buffer_resident", m.resident);
+                output::element("buffer_mapped", m.mapped);
+                output::element("buffer_heap", m.heap);
+                output::element("buffer_cache", m.cache);
+            }
+        }
+
+        int mem(std::vector<std::string> const &args) {
+            if (args.size() > 1) {
+                std::cout << "mem: Too many arguments.\n";
+                return 1;
+            }
+
+            store::stats st = store::statistics();
+            std::size_t stored = st.blocks * st.block_size;
+            double ratio = stored ? static_cast<double>(st.contents) / stored
+                                  : 1.0;
+
+            show_subsystems();
+
+            std::ios init(nullptr);
+            init.copyfmt(std::cout);
+            std::cout << "dedup         " << (dedup_enabled ? "ON" : "OFF")
+                      << '\n'
+                      << "block size    " << st.block_size << '\n'
+                      << "in store      " << st.buffers << " buffers\n"
+                      << "contents      " << st.contents << '\n'
+                      << "stored        " << stored << " (" << st.blocks
+                      << " blocks)\n"
+                      << "dedup ratio   " << std::fixed
+                      << std::setprecision(2) << ratio << '\n';
+            std::cout.copyfmt(init);
+
+            output::value("dedup", dedup_enabled);
+            output::value("block_size", st.block_size);
+            output::value("store_buffers", st.buffers);
+            output::value("contents", st.contents);
+            output::value("stored", stored);
+            output::value("dedup_ratio", ratio);
+
+            show_buffers();
+            return 0;
+        }
+    } // namespace
+
+    buffer_data::buffer_data(byte_buffer buf) {
+        std::size_t bs = block_size();
+        block_store &st = the_store();
+        if (!dedup_enabled || buf.size() < bs || !st.ready()) {
+            owned = std::make_shared<byte_buffer const>(std::move(buf));
+            return;
+        }
+
+        std::size_t n = (buf.size() + bs - 1) / bs;
+        std::vector<std::uint64_t> h(n);
+        parallel_for(n, 64, [&](std::size_t begin, std::size_t end) {
+            std::vector<std::uint8_t> last;
+            for (std::size_t i = begin; i < end; ++i) {
+                std::uint8_t const *block = buf.data() + i * bs;
+                if (buf.size() - i * bs < bs) {
+                    /* Partial block is stored padded with zeros. */
+                    last.assign(bs, 0);
+                    std::copy(block, block + (buf.size() - i * bs),
+                              last.begin());
+                    block = last.data();
+                }
+                h[i] = hash_block(block);
+            }
+        });
+
+        std::vector<std::uint32_t> s;
+        if (!st.add(buf.data(), buf.size(), h, s)) {
+            owned = std::make_shared<byte_buffer const>(std::move(buf));
+            return;
+        }
+        view = st.map(s);
+        if (!view) {
+            st.remove(s, buf.size());
+            owned = std::make_shared<byte_buffer const>(std::move(buf));
+            return;
+        }
+        view_size = buf.size();
+        slots = std::move(s);
+    }
+
+    buffer_data::buffer_data(buffer_data &&other) noexcept
+        : owned(std::move(other.owned)), view(other.view),
+          view_size(other.view_size), slots(std::move(other.slots)) {
+        other.view = nullptr;
+        other.view_size = 0;
+    }
+
+    buffer_data &buffer_data::operator=(buffer_data &&other) noexcept {
+        if (this != &other) {
+            release();
+            owned = std::move(other.owned);
+            view = other.view;
+            view_size = other.view_size;
+            slots = std::move(other.slots);
+            other.view = nullptr;
+            other.view_size = 0;
+        }
+        return *this;
+    }
+
+    buffer_data buffer_data::share() const {
+        if (view) {
+            block_store &st = the_store();
+            st.retain(slots, view_size);
+            if (std::uint8_t const *v = st.map(slots)) {
+                buffer_data copy;
+                copy.view = v;
+                copy.view_size = view_size;
+                copy.slots = slots;
+                return copy;
+            }
+            st.remove(slots, view_size);
+        }
+        buffer_data copy;
+        if (view) {
+            copy.owned = std::make_shared<byte_buffer const>(begin(), end());
+        } else {
+            copy.owned = owned;
+        }
+        return copy;
+    }
+
+    void buffer_data::release() noexcept {
+        if (!view) return;
+        ::munmap(const_cast<std::uint8_t *>(view), slots.size() * block_size());
+        the_store().remove(slots, view_size);
+        view = nullptr;
+        view_size = 0;
+        slots.clear();
+    }
+
+    namespace store {
+        bool enabled() { return dedup_enabled; }
+
+        void set_enabled(bool on) { dedup_enabled = on; }
+
+        stats statistics() { return the_store().statistics(); }
+    } // namespace store
+
+    std::size_t buffer_data::mapped() const {
+        if (view) return slots.size() * block_size();
+        std::size_t cap = owned ? owned->capacity() : 0;
+        return cap < large_block
+                   ? 0
+                   : (cap + large_block - 1) / large_block * large_block;
+    }
+
+    std::size_t buffer_data::heap() const {
+        std::size_t cap = owned ? owned->capacity() : 0;
+        return view || cap >= large_block ? 0 : cap;
+    }
+
+    std::size_t buffer_data::resident() const {
+        if (view) return memory::resident_bytes(view, view_size);
+        if (!owned) return 0;
+        return memory::resident_bytes(owned->data(), owned->capacity());
+    }
+
+    void store_init() { command_register("mem", &mem, &help_mem); }
+} // namespace ben
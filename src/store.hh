@@ -0,0 +1,105 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STORE_HH
+#define STORE_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "memory.hh"
+
+namespace ben {
+    /* Read-only contents of a buffer. Contents of at least one block
+       are kept in a content-addressed block store shared by every
+       buffer, so that identical blocks are stored once, and are read
+       through a mapping which lays the blocks out contiguously again.
+       Smaller contents, or all of them if the store is disabled or
+       unavailable, are kept as they are, shared by reference count
+       among copies made by share(). */
+    class buffer_data {
+        std::shared_ptr<byte_buffer const> owned;
+        std::uint8_t const *view = nullptr;
+        std::size_t view_size = 0;
+        /* Store slots of blocks mapped by view. */
+        std::vector<std::uint32_t> slots;
+
+        void release() noexcept;
+
+    public:
+        buffer_data() = default;
+        /* Takes contents from BUF. Not explicit, so that a freshly
+           filled byte_buffer can simply be assigned to a buffer. */
+        buffer_data(byte_buffer buf);
+        buffer_data(buffer_data &&other) noexcept;
+        buffer_data &operator=(buffer_data &&other) noexcept;
+        buffer_data(buffer_data const &) = delete;
+        buffer_data &operator=(buffer_data const &) = delete;
+        ~buffer_data() { release(); }
+
+        /* Returns the same contents without copying them, sharing
+           either blocks in the store or the contents themselves. */
+        buffer_data share() const;
+        /* True if contents outside the store are also used by another
+           buffer_data. */
+        bool shared() const { return owned && owned.use_count() > 1; }
+
+        /* Bytes of store blocks mapped for contents, or of contents
+           mapped directly as a large block. */
+        std::size_t mapped() const;
+        /* Bytes of contents allocated from the heap. */
+        std::size_t heap() const;
+        /* Bytes of the above present in memory. */
+        std::size_t resident() const;
+
+        std::uint8_t const *data() const {
+            return view ? view : owned ? owned->data() : nullptr;
+        }
+        std::size_t size() const {
+            return view ? view_size : owned ? owned->size() : 0;
+        }
+        bool empty() const { return size() == 0; }
+        std::uint8_t const &operator[](std::size_t i) const {
+            return data()[i];
+        }
+        std::uint8_t const *begin() const { return data(); }
+        std::uint8_t const *end() const { return data() + size(); }
+        std::uint8_t const *cbegin() const { return begin(); }
+        std::uint8_t const *cend() const { return end(); }
+    };
+
+    namespace store {
+        /* Whether buffers created from now on are deduplicated. */
+        bool enabled();
+        void set_enabled(bool on);
+
+        struct stats {
+            std::size_t block_size;
+            /* Buffers in the store and their total size. */
+            std::size_t buffers;
+            std::size_t contents;
+            /* Distinct blocks stored. */
+            std::size_t blocks;
+        };
+        stats statistics();
+    } // namespace store
+} // namespace ben
+
+#endif
@@ -0,0 +1,288 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "command.hh"
+#include "option.hh"
+#include "output.hh"
+#include "trace.hh"
+
+namespace ben {
+    namespace {
+        using clock = std::chrono::steady_clock;
+
+        /* Events kept per thread; 4 MiB each. */
+        constexpr std::size_t ring_size = 1 << 16;
+        constexpr std::size_t max_name = 40;
+
+        struct event {
+            std::int64_t begin;
+            std::int64_t end;
+            char const *category;
+            char name[max_name];
+        };
+
+        /* Written only by its thread. HEAD counts events ever
+           appended, and is published after the event is filled. */
+        struct ring {
+            std::unique_ptr<event[]> events{new event[ring_size]};
+            std::atomic<std::uint64_t> head{0};
+            std::thread::id thread = std::this_thread::get_id();
+        };
+
+        struct registry {
+            std::mutex mutex;
+            /* Rings outlive their threads, so that tasks of threads
+               removed by `mode threads' are still written. */
+            std::vector<std::unique_ptr<ring>> rings;
+        };
+
+        /* Never destroyed, as threads may record while exiting. */
+        registry &the_registry() {
+            static registry *r = new registry;
+            return *r;
+        }
+
+        std::atomic<bool> recording{false};
+        std::atomic<std::int64_t> epoch{0};
+        thread_local ring *local_ring = nullptr;
+
+        std::string path;
+        std::ofstream out;
+        std::thread::id main_thread;
+
+        std::int64_t clock_ns() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       clock::now().time_since_epoch())
+                .count();
+        }
+
+        std::int64_t now() {
+            return clock_ns() - epoch.load(std::memory_order_relaxed);
+        }
+
+        ring &this_ring() {
+            if (!local_ring) {
+                registry &reg = the_registry();
+                std::lock_guard<std::mutex> lock(reg.mutex);
+                reg.rings.push_back(std::make_unique<ring>());
+                local_ring = reg.rings.back().get();
+            }
+            return *local_ring;
+        }
+
+        void record(char const *category, std::string_view name,
+                    std::int64_t begin, std::int64_t end) {
+            ring &r = this_ring();
+            std::uint64_t h = r.head.load(std::memory_order_relaxed);
+            event &e = r.events[h % ring_size];
+            e.begin = begin;
+            e.end = end;
+            e.category = category;
+            std::size_t len = std::min(name.size(), max_name - 1);
+            std::memcpy(e.name, name.data(), len);
+            e.name[len] = '\0';
+            r.head.store(h + 1, std::memory_order_release);
+        }
+
+        void write_time(json_writer &w, std::int64_t ns) {
+            w.number(static_cast<double>(ns) / 1000);
+        }
+
+        /* Writes Chrome trace-event JSON of everything recorded.
+           Must be called while no thread records, as between
+           commands. Returns number of events written and sets
+           DROPPED to number of those overwritten. */
+        std::size_t write_trace(std::ostream &os, std::size_t &dropped) {
+            registry &reg = the_registry();
+            std::lock_guard<std::mutex> lock(reg.mutex);
+            std::int64_t pid = ::getpid();
+            std::string s;
+            json_writer w(s);
+            std::size_t count = 0;
+            dropped = 0;
+
+            w.raw("{\"traceEvents\":[");
+            for (std::size_t t = 0; t < reg.rings.size(); ++t) {
+                ring const &r = *reg.rings[t];
+                std::uint64_t h = r.head.load(std::memory_order_acquire);
+                if (h == 0) continue;
+                std::uint64_t first = h > ring_size ? h - ring_size : 0;
+                dropped += first;
+
+                if (count) w.raw(",");
+                w.raw("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":");
+                w.number(pid);
+                w.raw(",\"tid\":");
+                w.number(static_cast<std::uint64_t>(t));
+                w.raw(",\"args\":{\"name\":");
+                w.string(r.thread == main_thread
+                             ? "main"
+                             : "thread " + std::to_string(t));
+                w.raw("}}");
+
+                for (std::uint64_t i = first; i < h; ++i) {
+                    event const &e = r.events[i % ring_size];
+                    w.raw(",{\"name\":");
+                    w.string(e.name);
+                    w.raw(",\"cat\":");
+                    w.string(e.category);
+                    w.raw(",\"ph\":\"X\",\"ts\":");
+                    write_time(w, e.begin);
+                    w.raw(",\"dur\":");
+                    write_time(w, e.end - e.begin);
+                    w.raw(",\"pid\":");
+                    w.number(pid);
+                    w.raw(",\"tid\":");
+                    w.number(static_cast<std::uint64_t>(t));
+                    w.raw("}");
+                    ++count;
+                    if (s.size() >= 1 << 20) {
+                        os << s;
+                        s.clear();
+                    }
+                }
+            }
+            w.raw("],\"displayTimeUnit\":\"ms\"}\n");
+            os << s;
+            return count;
+        }
+
+        void help_trace([[maybe_unused]] std::string cmd) {
+            std::cout << R"(usage: trace [start FILE | stop]
+Record a timeline of what ben does, and write it to FILE on stop as
+Chrome trace-event JSON, which Perfetto or chrome://tracing can open.
+Recorded are commands, stages of parsing command lines, file loads
+and each task run by threads of parallel commands, every thread on
+its own track. Each thread keeps its latest 65536 events.
+Without arguments, show whether tracing is on.
+)";
+        }
+
+        int trace_command(std::vector<std::string> const &args) {
+            enum { START, STOP, INFO };
+            int sub;
+            std::string filename;
+            try {
+                option_matcher opt(args);
+                sub = opt.select_string({"start", "stop"}, INFO);
+                if (sub == START) filename = opt.get_string();
+                opt.must_not_remain();
+            } catch (std::runtime_error const &e) {
+                std::cout << "trace: " << e.what() << '\n';
+                return 1;
+            }
+
+            bool on = recording.load(std::memory_order_relaxed);
+            if (sub == INFO) {
+                if (on) {
+                    std::cout << "Tracing to " << path << '\n';
+                } else {
+                    std::cout << "Not tracing.\n";
+                }
+                output::value("tracing", on);
+                return 0;
+            }
+
+            if (sub == START) {
+                if (on) {
+                    std::cout << "trace: Already tracing to " << path
+                              << ".\n";
+                    return 1;
+                }
+                out.open(filename, std::ios::binary | std::ios::trunc);
+                if (!out) {
+                    std::cout << "trace: " << filename
+                              << ": Failed to open file.\n";
+                    return 1;
+                }
+                path = filename;
+                main_thread = std::this_thread::get_id();
+                registry &reg = the_registry();
+                {
+                    std::lock_guard<std::mutex> lock(reg.mutex);
+                    for (auto &r : reg.rings) {
+                        r->head.store(0, std::memory_order_relaxed);
+                    }
+                }
+                epoch.store(clock_ns(), std::memory_order_relaxed);
+                recording.store(true, std::memory_order_release);
+                return 0;
+            }
+
+            if (!on) {
+                std::cout << "trace: Not tracing.\n";
+                return 1;
+            }
+            recording.store(false, std::memory_order_release);
+            std::size_t dropped;
+            std::size_t count = write_trace(out, dropped);
+            out.close();
+            if (!out) {
+                std::cout << "trace: " << path
+                          << ": Failed to write file.\n";
+                return 1;
+            }
+            std::cout << count << " events written to " << path;
+            if (dropped) std::cout << " (" << dropped << " dropped)";
+            std::cout << '\n';
+            output::value("events", count);
+            output::value("dropped", dropped);
+            return 0;
+        }
+    } // namespace
+
+    namespace trace {
+        bool active() { return recording.load(std::memory_order_acquire); }
+
+        span::span(char const *category, std::string_view name)
+            : category(category), name(name), begin(active() ? now() : -1) {}
+
+        span::~span() {
+            if (begin < 0 || !active()) return;
+            try {
+                record(category, name, begin, now());
+            } catch (std::exception const &) {
+                /* Losing an event is better than failing the work. */
+            }
+        }
+    } // namespace trace
+
+    void trace_init() {
+        command_register("trace", &trace_command, &help_trace);
+    }
+} // namespace ben
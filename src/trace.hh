@@ -0,0 +1,52 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TRACE_HH
+#define TRACE_HH
+
+#include <cstdint>
+#include <string_view>
+
+namespace ben {
+    namespace trace {
+        /* True while `trace start' is recording. */
+        bool active();
+
+        /* Records the time from construction to destruction as an
+           event on the current thread's timeline, if tracing. Each
+           thread appends to its own ring buffer without locking; when
+           a ring is full, the oldest events are overwritten. NAME
+           must live as long as the span, and is recorded truncated
+           if long. */
+        class span {
+            char const *category;
+            std::string_view name;
+            /* Nanoseconds since trace start, or -1 if not recording. */
+            std::int64_t begin;
+
+        public:
+            span(char const *category, std::string_view name);
+            ~span();
+            span(span const &) = delete;
+            span &operator=(span const &) = delete;
+        };
+    } // namespace trace
+} // namespace ben
+
+#endif
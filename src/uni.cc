@@ -17,18 +17,29 @@
  */
 
 #include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
 
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
 #include <stdexcept>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "command.hh"
+#include "file.hh"
 #include "interactive.hh"
 #include "option.hh"
+#include "output.hh"
+
+extern char **environ;
 
 namespace ben {
     namespace {
@@ -49,34 +60,197 @@ namespace ben {
         }
 
         void help_command([[maybe_unused]] std::string cmd) {
-            std::cout << "usage: command COMMAND [ARG]...\n";
+            std::cout << R"(usage: command [--stdin LEN [BUF]] COMMAND [ARG]...
+Execute system COMMAND.
+With --stdin, LEN bytes from cursor of BUF are fed to standard input
+of COMMAND.
+)";
         }
 
-        int command(std::vector<std::string> const &args) {
-            if (args.size() < 2) return 0;
+        /* Writes [P, P + LEN) to non-blocking pipe FD. Pages are
+           mapped into the pipe with vmsplice rather than copied, so P
+           must stay unchanged until the reader consumes it. */
+        ssize_t feed_pipe(int fd, std::uint8_t const *p, std::size_t len) {
+#ifdef SPLICE_F_NONBLOCK
+            ::iovec iov = {const_cast<std::uint8_t *>(p), len};
+            ssize_t n = ::vmsplice(fd, &iov, 1, SPLICE_F_NONBLOCK);
+            if (n >= 0 || (errno != EINVAL && errno != ENOSYS)) return n;
+#endif
+            return ::write(fd, p, len);
+        }
 
-            ::pid_t pid = ::fork();
-            if (pid == -1) {
-                int errsave = errno;
-                std::cout << "command:" << std::strerror(errsave) << '\n';
-                return 1;
+        /* Pipes between ben and a child, closed on destruction. */
+        struct pipe_pair {
+            int fd[2] = {-1, -1};
+
+            pipe_pair() = default;
+            pipe_pair(pipe_pair const &) = delete;
+            pipe_pair &operator=(pipe_pair const &) = delete;
+            ~pipe_pair() {
+                close(0);
+                close(1);
             }
-            if (pid == 0) {
-                char *argv[args.size()];
-                for (unsigned int i = 1; i < args.size(); ++i) {
-                    argv[i - 1] = const_cast<char *>(args[i].c_str());
+
+            void open() {
+                if (::pipe2(fd, O_CLOEXEC)) {
+                    throw std::runtime_error(std::strerror(errno));
                 }
-                argv[args.size() - 1] = 0;
-                ::execvp(args[1].c_str(), argv);
+            }
 
-                int errsave = errno;
-                std::cout << "command: " << args[1] << ": "
-                          << ::strerror(errsave) << '\n';
-                std::exit(1);
+            void close(int i) {
+                if (fd[i] >= 0) ::close(fd[i]);
+                fd[i] = -1;
+            }
+        };
+
+        /* Runs ARGV with posix_spawnp, which shares address space with
+           ben until exec rather than copying its page tables, however
+           large the loaded buffers are. Feeds [IN, IN + IN_LEN) to the
+           child's stdin if FEED is set, and forwards its stdout
+           through std::cout while it is captured. Returns exit
+           status of the child. */
+        int spawn(std::vector<std::string> const &argv, std::uint8_t const *in,
+                  std::size_t in_len, bool feed) {
+            bool forward = output::captured();
+            pipe_pair in_pipe, out_pipe;
+            if (feed) in_pipe.open();
+            if (forward) out_pipe.open();
+
+            ::posix_spawn_file_actions_t actions;
+            ::posix_spawn_file_actions_init(&actions);
+            if (feed) {
+                ::posix_spawn_file_actions_adddup2(&actions, in_pipe.fd[0],
+                                                   STDIN_FILENO);
+            } else if (output::structured()) {
+                /* Stdin of ben carries the next requests. */
+                ::posix_spawn_file_actions_addopen(
+                    &actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+            }
+            if (forward) {
+                ::posix_spawn_file_actions_adddup2(&actions, out_pipe.fd[1],
+                                                   STDOUT_FILENO);
+            }
+
+            /* ben ignores SIGINT, and SIGPIPE while feeding stdin; the
+               child should not inherit that. */
+            ::posix_spawnattr_t attr;
+            ::posix_spawnattr_init(&attr);
+            ::sigset_t def;
+            sigemptyset(&def);
+            sigaddset(&def, SIGINT);
+            sigaddset(&def, SIGPIPE);
+            ::posix_spawnattr_setsigdefault(&attr, &def);
+            ::posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+            std::vector<char *> cargv;
+            for (std::string const &a : argv) {
+                cargv.push_back(const_cast<char *>(a.c_str()));
+            }
+            cargv.push_back(nullptr);
+
+            ::pid_t pid;
+            int err = ::posix_spawnp(&pid, cargv[0], &actions, &attr,
+                                     cargv.data(), environ);
+            ::posix_spawn_file_actions_destroy(&actions);
+            ::posix_spawnattr_destroy(&attr);
+            if (err) {
+                std::cout << "command: " << argv[0] << ": "
+                          << std::strerror(err) << '\n';
+                return 127;
+            }
+            in_pipe.close(0);
+            out_pipe.close(1);
+
+            struct sigaction ign = {}, saved_pipe;
+            ign.sa_handler = SIG_IGN;
+            ::sigaction(SIGPIPE, &ign, &saved_pipe);
+
+            if (feed) {
+                ::fcntl(in_pipe.fd[1], F_SETFL, O_NONBLOCK);
+                /* Fewer wakeups for large input; failure is harmless. */
+                ::fcntl(in_pipe.fd[1], F_SETPIPE_SZ, 1 << 20);
+                if (in_len == 0) in_pipe.close(1);
+            }
+            char buf[65536];
+            while (in_pipe.fd[1] >= 0 || out_pipe.fd[0] >= 0) {
+                ::pollfd fds[2] = {{in_pipe.fd[1], POLLOUT, 0},
+                                   {out_pipe.fd[0], POLLIN, 0}};
+                if (::poll(fds, 2, -1) < 0) {
+                    if (errno == EINTR) continue;
+                    break;
+                }
+                if (fds[0].revents) {
+                    ssize_t n = feed_pipe(in_pipe.fd[1], in, in_len);
+                    if (n > 0) {
+                        in += n;
+                        in_len -= n;
+                    }
+                    if ((n < 0 && errno != EAGAIN && errno != EINTR) ||
+                        in_len == 0) {
+                        /* Done, or child closed its stdin. */
+                        in_pipe.close(1);
+                    }
+                }
+                if (fds[1].revents) {
+                    ssize_t n = ::read(out_pipe.fd[0], buf, sizeof(buf));
+                    if (n > 0) {
+                        std::cout.write(buf, n);
+                    } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                        out_pipe.close(0);
+                    }
+                }
             }
+            ::sigaction(SIGPIPE, &saved_pipe, nullptr);
+
             int status;
-            ::waitpid(pid, &status, 0);
-            return status;
+            while (::waitpid(pid, &status, 0) < 0) {
+                if (errno != EINTR) return 1;
+            }
+            if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+            return WEXITSTATUS(status);
+        }
+
+        int command(std::vector<std::string> const &args) {
+            std::vector<std::string> argv;
+            file *f = nullptr;
+            std::size_t len = 0;
+            try {
+                option_matcher opt(args);
+                if (opt.try_select_string({"--stdin"}, 1) == 0) {
+                    len = opt.get_size();
+                    std::size_t next = args.size() - opt.remaining();
+                    if (next < args.size() && args[next][0] == '%') {
+                        f = opt.get_file_or_default();
+                    } else {
+                        f = get_file("");
+                        if (!f) {
+                            throw std::runtime_error(
+                                "No default buffer selected.");
+                        }
+                    }
+                    if (opt.remaining() == 0) {
+                        throw std::runtime_error("Mandatory argument omitted.");
+                    }
+                }
+                if (opt.remaining() == 0) return 0;
+                argv = opt.get_rest();
+            } catch (std::runtime_error const &e) {
+                std::cout << "command: " << e.what() << '\n';
+                return 1;
+            }
+
+            if (f && f->data.size() - f->cursor < len) {
+                std::cout << "command: LEN exceeds buffer.\n";
+                return 1;
+            }
+
+            try {
+                return spawn(argv, f ? f->data.data() + f->cursor : nullptr,
+                             len, f != nullptr);
+            } catch (std::runtime_error const &e) {
+                std::cout << "command: " << e.what() << '\n';
+                return 1;
+            }
         }
 
         int cd(std::vector<std::string> const &args) {
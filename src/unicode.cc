@@ -0,0 +1,478 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iomanip>
+#include <ios>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "command.hh"
+#include "cpu.hh"
+#include "file.hh"
+#include "option.hh"
+#include "parallel.hh"
+#include "unicode.hh"
+
+namespace ben {
+    void append_utf8(std::string &out, char32_t cp) {
+        if (cp < 0x80) {
+            out.push_back(cp);
+        } else if (cp < 0x800) {
+            out.push_back(0xc0 | cp >> 6);
+            out.push_back(0x80 | (cp & 0x3f));
+        } else if (cp < 0x10000) {
+            out.push_back(0xe0 | cp >> 12);
+            out.push_back(0x80 | (cp >> 6 & 0x3f));
+            out.push_back(0x80 | (cp & 0x3f));
+        } else {
+            out.push_back(0xf0 | cp >> 18);
+            out.push_back(0x80 | (cp >> 12 & 0x3f));
+            out.push_back(0x80 | (cp >> 6 & 0x3f));
+            out.push_back(0x80 | (cp & 0x3f));
+        }
+    }
+
+    namespace {
+        std::uint16_t load_unit(text_encoding enc, std::uint8_t const *p) {
+            if (enc == text_encoding::UTF16LE) return p[0] | p[1] << 8;
+            return p[0] << 8 | p[1];
+        }
+
+#ifdef __SSE2__
+        /* Lanes of 16 bytes which are printable ASCII. */
+        inline int ascii_printable_mask(__m128i v) {
+            /* Bytes above 0x7f are negative, so they fail the first test. */
+            __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)),
+                                       _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f)));
+            return _mm_movemask_epi8(ok);
+        }
+
+        /* Unsigned LO <= V <= HI for each 16-bit lane. */
+        inline __m128i in_range16(__m128i v, std::uint16_t lo,
+                                  std::uint16_t hi) {
+            __m128i t = _mm_xor_si128(_mm_sub_epi16(v, _mm_set1_epi16(lo)),
+                                      _mm_set1_epi16(-0x8000));
+            return _mm_cmplt_epi16(
+                t, _mm_set1_epi16(static_cast<std::int16_t>(
+                       (static_cast<std::uint32_t>(hi - lo) + 1) ^ 0x8000)));
+        }
+
+        inline __m128i load_units(text_encoding enc, std::uint8_t const *p) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            if (enc == text_encoding::UTF16BE)
+#else
+            if (enc == text_encoding::UTF16LE)
+#endif
+            {
+                v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            }
+            return v;
+        }
+
+        /* Lanes of 8 code units which are printable BMP characters
+           outside surrogate range. Each lane yields 2 bits. */
+        inline int bmp_printable_mask(__m128i v) {
+            __m128i ok = _mm_or_si128(
+                _mm_or_si128(in_range16(v, 0x20, 0x7e),
+                             in_range16(v, 0xa0, 0xd7ff)),
+                in_range16(v, 0xe000, 0xfffd));
+            return _mm_movemask_epi8(ok);
+        }
+#endif
+
+        /* Length of printable ASCII run at the beginning of P. */
+        std::size_t ascii_run_generic(std::uint8_t const *p, std::size_t len) {
+            std::size_t i = 0;
+            while (i < len && 0x20 <= p[i] && p[i] < 0x7f) ++i;
+            return i;
+        }
+
+#ifdef __SSE2__
+        std::size_t ascii_run_sse2(std::uint8_t const *p, std::size_t len) {
+            std::size_t i = 0;
+            for (; len - i >= 16; i += 16) {
+                int mask = ascii_printable_mask(
+                    _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i)));
+                if (mask != 0xffff) return i + __builtin_ctz(~mask);
+            }
+            return i + ascii_run_generic(p + i, len - i);
+        }
+#endif
+
+#ifdef HAVE_X86_DISPATCH
+        __attribute__((target("avx2"))) std::size_t
+        ascii_run_avx2(std::uint8_t const *p, std::size_t len) {
+            std::size_t i = 0;
+            for (; len - i >= 32; i += 32) {
+                __m256i v = _mm256_loadu_si256(
+                    reinterpret_cast<__m256i const *>(p + i));
+                __m256i ok = _mm256_and_si256(
+                    _mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x1f)),
+                    _mm256_cmpgt_epi8(_mm256_set1_epi8(0x7f), v));
+                unsigned int mask = _mm256_movemask_epi8(ok);
+                if (mask != 0xffffffff) return i + __builtin_ctz(~mask);
+            }
+            return i + ascii_run_generic(p + i, len - i);
+        }
+
+        __attribute__((target("avx512bw"))) std::size_t
+        ascii_run_avx512bw(std::uint8_t const *p, std::size_t len) {
+            std::size_t i = 0;
+            for (; len - i >= 64; i += 64) {
+                __m512i v = _mm512_loadu_si512(p + i);
+                std::uint64_t mask =
+                    _mm512_cmpgt_epi8_mask(v, _mm512_set1_epi8(0x1f)) &
+                    _mm512_cmplt_epi8_mask(v, _mm512_set1_epi8(0x7f));
+                if (~mask) return i + __builtin_ctzll(~mask);
+            }
+            return i + ascii_run_generic(p + i, len - i);
+        }
+#endif
+
+        std::size_t (*ascii_run)(std::uint8_t const *,
+                                 std::size_t) = ascii_run_generic;
+
+        char const *bind_ascii_run() {
+#ifdef HAVE_X86_DISPATCH
+            if (cpu::has(cpu::feature::AVX512BW)) {
+                ascii_run = ascii_run_avx512bw;
+                return "avx512bw";
+            }
+            if (cpu::has(cpu::feature::AVX2)) {
+                ascii_run = ascii_run_avx2;
+                return "avx2";
+            }
+#endif
+#ifdef __SSE2__
+            ascii_run = ascii_run_sse2;
+            return "sse2";
+#else
+            ascii_run = ascii_run_generic;
+            return "generic";
+#endif
+        }
+
+        std::size_t printable_run_utf8(std::uint8_t const *p,
+                                       std::size_t len) {
+            std::size_t i = 0;
+            while (i < len) {
+                i += ascii_run(p + i, len - i);
+                if (i >= len) break;
+                char32_t cp;
+                std::size_t n = decode_char(text_encoding::UTF8, p + i,
+                                            len - i, cp);
+                if (n == 0 || !is_printable(cp)) break;
+                i += n;
+            }
+            return i;
+        }
+
+        std::size_t printable_run_utf16(text_encoding enc,
+                                        std::uint8_t const *p,
+                                        std::size_t len) {
+            std::size_t i = 0;
+            while (len - i >= 2) {
+#ifdef __SSE2__
+                while (len - i >= 16) {
+                    int mask = bmp_printable_mask(load_units(enc, p + i));
+                    if (mask != 0xffff) {
+                        i += __builtin_ctz(~mask);
+                        break;
+                    }
+                    i += 16;
+                }
+                if (len - i < 2) break;
+#endif
+                char32_t cp;
+                std::size_t n = decode_char(enc, p + i, len - i, cp);
+                if (n == 0 || !is_printable(cp)) break;
+                i += n;
+            }
+            return i;
+        }
+
+        std::size_t count_chars(text_encoding enc, std::uint8_t const *p,
+                                std::size_t len) {
+            std::size_t n = 0;
+            if (enc == text_encoding::UTF16LE ||
+                enc == text_encoding::UTF16BE) {
+                for (std::size_t i = 0; i + 1 < len; i += 2) {
+                    std::uint16_t u = load_unit(enc, p + i);
+                    if (u < 0xdc00 || 0xdfff < u) ++n;
+                }
+            } else {
+                for (std::size_t i = 0; i < len; ++i) {
+                    if ((p[i] & 0xc0) != 0x80) ++n;
+                }
+            }
+            return n;
+        }
+
+        struct run {
+            std::size_t begin;
+            std::size_t end;
+        };
+
+        struct chunk_runs {
+            std::vector<run> runs;
+            /* Position the scan stopped at; not before end of chunk. */
+            std::size_t stop;
+        };
+
+        /* Collects runs beginning in [BEGIN, END). The last one is
+           followed beyond END until it terminates. Decoding is
+           self-synchronizing, so a scan started in the middle of a
+           character agrees with sequential scan within a character. */
+        void scan_runs(text_encoding enc, std::uint8_t const *data,
+                       std::size_t size, std::size_t begin, std::size_t end,
+                       chunk_runs &out) {
+            std::size_t i = begin;
+            std::size_t unit = unit_size(enc);
+            while (i < end) {
+                std::size_t n = printable_run(enc, data + i, size - i);
+                if (n) {
+                    out.runs.push_back({i, i + n});
+                    i += n;
+                    if (i >= end) break;
+                }
+                if (size - i < unit) {
+                    i = size;
+                    break;
+                }
+                char32_t cp;
+                std::size_t m = decode_char(enc, data + i, size - i, cp);
+                i += m ? m : unit;
+            }
+            out.stop = i;
+        }
+
+        std::vector<run> find_strings(text_encoding enc, file const *f,
+                                      std::size_t min_len) {
+            constexpr std::size_t chunk_size = 1 << 20;
+
+            std::uint8_t const *data = f->data.data();
+            std::size_t size = f->data.size();
+            std::vector<chunk_runs> chunks((size + chunk_size - 1) /
+                                           chunk_size);
+            parallel_for(size, chunk_size,
+                         [&](std::size_t begin, std::size_t end) {
+                             scan_runs(enc, data, size, begin, end,
+                                       chunks[begin / chunk_size]);
+                         });
+
+            std::vector<run> result;
+            std::size_t frontier = 0;
+            for (chunk_runs const &c : chunks) {
+                for (run const &r : c.runs) {
+                    /* Already reported by preceding chunk. */
+                    if (r.begin < frontier) continue;
+                    if (count_chars(enc, data + r.begin, r.end - r.begin) >=
+                        min_len) {
+                        result.push_back(r);
+                    }
+                }
+                if (c.stop > frontier) frontier = c.stop;
+            }
+            return result;
+        }
+
+        void help_strings([[maybe_unused]] std::string cmd) {
+            std::cout << R"(usage: strings [--ascii|--utf8|--utf16le|--utf16be] [MINLEN [BUF]]
+Print every run of at least MINLEN (default 4) printable characters
+in the buffer with its offset, like strings(1). Default encoding is
+UTF-8. UTF-16 strings are searched at even offsets.
+)";
+        }
+
+        int strings(std::vector<std::string> const &args) {
+            text_encoding enc;
+            std::size_t min_len;
+            file *f;
+            try {
+                option_matcher opt(args);
+                std::size_t e = opt.try_select_string(
+                    {"--ascii", "--utf8", "--utf16le", "--utf16be"}, 1);
+                enc = static_cast<text_encoding>(e);
+                min_len = opt.get_size(4);
+                f = opt.get_file_or_default();
+                opt.must_not_remain();
+            } catch (std::runtime_error const &e) {
+                std::cout << "strings: " << e.what() << '\n';
+                return 1;
+            }
+            if (min_len == 0) min_len = 1;
+
+            std::vector<run> found = find_strings(enc, f, min_len);
+
+            std::ios init(nullptr);
+            init.copyfmt(std::cout);
+            std::string line;
+            for (run const &r : found) {
+                line.clear();
+                transcode_to_utf8(enc, f->data.data() + r.begin,
+                                  r.end - r.begin, line);
+                std::cout << std::hex << std::setw(8) << std::setfill('0')
+                          << r.begin << ": " << line << '\n';
+            }
+            std::cout.copyfmt(init);
+
+            return 0;
+        }
+    } // namespace
+
+    bool is_printable(char32_t cp) {
+        if (cp < 0x20) return false;
+        if (cp < 0x7f) return true;
+        if (cp < 0xa0) return false;
+        if (0xd800 <= cp && cp <= 0xdfff) return false;
+        if ((cp & 0xfffe) == 0xfffe) return false;
+        return cp <= 0x10ffff;
+    }
+
+    std::size_t decode_char(text_encoding enc, std::uint8_t const *p,
+                            std::size_t len, char32_t &cp) {
+        if (len == 0) return 0;
+
+        switch (enc) {
+        case text_encoding::ASCII:
+            if (p[0] >= 0x80) return 0;
+            cp = p[0];
+            return 1;
+
+        case text_encoding::UTF8: {
+            std::uint8_t b0 = p[0];
+            if (b0 < 0x80) {
+                cp = b0;
+                return 1;
+            }
+            std::size_t n;
+            std::uint8_t lo = 0x80, hi = 0xbf;
+            if (b0 < 0xc2) {
+                return 0;
+            } else if (b0 < 0xe0) {
+                n = 2;
+                cp = b0 & 0x1f;
+            } else if (b0 < 0xf0) {
+                n = 3;
+                cp = b0 & 0x0f;
+                /* Reject overlong forms and surrogates. */
+                if (b0 == 0xe0) lo = 0xa0;
+                if (b0 == 0xed) hi = 0x9f;
+            } else if (b0 < 0xf5) {
+                n = 4;
+                cp = b0 & 0x07;
+                if (b0 == 0xf0) lo = 0x90;
+                if (b0 == 0xf4) hi = 0x8f;
+            } else {
+                return 0;
+            }
+            if (len < n) return 0;
+            if (p[1] < lo || hi < p[1]) return 0;
+            for (std::size_t i = 1; i < n; ++i) {
+                if ((p[i] & 0xc0) != 0x80) return 0;
+                cp = cp << 6 | (p[i] & 0x3f);
+            }
+            return n;
+        }
+
+        case text_encoding::UTF16LE:
+        case text_encoding::UTF16BE: {
+            if (len < 2) return 0;
+            std::uint16_t u = load_unit(enc, p);
+            if (u < 0xd800 || 0xdfff < u) {
+                cp = u;
+                return 2;
+            }
+            if (0xdbff < u || len < 4) return 0;
+            std::uint16_t l = load_unit(enc, p + 2);
+            if (l < 0xdc00 || 0xdfff < l) return 0;
+            cp = 0x10000 + ((u - 0xd800) << 10) + (l - 0xdc00);
+            return 4;
+        }
+        }
+        return 0;
+    }
+
+    std::size_t printable_run(text_encoding enc, std::uint8_t const *p,
+                              std::size_t len) {
+        switch (enc) {
+        case text_encoding::ASCII:
+            return ascii_run(p, len);
+        case text_encoding::UTF8:
+            return printable_run_utf8(p, len);
+        case text_encoding::UTF16LE:
+        case text_encoding::UTF16BE:
+            return printable_run_utf16(enc, p, len);
+        }
+        return 0;
+    }
+
+    void transcode_to_utf8(text_encoding enc, std::uint8_t const *p,
+                           std::size_t len, std::string &out) {
+        if (enc == text_encoding::ASCII || enc == text_encoding::UTF8) {
+            out.append(reinterpret_cast<char const *>(p), len);
+            return;
+        }
+
+        out.reserve(out.size() + len);
+        std::size_t i = 0;
+        while (len - i >= 2) {
+#ifdef __SSE2__
+            /* Narrow 8 units at once while they are all ASCII. */
+            while (len - i >= 16) {
+                __m128i v = load_units(enc, p + i);
+                __m128i high = _mm_and_si128(v, _mm_set1_epi16(-0x80));
+                if (_mm_movemask_epi8(_mm_cmpeq_epi16(
+                        high, _mm_setzero_si128())) != 0xffff) {
+                    break;
+                }
+                char narrow[16];
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(narrow),
+                                 _mm_packus_epi16(v, v));
+                out.append(narrow, 8);
+                i += 16;
+            }
+            if (len - i < 2) break;
+#endif
+            char32_t cp;
+            std::size_t n = decode_char(enc, p + i, len - i, cp);
+            if (n == 0) break;
+            append_utf8(out, cp);
+            i += n;
+        }
+    }
+
+    void unicode_init() {
+        command_register("strings", &strings, &help_strings);
+        cpu::register_kernel("printable", &bind_ascii_run);
+    }
+} // namespace ben
@@ -0,0 +1,56 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNICODE_HH
+#define UNICODE_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace ben {
+    enum class text_encoding { ASCII, UTF8, UTF16LE, UTF16BE };
+
+    /* Returns size of the smallest unit of ENC in bytes. */
+    inline std::size_t unit_size(text_encoding enc) {
+        return enc == text_encoding::UTF16LE || enc == text_encoding::UTF16BE
+                   ? 2
+                   : 1;
+    }
+
+    bool is_printable(char32_t cp);
+
+    /* Appends code point CP to OUT encoded as UTF-8. */
+    void append_utf8(std::string &out, char32_t cp);
+
+    /* Decodes a character at P and stores it to CP. Returns number of
+       bytes consumed, or 0 if P does not begin with valid character. */
+    std::size_t decode_char(text_encoding enc, std::uint8_t const *p,
+                            std::size_t len, char32_t &cp);
+
+    /* Returns length in bytes of the longest run of valid printable
+       characters at the beginning of P. */
+    std::size_t printable_run(text_encoding enc, std::uint8_t const *p,
+                              std::size_t len);
+
+    /* Appends P to OUT as UTF-8. P must be a valid run. */
+    void transcode_to_utf8(text_encoding enc, std::uint8_t const *p,
+                           std::size_t len, std::string &out);
+} // namespace ben
+
+#endif
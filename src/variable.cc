@@ -21,6 +21,7 @@
 #include <strings.h>
 #include <unordered_map>
 
+#include "memory.hh"
 #include "variable.hh"
 
 namespace ben {
@@ -37,6 +38,7 @@ namespace ben {
     }
 
     void add_variable(std::string const &key, std::string const &value) {
+        memory::charge_scope scope(memory::subsystem::VARIABLES);
         variable_map[key] = value;
     }
 
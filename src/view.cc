@@ -0,0 +1,510 @@
+/*
+ * Interactive binary viewer.
+ * Copyright (C) 2020  Koki Fukuda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "command.hh"
+#include "file.hh"
+#include "option.hh"
+
+namespace ben {
+    namespace {
+        constexpr std::size_t bytes_per_row = 16;
+        /* How long to wait for the rest of an escape sequence before
+           taking ESC as a key by itself, in milliseconds. */
+        constexpr int escape_timeout = 50;
+
+        enum class attr : std::uint8_t { NORMAL, CURSOR, STATUS };
+
+        struct cell {
+            char ch = ' ';
+            attr at = attr::NORMAL;
+
+            bool operator==(cell const &other) const {
+                return ch == other.ch && at == other.at;
+            }
+            bool operator!=(cell const &other) const {
+                return !(*this == other);
+            }
+        };
+
+        volatile std::sig_atomic_t resized = 0;
+
+        void on_winch(int) { resized = 1; }
+
+        /* Puts the terminal in raw mode on the alternate screen, and
+           restores it when destroyed. */
+        class raw_terminal {
+            termios saved;
+            struct sigaction saved_winch;
+
+        public:
+            raw_terminal() {
+                if (tcgetattr(STDIN_FILENO, &saved) < 0) {
+                    throw std::runtime_error(std::strerror(errno));
+                }
+                termios raw = saved;
+                raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+                raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+                raw.c_cc[VMIN] = 1;
+                raw.c_cc[VTIME] = 0;
+                tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+
+                struct sigaction sa = {};
+                sa.sa_handler = &on_winch;
+                sigemptyset(&sa.sa_mask);
+                sigaction(SIGWINCH, &sa, &saved_winch);
+
+                write_all("\033[?1049h\033[?25l");
+            }
+
+            ~raw_terminal() {
+                write_all("\033[0m\033[?25h\033[?1049l");
+                sigaction(SIGWINCH, &saved_winch, nullptr);
+                tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved);
+            }
+
+            raw_terminal(raw_terminal const &) = delete;
+            raw_terminal &operator=(raw_terminal const &) = delete;
+
+            static void write_all(std::string const &s) {
+                char const *p = s.data();
+                std::size_t left = s.size();
+                while (left) {
+                    ssize_t n = ::write(STDOUT_FILENO, p, left);
+                    if (n < 0) {
+                        if (errno == EINTR) continue;
+                        return;
+                    }
+                    p += n;
+                    left -= n;
+                }
+            }
+        };
+
+        /*
+         * Screen model. Frames are drawn into BACK, and present() sends
+         * only cells differing from FRONT, which mirrors what the
+         * terminal shows, in a single write.
+         */
+        class screen {
+            int rows = 0;
+            int cols = 0;
+            std::vector<cell> front;
+            std::vector<cell> back;
+
+        public:
+            void resize() {
+                winsize ws;
+                if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) < 0 ||
+                    ws.ws_row == 0 || ws.ws_col == 0) {
+                    ws.ws_row = 24;
+                    ws.ws_col = 80;
+                }
+                rows = ws.ws_row;
+                cols = ws.ws_col;
+                back.assign(rows * cols, cell());
+                /* Unknown contents; force every cell to be drawn. */
+                front.assign(rows * cols, cell{'\0', attr::NORMAL});
+                raw_terminal::write_all("\033[0m\033[2J");
+            }
+
+            int height() const { return rows; }
+
+            void clear() { std::fill(back.begin(), back.end(), cell()); }
+
+            void put(int row, int col, std::string const &s,
+                     attr at = attr::NORMAL) {
+                if (row < 0 || row >= rows) return;
+                for (char c : s) {
+                    if (col >= cols) break;
+                    if (col >= 0) back[row * cols + col] = {c, at};
+                    ++col;
+                }
+            }
+
+            void fill_row(int row, attr at) {
+                if (row < 0 || row >= rows) return;
+                for (int c = 0; c < cols; ++c) back[row * cols + c].at = at;
+            }
+
+            void present() {
+                static char const *const sgr[] = {"\033[0m", "\033[0;1;7m",
+                                                  "\033[0;7m"};
+                std::string out;
+                attr current = attr::NORMAL;
+                bool sgr_known = false;
+
+                for (int r = 0; r < rows; ++r) {
+                    cell const *f = &front[r * cols];
+                    cell const *b = &back[r * cols];
+                    int c = 0;
+                    while (c < cols) {
+                        if (f[c] == b[c]) {
+                            ++c;
+                            continue;
+                        }
+                        /* Extend the run over short unchanged gaps, which
+                           is cheaper than another cursor movement. */
+                        int end = c + 1;
+                        for (int gap = 0; end < cols && gap < 8; ++end) {
+                            gap = f[end] == b[end] ? gap + 1 : 0;
+                        }
+                        while (f[end - 1] == b[end - 1]) --end;
+
+                        out += "\033[" + std::to_string(r + 1) + ';' +
+                               std::to_string(c + 1) + 'H';
+                        for (; c < end; ++c) {
+                            if (!sgr_known || b[c].at != current) {
+                                current = b[c].at;
+                                sgr_known = true;
+                                out += sgr[static_cast<int>(current)];
+                            }
+                            out += b[c].ch;
+                        }
+                    }
+                }
+                if (out.empty()) return;
+
+                out += "\033[0m";
+                raw_terminal::write_all(out);
+                front = back;
+            }
+        };
+
+        enum class key { NONE, UP, DOWN, LEFT, RIGHT, PGUP, PGDN, HOME, END,
+                         QUIT };
+
+        /* Parses one key from the beginning of P. Returns number of bytes
+           consumed, or 0 if P holds only the beginning of an escape
+           sequence. Unknown sequences are consumed and ignored. */
+        std::size_t parse_key(char const *p, std::size_t len, key &k) {
+            static struct {
+                char const *seq;
+                key k;
+            } const seqs[] = {
+                {"\033[A", key::UP},    {"\033[B", key::DOWN},
+                {"\033[C", key::RIGHT}, {"\033[D", key::LEFT},
+                {"\033OA", key::UP},    {"\033OB", key::DOWN},
+                {"\033OC", key::RIGHT}, {"\033OD", key::LEFT},
+                {"\033[5~", key::PGUP}, {"\033[6~", key::PGDN},
+                {"\033[H", key::HOME},  {"\033[1~", key::HOME},
+                {"\033OH", key::HOME},  {"\033[F", key::END},
+                {"\033[4~", key::END},  {"\033OF", key::END},
+            };
+
+            k = key::NONE;
+            if (p[0] != '\033') {
+                switch (p[0]) {
+                case 'k':
+                    k = key::UP;
+                    break;
+                case 'j':
+                    k = key::DOWN;
+                    break;
+                case 'h':
+                    k = key::LEFT;
+                    break;
+                case 'l':
+                    k = key::RIGHT;
+                    break;
+                case 'b':
+                case '\x02':
+                    k = key::PGUP;
+                    break;
+                case ' ':
+                case 'f':
+                case '\x06':
+                    k = key::PGDN;
+                    break;
+                case 'g':
+                    k = key::HOME;
+                    break;
+                case 'G':
+                    k = key::END;
+                    break;
+                case 'q':
+                case '\x03':
+                    k = key::QUIT;
+                    break;
+                }
+                return 1;
+            }
+
+            if (len == 1) return 0;
+            for (auto const &s : seqs) {
+                std::size_t n = std::strlen(s.seq);
+                if (std::memcmp(p, s.seq, std::min(n, len)) != 0) continue;
+                if (n > len) return 0;
+                k = s.k;
+                return n;
+            }
+            /* Skip an unknown CSI sequence up to its final byte. */
+            std::size_t n = 2;
+            if (p[1] == '[') {
+                while (n < len && !(p[n] >= 0x40 && p[n] <= 0x7e)) ++n;
+                if (n == len) return 0;
+                ++n;
+            }
+            return n;
+        }
+
+        class hex_view {
+            file *f;
+            std::string title;
+            screen scr;
+            std::size_t top = 0;
+
+            int data_rows() const { return std::max(scr.height() - 1, 1); }
+
+            void move(std::ptrdiff_t delta) {
+                std::size_t size = f->data.size();
+                if (size == 0) return;
+                std::ptrdiff_t pos = static_cast<std::ptrdiff_t>(f->cursor) +
+                                     delta;
+                if (pos < 0) {
+                    /* Keep column when moving up from the first row. */
+                    pos = delta < -1 ? f->cursor % bytes_per_row : 0;
+                } else if (static_cast<std::size_t>(pos) >= size) {
+                    pos = size - 1;
+                }
+                f->cursor = pos;
+                f->bit_cursor = 0;
+            }
+
+            void apply(key k) {
+                std::ptrdiff_t page = data_rows() * bytes_per_row;
+                switch (k) {
+                case key::UP:
+                    move(-static_cast<std::ptrdiff_t>(bytes_per_row));
+                    break;
+                case key::DOWN:
+                    if (f->cursor + bytes_per_row < f->data.size()) {
+                        move(bytes_per_row);
+                    }
+                    break;
+                case key::LEFT:
+                    move(-1);
+                    break;
+                case key::RIGHT:
+                    move(1);
+                    break;
+                case key::PGUP:
+                    move(-page);
+                    break;
+                case key::PGDN:
+                    move(page);
+                    break;
+                case key::HOME:
+                    move(-static_cast<std::ptrdiff_t>(f->cursor));
+                    break;
+                case key::END:
+                    move(f->data.size());
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            /* Scrolls as little as possible to keep cursor visible. */
+            void scroll() {
+                std::size_t row = f->cursor / bytes_per_row;
+                std::size_t rows = data_rows();
+                if (row < top) {
+                    top = row;
+                } else if (row >= top + rows) {
+                    top = row - rows + 1;
+                }
+            }
+
+            void draw_row(int r, std::size_t line) {
+                static char const hex[] = "0123456789abcdef";
+                std::size_t base = line * bytes_per_row;
+                if (base >= f->data.size()) return;
+
+                char addr[20];
+                std::snprintf(addr, sizeof(addr), "%08zx: ", base);
+                scr.put(r, 0, addr);
+
+                for (std::size_t i = 0; i < bytes_per_row; ++i) {
+                    std::size_t pos = base + i;
+                    if (pos >= f->data.size()) break;
+                    std::uint8_t b = f->data[pos];
+                    attr at = pos == f->cursor ? attr::CURSOR : attr::NORMAL;
+                    int col = 10 + i / 2 * 5 + i % 2 * 2;
+                    scr.put(r, col, {hex[b >> 4], hex[b & 0xf]}, at);
+                    scr.put(r, 51 + i,
+                            std::string(1, std::isprint(b) ? b : '.'), at);
+                }
+            }
+
+            void draw_status() {
+                int r = scr.height() - 1;
+                char buf[128];
+                std::snprintf(buf, sizeof(buf),
+                              " %s  %08zx / %08zx  q:quit hjkl/arrows:move "
+                              "b/f:page g/G:top/end",
+                              title.c_str(), f->cursor, f->data.size());
+                scr.fill_row(r, attr::STATUS);
+                scr.put(r, 0, buf, attr::STATUS);
+            }
+
+            void render() {
+                scroll();
+                scr.clear();
+                for (int r = 0; r < data_rows() && r < scr.height(); ++r) {
+                    draw_row(r, top + r);
+                }
+                if (scr.height() > 1) draw_status();
+                scr.present();
+            }
+
+        public:
+            hex_view(file *f, std::string title)
+                : f(f), title(std::move(title)) {}
+
+            void run() {
+                raw_terminal term;
+                scr.resize();
+
+                char buf[256];
+                /* Bytes at the beginning of BUF holding an escape
+                   sequence whose rest has not arrived yet. */
+                std::size_t kept = 0;
+                for (;;) {
+                    if (resized) {
+                        resized = 0;
+                        scr.resize();
+                    }
+                    render();
+
+                    if (kept) {
+                        pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+                        int r = poll(&pfd, 1, escape_timeout);
+                        if (r < 0 && errno == EINTR) continue;
+                        if (r == 0) {
+                            /* ESC by itself quits; a broken sequence
+                               is dropped. */
+                            if (kept == 1) return;
+                            kept = 0;
+                            continue;
+                        }
+                    }
+
+                    ssize_t n = ::read(STDIN_FILENO, buf + kept,
+                                       sizeof(buf) - kept);
+                    if (n < 0) {
+                        if (errno == EINTR) continue;
+                        return;
+                    }
+                    if (n == 0) return;
+
+                    /* Handle every key already queued before drawing the
+                       next frame, so auto-repeat over a slow link does
+                       not lag behind by one frame per key. */
+                    std::size_t len = kept + n;
+                    pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+                    while (len < sizeof(buf) && poll(&pfd, 1, 0) > 0) {
+                        n = ::read(STDIN_FILENO, buf + len,
+                                   sizeof(buf) - len);
+                        if (n <= 0) break;
+                        len += n;
+                    }
+
+                    std::size_t i = 0;
+                    while (i < len) {
+                        key k;
+                        std::size_t used = parse_key(buf + i, len - i, k);
+                        if (used == 0) break;
+                        i += used;
+                        if (k == key::QUIT) return;
+                        apply(k);
+                    }
+                    /* Keep an incomplete sequence for the next read,
+                       unless it fills the whole buffer. */
+                    kept = len - i < sizeof(buf) ? len - i : 0;
+                    std::memmove(buf, buf + i, kept);
+                }
+            }
+        };
+
+        void help_view([[maybe_unused]] std::string cmd) {
+            std::cout << R"(usage: view [BUF]
+Show the buffer in a full-screen hex view.
+Cursor of the buffer follows the view and stays where it is left.
+Keys;
+  h j k l, arrows    move cursor
+  b f, PgUp PgDn     move by a page
+  g G, Home End      go to the beginning or the end
+  q, Esc             leave the view
+Only changed cells are redrawn, with one write per frame.
+)";
+        }
+
+        int view(std::vector<std::string> const &args) {
+            file *f;
+            try {
+                option_matcher opt(args);
+                f = opt.get_file_or_default();
+                opt.must_not_remain();
+            } catch (std::runtime_error const &e) {
+                std::cout << "view: " << e.what() << '\n';
+                return 1;
+            }
+
+            if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO)) {
+                std::cout << "view: Not a terminal.\n";
+                return 1;
+            }
+
+            std::string title = f->filename;
+            std::size_t i = file_index(f);
+            if (i < file_count()) {
+                title = '%' + std::to_string(i) + ' ' + title;
+            }
+
+            std::cout.flush();
+            try {
+                hex_view(f, title).run();
+            } catch (std::runtime_error const &e) {
+                std::cout << "view: " << e.what() << '\n';
+                return 1;
+            }
+            return 0;
+        }
+    } // namespace
+
+    void view_init() { command_register("view", &view, &help_view); }
+} // namespace ben
@@ -23,13 +23,16 @@
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <zlib.h>
 
 #include "command.hh"
 #include "file.hh"
+#include "memory.hh"
 #include "option.hh"
+#include "output.hh"
 
 namespace ben {
     namespace {
@@ -40,12 +43,12 @@ byte array as a new buffer.
 )";
         }
 
-        std::vector<std::uint8_t>
+        byte_buffer
         zlib_inflate(std::unique_ptr<unsigned char[]> buf, std::size_t len) {
             int z_ret;
             z_stream strm;
-            strm.zalloc = Z_NULL;
-            strm.zfree = Z_NULL;
+            strm.zalloc = memory::zlib_alloc;
+            strm.zfree = memory::zlib_free;
             strm.opaque = Z_NULL;
             strm.avail_in = 0;
             strm.next_in = Z_NULL;
@@ -53,7 +56,7 @@ byte array as a new buffer.
             if (inflateInit(&strm) != Z_OK) {
                 throw std::runtime_error("Failed to initialize zlib.");
             }
-            std::vector<std::uint8_t> result;
+            byte_buffer result;
             unsigned char out[1024];
 
             strm.avail_in = len;
@@ -112,15 +115,17 @@ byte array as a new buffer.
             }
 
             try {
+                memory::charge_scope scope(memory::subsystem::DECOMPRESSION);
                 std::unique_ptr<unsigned char[]> buf =
                     std::make_unique<unsigned char[]>(len);
                 std::copy(f->data.cbegin() + f->cursor,
                           f->data.cbegin() + f->cursor + len, buf.get());
-                std::vector<std::uint8_t> result =
-                    zlib_inflate(std::move(buf), len);
+                byte_buffer result = zlib_inflate(std::move(buf), len);
                 int han = add_file_buffer(
-                    f->filename + "#z" + std::to_string(f->cursor), result);
+                    f->filename + "#z" + std::to_string(f->cursor),
+                    std::move(result));
                 std::cout << "Added as %" << han << '\n';
+                output::value("buffer", han);
             } catch (std::exception const &e) {
                 std::cout << e.what() << '\n';
                 return 1;